@@ -51,6 +51,10 @@ void ISP::init()
     ISP_CLK_0
     ISP_MCLR_D_0
     ISP_MCLR_1    
+
+    // free running Timer1 used to time the programming cycles
+    TCCR1A = 0;
+    TCCR1B = _BV(CS11) | _BV(CS10);     // F_CPU/64
 }
 
 void ISP::send(uint16_t data, const uint8_t n)
@@ -122,6 +126,21 @@ void ISP::readPgm(uint16_t* data, uint8_t n)
     }    
 }
 
+uint16_t ISP::findNonBlank(uint16_t n, uint16_t &word)
+{
+    for (uint16_t i=0; i<n; i++)
+    {
+        send(0x04, 6);      // Read Data From Program Memory
+        word = read14s();
+        if (word != 0x3FFF)
+        {
+            return i;
+        }
+        incrementPointer();
+    }
+    return n;
+}
+
 uint16_t ISP::read14s(void)
 {
     return (read16() & 0x7FFE) >> 1;
@@ -129,6 +148,14 @@ uint16_t ISP::read14s(void)
 
 void ISP::writePgm(uint16_t *data, uint8_t n)
 {
+    beginWritePgm(data, n);
+    waitWriteDone();
+}
+
+void ISP::beginWritePgm(uint16_t *data, uint8_t n)
+{
+    waitWriteDone();
+
     for (uint8_t i=0; i<n; i++)  
     {
         send(0x02,6);   // load data for program memory
@@ -143,11 +170,39 @@ void ISP::writePgm(uint16_t *data, uint8_t n)
     
     const uint8_t slow = 1;
 
-    if (slow==1)
-        _delay_ms(5);
-    else
-        _delay_ms(3);
+    m_writeStart   = TCNT1;
+    m_writeTicks   = ((slow==1) ? 5 : 3) * c_ticksPerMs;
+    m_writePending = true;
+}
+
+bool ISP::isBusy()
+{
+    if (!m_writePending)
+    {
+        return false;
+    }
+
+    const uint16_t elapsed = TCNT1 - m_writeStart;
+    if (elapsed >= m_writeTicks)
+    {
+        // make sure a counter wrap-around does not
+        // restart the wait if we are polled late.
+        m_writeTicks = 0;
+        return false;
+    }
+    return true;
+}
+
+void ISP::waitWriteDone()
+{
+    if (!m_writePending)
+    {
+        return;
+    }
+
+    while(isBusy()) {};
 
+    m_writePending = false;
     incrementPointer();
 }
 
@@ -155,6 +210,7 @@ void ISP::loadConfig(uint16_t data)
 {
     send(0x00, 6);      // Load Configuration 
     send(data, 16);
+    m_address = 0x8000;
 }
 
 void ISP::massErase()
@@ -164,14 +220,35 @@ void ISP::massErase()
     _delay_ms(10);
 }
 
+void ISP::rowErase()
+{
+    send(0x11, 6);      // internally timed row erase
+    _delay_us(2500);    // TERAR
+}
+
 void ISP::resetPointer()
 {
     send(0x16,6);
+    m_address = 0;
 }
 
 void ISP::incrementPointer()
 {
     send(0x06,6);
+    m_address++;
+}
+
+void ISP::seek(uint16_t address)
+{
+    if ((address < m_address) || (m_address >= 0x8000))
+    {
+        resetPointer();
+    }
+
+    while(m_address < address)
+    {
+        incrementPointer();
+    }
 }
 
 void ISP::enterProgMode()
@@ -184,6 +261,7 @@ void ISP::enterProgMode()
     send(0b01000011,8);
     send(0b01001101,8);
     send(0,1);
+    m_address = 0;      // the device resets its pointer on entry
 }
 
 void ISP::exitProgMode()
@@ -204,6 +282,7 @@ void ISP::enterProgModeWithPGMPin()
     _delay_us(1);       // spec is min. 100ns for PIC16F87X
     ISP_MCLR_1
     _delay_us(300);      // spec is min. 5us for PIC16F87X
+    m_address = 0;
 }
 
 void ISP::exitProgModeWithPGMPin()
@@ -18,8 +18,24 @@ public:
     uint8_t  read8(void);
     
     void readPgm(uint16_t* data, uint8_t n);
+
+    /** read up to n words from the pointer and stop at the first one
+        that is not blank (0x3FFF). returns the number of blank words 
+        read before it, n if all are blank. */
+    uint16_t findNonBlank(uint16_t n, uint16_t &word);
     void writePgm(uint16_t* data, uint8_t n);
 
+    /** load the data latches and start internally timed programming,
+        without waiting for it to finish. */
+    void beginWritePgm(uint16_t* data, uint8_t n);
+
+    /** true while an internally timed write is in progress */
+    bool isBusy();
+
+    /** wait for a write started by beginWritePgm to finish and
+        advance the pointer past it. Does nothing when idle. */
+    void waitWriteDone();
+
     void enterProgMode();
     void exitProgMode();
 
@@ -27,13 +43,30 @@ public:
     void exitProgModeWithPGMPin();
 
     void massErase(void);
+
+    /** erase the row of program memory that holds the pointer */
+    void rowErase(void);
     void resetPointer(void);
     void incrementPointer();
 
+    /** move the pointer to a program memory word address. The pointer 
+        can only be incremented, so moving backwards starts from 0. */
+    void seek(uint16_t address);
+
     void loadConfig(uint16_t data);
     void send_8_msb(unsigned char data);
 
-    constexpr static uint16_t c_bufsize = 260;
+    /** a frame payload is at most 255 bytes, so 127 words */
+    constexpr static uint16_t c_bufsize = 128;
 
     uint16_t m_flashBuffer[c_bufsize];
+
+protected:
+    /** Timer1 runs at F_CPU/64 = 4us per tick */
+    constexpr static uint16_t c_ticksPerMs = 250;
+
+    uint16_t m_address      = 0;        ///< address the device pointer is at, 0x8000 and up is configuration space
+    bool     m_writePending = false;    ///< a write was started and the pointer not yet advanced
+    uint16_t m_writeStart   = 0;        ///< Timer1 count when programming started
+    uint16_t m_writeTicks   = 0;        ///< programming time in Timer1 ticks
 };
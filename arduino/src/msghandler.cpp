@@ -2,6 +2,7 @@
 #include <avr/io.h>
 #include "msghandler.h"
 #include "../../src/pgmops.h"
+#include "../../src/framing.h"
 
 void MessageHandler::init()
 {
@@ -25,79 +26,304 @@ bool MessageHandler::loop()
 {
     while(m_uart.hasData())
     {
-        switch(m_rxState)
+        const uint8_t byte = m_uart.read();
+        if (byte != Framing::c_delimiter)
         {
-        case RxState::START:
-            m_bufferIdx = 0;
-            m_buffer[m_bufferIdx++] = m_uart.read();
-            m_rxState = RxState::PAYLOADSIZE;
-            break;
-        case RxState::PAYLOADSIZE:
-            m_bytesToReceive = m_uart.read();
-            if (m_bytesToReceive >= c_bufsize)
+            if (m_rxLen < c_bufsize)
             {
-                m_bytesToReceive = c_bufsize-1;
+                m_buffer[m_rxLen++] = byte;
             }
-
-            m_buffer[m_bufferIdx++] = m_bytesToReceive;
-            if (m_bytesToReceive == 0)
+            else
             {
-                m_rxState = RxState::START;
-                return true;
+                m_rxOverflow = true;
             }
-            m_rxState = RxState::PAYLOAD;
-            break;
-        case RxState::PAYLOAD:
-            m_buffer[m_bufferIdx++] = m_uart.read();
-            m_bytesToReceive--;
-            if (m_bytesToReceive==0)
+            continue;
+        }
+
+        // end of frame
+        const uint16_t encodedLen = m_rxLen;
+        const bool overflow = m_rxOverflow || m_uart.hasOverflowed();
+        m_rxLen = 0;
+        m_rxOverflow = false;
+        m_uart.clearOverflow();
+
+        if ((encodedLen == 0) && !overflow)
+        {
+            continue;   // back-to-back delimiters
+        }
+
+        // layout after decoding: opcode, length, payload, seq, CRC
+        const uint16_t rawLen = overflow ? 0 : Framing::cobsDecode(m_buffer, encodedLen, m_buffer);
+        if ((rawLen >= (2 + Framing::c_trailerSize)) 
+            && (m_buffer[1] == (rawLen - 2 - Framing::c_trailerSize)))
+        {
+            m_bufferIdx = rawLen - Framing::c_trailerSize;
+            const uint16_t crc = m_buffer[m_bufferIdx+1] | (static_cast<uint16_t>(m_buffer[m_bufferIdx+2]) << 8);
+            if (Framing::crc16(m_buffer, m_bufferIdx+1) == crc)
             {
-                m_rxState = RxState::START;
+                m_rxSeq = m_buffer[m_bufferIdx];
                 return true;
             }
-            break;
         }
+
+        // let the host know right away so it does not wait for a timeout
+        sendStatus(c_replyCorrupt, m_lastSeq + 1);
     }
     return false;
 }
 
-// FIXME: we really should change this to COBS encoding
-void MessageHandler::tick()
+void MessageHandler::reply(uint8_t byte)
+{
+    if (m_replyLen < c_replySize)
+    {
+        m_reply[m_replyLen++] = byte;
+    }
+}
+
+void MessageHandler::sendFrame(const uint8_t *raw, uint16_t len)
+{
+    Framing::cobsEncode(raw, len, [this](uint8_t b)
+        {
+            m_uart.write(b);
+        }
+    );
+    m_uart.write(Framing::c_delimiter);
+}
+
+void MessageHandler::sendReply()
+{
+    m_reply[m_replyLen] = m_lastSeq;
+    const uint16_t crc = Framing::crc16(m_reply, m_replyLen + 1);
+    m_reply[m_replyLen+1] = crc & 0xFF;
+    m_reply[m_replyLen+2] = crc >> 8;
+    sendFrame(m_reply, m_replyLen + Framing::c_trailerSize);
+    m_replySent = true;
+}
+
+void MessageHandler::sendStatus(uint8_t status, uint8_t seq)
+{
+    uint8_t frame[4];
+    frame[0] = status;
+    frame[1] = seq;
+    const uint16_t crc = Framing::crc16(frame, 2);
+    frame[2] = crc & 0xFF;
+    frame[3] = crc >> 8;
+    sendFrame(frame, sizeof(frame));
+}
+
+void MessageHandler::streamWords(uint16_t words)
 {
-    while(!loop()) {};
+    // the data frames are built in m_reply; the final reply 
+    // of the command overwrites it afterwards.
+    // The transmit buffer holds a whole frame, so the next
+    // chunk is read over ICSP while this one is being sent.
+    uint16_t offset = 0;
+    while(offset < words)
+    {
+        uint8_t chunk = c_streamChunkWords;
+        if ((words - offset) < chunk)
+        {
+            chunk = words - offset;
+        }
+
+        m_isp.readPgm(m_isp.m_flashBuffer, chunk);
+
+        m_replyLen = 0;
+        reply(c_replyData);
+        reply(offset & 0xFF);
+        reply(offset >> 8);
+        for(uint8_t i=0; i<chunk; i++)
+        {
+            reply(m_isp.m_flashBuffer[i] & 0xFF);
+            reply(m_isp.m_flashBuffer[i] >> 8);
+        }
+        sendReply();
 
-    if (m_bufferIdx <= 0)
+        offset += chunk;
+    }
+
+    m_replyLen  = 0;
+    m_replySent = false;
+}
+
+void MessageHandler::streamCrcs(uint16_t count, uint16_t blockWords)
+{
+    if (blockWords == 0)
     {
-        // some kind of error!
-        return;
+        blockWords = count;
     }
 
+    uint16_t block = 0;
+    uint16_t done  = 0;
+    m_replyLen = 0;
+    while(done < count)
+    {
+        uint16_t words = blockWords;
+        if ((count - done) < words)
+        {
+            words = count - done;
+        }
+
+        uint32_t crc = Framing::c_crc32Init;
+        while(words > 0)
+        {
+            uint8_t chunk = c_streamChunkWords;
+            if (words < chunk)
+            {
+                chunk = words;
+            }
+
+            m_isp.readPgm(m_isp.m_flashBuffer, chunk);
+            for(uint8_t i=0; i<chunk; i++)
+            {
+                crc = Framing::crc32Update(crc, m_isp.m_flashBuffer[i] & 0xFF);
+                crc = Framing::crc32Update(crc, m_isp.m_flashBuffer[i] >> 8);
+            }
+
+            words -= chunk;
+            done  += chunk;
+        }
+        crc = ~crc;
+
+        if (m_replyLen == 0)
+        {
+            reply(c_replyData);
+            reply(block & 0xFF);
+            reply(block >> 8);
+        }
+
+        reply(crc & 0xFF);
+        reply((crc >> 8) & 0xFF);
+        reply((crc >> 16) & 0xFF);
+        reply(crc >> 24);
+        block++;
+
+        if (m_replyLen >= (3 + 4*c_streamChunkCrcs))
+        {
+            sendReply();
+            m_replyLen = 0;
+        }
+    }
+
+    if (m_replyLen > 0)
+    {
+        sendReply();
+    }
+
+    m_replyLen  = 0;
+    m_replySent = false;
+}
+
+bool MessageHandler::confirmBaudRate()
+{
+    while(!loop())
+    {
+        if (!m_uart.waitForData(c_echoTimeoutMs))
+        {
+            return false;
+        }
+    }
+
+    if (static_cast<PGMOperation>(m_buffer[0]) != PGMOperation::Echo)
+    {
+        return false;
+    }
+
+    handleFrame();
+    return true;
+}
+
+void MessageHandler::tick()
+{
+    // the ISP might still be programming a page
+    // while we receive the next message.
+    while(!loop()) 
+    {
+        m_isp.isBusy();
+    };
+
+    handleFrame();
+}
+
+void MessageHandler::handleFrame()
+{
     ledOn();
 
+    // frames are executed strictly in sequence. A repeated frame
+    // gets the stored reply, so the host can safely retry a frame
+    // whose reply it did not receive.
+    const auto op = static_cast<PGMOperation>(m_buffer[0]);
+    if (op == PGMOperation::Sync)
+    {
+        m_lastSeq = m_rxSeq - 1;
+    }
+
+    const uint8_t diff = m_rxSeq - m_lastSeq;
+    if (diff == 0)
+    {
+        sendReply();
+    }
+    else if (diff >= 0x80)
+    {
+        sendStatus(c_replyDuplicate, m_rxSeq);
+    }
+    else if (diff != 1)
+    {
+        sendStatus(c_replyOutOfSequence, m_rxSeq);
+    }
+    else
+    {
+        m_lastSeq   = m_rxSeq;
+        m_replyLen  = 0;
+        m_replySent = false;
+
+        execute();
+
+        if (!m_replySent)
+        {
+            sendReply();
+        }
+    }
+
+    ledOff();
+}
+
+void MessageHandler::execute()
+{
+    // only WritePageSeq may overlap with programming,
+    // and it waits for the previous page itself.
     auto cmdId = m_buffer[0];
+    if (static_cast<PGMOperation>(cmdId) != PGMOperation::WritePageSeq)
+    {
+        m_isp.waitWriteDone();
+    }
+
     switch(static_cast<PGMOperation>(cmdId))
     {
+    case PGMOperation::Sync:
+        reply(0x80);
+        break;
     case PGMOperation::EnterProgMode:
         m_isp.enterProgMode();
-        m_uart.write(0x81);
+        reply(0x81);
         break;
     case PGMOperation::ExitProgMode:
         m_isp.exitProgMode();
-        m_uart.write(0x82);
+        reply(0x82);
         break;        
     case PGMOperation::ResetPointer:
         m_isp.resetPointer();
-        m_uart.write(0x83);
+        reply(0x83);
         break;
     case PGMOperation::LoadConfig:
         m_isp.loadConfig(0);
-        m_uart.write(0x84);
+        reply(0x84);
         break;
     case PGMOperation::PointerIncrement:
         {
             if (m_bufferIdx != 3)
             {
-                m_uart.write(0x05);
+                reply(0x05);
                 // error!
                 return;
             }
@@ -105,7 +331,7 @@ void MessageHandler::tick()
             {
                 m_isp.incrementPointer();
             }
-            m_uart.write(0x85);
+            reply(0x85);
         }
         break;
     case PGMOperation::ReadPage:
@@ -115,28 +341,191 @@ void MessageHandler::tick()
             0x01: total bytes of payload = 1
             0x02: number of words to read
         */    
-        if (m_bufferIdx != 3)
+        if ((m_bufferIdx != 3) || (m_buffer[2] > ((c_replySize - 1) / 2)))
         {
-            m_uart.write(0x06);
+            reply(0x06);
             // error!
             return;
         }    
         
-        m_uart.write(0x86);
+        reply(0x86);
         {
             const auto words = m_buffer[2];
             m_isp.readPgm(m_isp.m_flashBuffer, words);
 
             for(uint8_t i=0; i<words; i++)
             {
-                m_uart.write(m_isp.m_flashBuffer[i] & 0xFF);
-                m_uart.write(m_isp.m_flashBuffer[i] >> 8);
+                reply(m_isp.m_flashBuffer[i] & 0xFF);
+                reply(m_isp.m_flashBuffer[i] >> 8);
             }
         }
         break;
+    case PGMOperation::ReadRange:
+        {
+            /*
+                Buffer layout:
+                0x00: operation ID
+                0x01: total bytes of payload = 2
+                0x02: number of words to read, LSB
+                0x03: number of words to read, MSB
+
+                The words are sent in c_replyData frames, followed
+                by the reply 0x8C. Only that last reply is kept for 
+                a repeated frame, the host has to ask again for the
+                data it did not receive.
+            */
+            if (m_bufferIdx != 4)
+            {
+                reply(0x0C);
+                break;
+            }
+
+            streamWords(m_buffer[2] | (static_cast<uint16_t>(m_buffer[3]) << 8));
+            reply(0x8C);
+        }
+        break;
+    case PGMOperation::CrcRange:
+        {
+            /*
+                Buffer layout:
+                0x00: operation ID
+                0x01: total bytes of payload = 5
+                0x02: start word address, LSB
+                0x03: start word address, MSB
+                0x04: number of words, LSB
+                0x05: number of words, MSB
+                0x06: block size in words, 0 = one block
+
+                The CRC-32 of each block is sent LSB first in c_replyData 
+                frames, where the offset counts blocks. The reply 0x8D 
+                follows, as for ReadRange.
+            */
+            if (m_bufferIdx != 7)
+            {
+                reply(0x0D);
+                break;
+            }
+
+            m_isp.seek(m_buffer[2] | (static_cast<uint16_t>(m_buffer[3]) << 8));
+            streamCrcs(m_buffer[4] | (static_cast<uint16_t>(m_buffer[5]) << 8), m_buffer[6]);
+            reply(0x8D);
+        }
+        break;
+    case PGMOperation::BlankCheckRange:
+        {
+            /*
+                Buffer layout:
+                0x00: operation ID
+                0x01: total bytes of payload = 4
+                0x02: start word address, LSB
+                0x03: start word address, MSB
+                0x04: number of words, LSB
+                0x05: number of words, MSB
+
+                The reply is 0x8E when all words are blank, otherwise
+                0x8E followed by the address and the value of the first
+                word that is not, both LSB first.
+            */
+            if (m_bufferIdx != 6)
+            {
+                reply(0x0E);
+                break;
+            }
+
+            const uint16_t start = m_buffer[2] | (static_cast<uint16_t>(m_buffer[3]) << 8);
+            const uint16_t count = m_buffer[4] | (static_cast<uint16_t>(m_buffer[5]) << 8);
+            m_isp.seek(start);
+
+            uint16_t word = 0;
+            const uint16_t offset = m_isp.findNonBlank(count, word);
+            reply(0x8E);
+            if (offset < count)
+            {
+                const uint16_t address = start + offset;
+                reply(address & 0xFF);
+                reply(address >> 8);
+                reply(word & 0xFF);
+                reply(word >> 8);
+            }
+        }
+        break;
+    case PGMOperation::VerifyPage:
+        {
+            /*
+                Buffer layout:
+                0x00: operation ID
+                0x01: total bytes of payload
+                0x02: start word address, LSB
+                0x03: start word address, MSB
+                0x04: LSB of first expected word
+                0x05: MSB of first expected word etc..
+
+                The reply is 0x8F and the number of mismatches, followed
+                by the offset (1 byte) and the word read (LSB first) 
+                of each mismatching word.
+            */
+            const uint8_t words = (m_bufferIdx - 4) / 2;
+            if ((m_bufferIdx < 4) || ((m_bufferIdx & 1) != 0) || (words > c_maxVerifyWords))
+            {
+                reply(0x0F);
+                break;
+            }
+
+            m_isp.seek(m_buffer[2] | (static_cast<uint16_t>(m_buffer[3]) << 8));
+            m_isp.readPgm(m_isp.m_flashBuffer, words);
+
+            reply(0x8F);
+            reply(0);   // number of mismatches, filled in below
+            uint8_t mismatches = 0;
+            const uint8_t *ptr = m_buffer+4;
+            for(uint8_t i=0; i<words; i++)
+            {
+                const uint16_t expected = static_cast<uint16_t>(ptr[(2*i)+1]<<8) + static_cast<uint16_t>(ptr[(2*i)]);
+                if (m_isp.m_flashBuffer[i] != expected)
+                {
+                    reply(i);
+                    reply(m_isp.m_flashBuffer[i] & 0xFF);
+                    reply(m_isp.m_flashBuffer[i] >> 8);
+                    mismatches++;
+                }
+            }
+            m_reply[1] = mismatches;
+        }
+        break;
     case PGMOperation::MassErasePIC16A:
         m_isp.massErase();
-        m_uart.write(0x87);
+        reply(0x87);
+        break;
+    case PGMOperation::RowErase:
+        {
+            /*
+                Buffer layout:
+                0x00: operation ID
+                0x01: total bytes of payload = 4
+                0x02: start word address, LSB
+                0x03: start word address, MSB
+                0x04: number of rows
+                0x05: words per row
+
+                The device erases the row that holds the pointer, so
+                the row size only sets the step between the rows.
+            */
+            if ((m_bufferIdx != 6) || (m_buffer[5] == 0))
+            {
+                reply(0x16);
+                break;
+            }
+
+            m_isp.waitWriteDone();
+            uint16_t address = m_buffer[2] | (static_cast<uint16_t>(m_buffer[3]) << 8);
+            for(uint8_t row=0; row<m_buffer[4]; row++)
+            {
+                m_isp.seek(address);
+                m_isp.rowErase();
+                address += m_buffer[5];
+            }
+            reply(0x96);
+        }
         break;
     case PGMOperation::WritePage:
         {
@@ -150,6 +539,12 @@ void MessageHandler::tick()
                 0x05: second byte of first word etc..
             */
             const uint8_t words = m_buffer[2];
+            if ((m_bufferIdx != (4 + 2*static_cast<uint16_t>(words))) || (words > ISP::c_bufsize))
+            {
+                reply(0x08);
+                break;
+            }
+
             uint8_t *ptr = m_buffer+4;
             for (uint16_t i=0; i<words; i++)
             {
@@ -157,21 +552,105 @@ void MessageHandler::tick()
             }
 
             m_isp.writePgm(m_isp.m_flashBuffer, words);
+            reply(0x88);
+        }
+        break;
+    case PGMOperation::WritePageSeq:
+        {
+            /*
+                Buffer layout:
+                0x00: operation ID
+                0x01: total bytes of payload
+                0x02: sequence number
+                0x03: number of words to program
+                0x04: speed 1 = slow, 0 = fast
+                0x05: word address, LSB
+                0x06: word address, MSB
+                0x07: LSB of first word
+                0x08: MSB of first word etc..
+
+                The reply (0x8B, sequence number) is sent as soon as
+                programming has started, so the host can send the
+                next page while this one is being programmed.
+            */
+            const uint8_t seq   = m_buffer[2];
+            const uint8_t words = m_buffer[3];
+            if ((m_bufferIdx != (7 + 2*static_cast<uint16_t>(words))) || (words > ISP::c_bufsize))
+            {
+                reply(0x0B);
+                reply(seq);
+                break;
+            }
+
+            uint8_t *ptr = m_buffer+7;
+            for (uint16_t i=0; i<words; i++)
+            {
+                m_isp.m_flashBuffer[i] = static_cast<uint16_t>(ptr[(2*i)+1]<<8) + static_cast<uint16_t>(ptr[(2*i)]);
+            }
+
+            // the pointer moves past the previous page once it is programmed
+            m_isp.waitWriteDone();
+            m_isp.seek(m_buffer[5] | (static_cast<uint16_t>(m_buffer[6]) << 8));
+            m_isp.beginWritePgm(m_isp.m_flashBuffer, words);
+            reply(0x8B);
+            reply(seq);
+        }
+        break;
+    case PGMOperation::SetBaudRate:
+        {
+            /*
+                Buffer layout:
+                0x00: operation ID
+                0x01: total bytes of payload = 4
+                0x02: baud rate, LSB first
+            */
+            if (m_bufferIdx != 6)
+            {
+                reply(0x09);
+                break;
+            }
+
+            const uint32_t baudrate = static_cast<uint32_t>(m_buffer[2])
+                | (static_cast<uint32_t>(m_buffer[3]) << 8)
+                | (static_cast<uint32_t>(m_buffer[4]) << 16)
+                | (static_cast<uint32_t>(m_buffer[5]) << 24);
+
+            if (!UART::isValidBaudRate(baudrate))
+            {
+                reply(0x09);
+                break;
+            }
+
+            // acknowledge at the old rate, then switch.
+            // if the host does not confirm at the new rate, fall back.
+            const uint32_t oldRate = m_uart.baudRate();
+            reply(0x89);
+            sendReply();
+            m_uart.flush();
+            m_uart.setBaudRate(baudrate);
+            if (!confirmBaudRate())
+            {
+                m_uart.setBaudRate(oldRate);
+            }
+        }
+        break;
+    case PGMOperation::Echo:
+        reply(0x8A);
+        for(uint8_t i=2; i<m_bufferIdx; i++)
+        {
+            reply(m_buffer[i]);
         }
-        m_uart.write(0x88);
         break;
     case PGMOperation::EnterProgModeWithPGM:
         m_isp.enterProgModeWithPGMPin();
-        m_uart.write(0x90);
+        reply(0x90);
         break;
     case PGMOperation::ExitProgModeWithPGM:
         m_isp.exitProgModeWithPGMPin();
-        m_uart.write(0x91);
+        reply(0x91);
         break;
     default:
-        m_uart.write(0x00);
+        reply(0x00);
         break;
     }
-
-    ledOff();
 }
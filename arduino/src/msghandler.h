@@ -15,26 +15,67 @@ public:
     }
 
 protected:
+    /** receive bytes until a complete, valid frame is in m_buffer */
     bool loop();
 
+    /** check the sequence number of the frame in m_buffer and execute it */
+    void handleFrame();
+
+    /** execute the command in m_buffer, filling m_reply */
+    void execute();
+
     void ledOn();
     void ledOff();
 
+    /** after a baud rate change, wait for an Echo frame at the new rate
+        and handle it. returns false on timeout or garbled data. */
+    bool confirmBaudRate();
+
+    /** append a byte to the reply of the current command */
+    void reply(uint8_t byte);
+
+    /** send m_reply with the sequence number of the current command */
+    void sendReply();
+
+    /** send a reply that only has a status byte, without touching m_reply */
+    void sendStatus(uint8_t status, uint8_t seq);
+
+    /** read words from the current pointer and stream them as c_replyData frames */
+    void streamWords(uint16_t words);
+
+    /** read count words from the current pointer and stream the CRC-32
+        of each block of blockWords words as c_replyData frames */
+    void streamCrcs(uint16_t count, uint16_t blockWords);
+
+    /** COBS encode a raw frame and send it with a delimiter */
+    void sendFrame(const uint8_t *raw, uint16_t len);
+
     constexpr static uint16_t c_bufsize = 280;
+    constexpr static uint16_t c_replySize = 256;        ///< status byte and up to 255 data bytes
+    constexpr static uint16_t c_echoTimeoutMs = 250;    ///< time the host has to send the test
+    constexpr static uint8_t  c_streamChunkWords = 32;  ///< words per streamed data frame
+    constexpr static uint8_t  c_streamChunkCrcs  = 32;  ///< CRCs per streamed data frame
+    constexpr static uint8_t  c_maxVerifyWords   = 64;  ///< words per VerifyPage, so all mismatches fit the reply
 
-    enum class RxState : uint8_t
-    {
-        START = 0,
-        PAYLOADSIZE,
-        PAYLOAD
-    };
+    // the commands that read flash use ISP::m_flashBuffer, which is smaller
+    // than a frame payload; WritePage and WritePageSeq check their length
+    static_assert(((c_replySize - 1) / 2) <= ISP::c_bufsize, "ReadPage does not fit the flash buffer");
+    static_assert(c_streamChunkWords <= ISP::c_bufsize, "a streamed chunk does not fit the flash buffer");
+    static_assert(c_maxVerifyWords <= ISP::c_bufsize, "VerifyPage does not fit the flash buffer");
 
     ISP  m_isp;
     UART m_uart;
 
-    RxState m_rxState = RxState::START;
-
-    uint16_t m_bytesToReceive = 0;
     uint16_t m_bufferIdx = 0;
-    uint8_t  m_buffer[c_bufsize];
+    uint8_t  m_buffer[c_bufsize];   ///< encoded frame, decoded in place: opcode, length, payload
+
+    uint16_t m_rxLen = 0;           ///< number of encoded bytes received so far
+    bool     m_rxOverflow = false;  ///< the frame being received does not fit m_buffer
+    uint8_t  m_rxSeq = 0;           ///< sequence number of the frame in m_buffer
+    uint8_t  m_lastSeq = 0xFF;      ///< sequence number of the last executed frame
+
+    /** reply of the last executed frame, kept to answer a repeated frame */
+    uint8_t  m_reply[c_replySize + 3];
+    uint16_t m_replyLen  = 0;
+    bool     m_replySent = false;
 };
@@ -1,41 +1,162 @@
 // SPDX-License-Identifier: GPL-3.0-only
 // Copyright N.A. Moseley 2022
 
-#define F_CPU 16000000
-#define BAUD 57600
+#define F_CPU 16000000UL
 
 #include <avr/io.h>
-#include <util/setbaud.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
 #include "uart.h"
 
-void UART::init()
+namespace
 {
-    UBRR0H = UBRRH_VALUE;
-    UBRR0L = UBRRL_VALUE;    
+    constexpr uint8_t c_rxMask = UART::c_rxBufferSize - 1;
+    constexpr uint8_t c_txMask = UART::c_txBufferSize - 1;
 
-#if USE_2X
-    UCSR0A |= _BV(U2X0);
-#else
-    UCSR0A &= ~(_BV(U2X0));
-#endif
+    static_assert((UART::c_rxBufferSize & c_rxMask) == 0, "RX buffer size must be a power of two");
+    static_assert((UART::c_txBufferSize & c_txMask) == 0, "TX buffer size must be a power of two");
+    static_assert(UART::c_rxBufferSize <= 256, "RX buffer indices are 8 bits");
+
+    volatile uint8_t g_rxBuffer[UART::c_rxBufferSize];
+    volatile uint8_t g_rxHead = 0;      ///< written by the ISR
+    volatile uint8_t g_rxTail = 0;      ///< written by read()
+    volatile bool    g_rxOverflow = false;
+
+    volatile uint8_t g_txBuffer[UART::c_txBufferSize];
+    volatile uint8_t g_txHead = 0;      ///< written by write()
+    volatile uint8_t g_txTail = 0;      ///< written by the ISR
+};
+
+ISR(USART_RX_vect)
+{
+    const uint8_t byte = UDR0;
+    const uint8_t next = (g_rxHead + 1) & c_rxMask;
+    if (next == g_rxTail)
+    {
+        g_rxOverflow = true;
+        return;
+    }
+
+    g_rxBuffer[g_rxHead] = byte;
+    g_rxHead = next;
+}
+
+ISR(USART_UDRE_vect)
+{
+    if (g_txHead == g_txTail)
+    {
+        UCSR0B &= ~_BV(UDRIE0);     /* nothing left to send */
+        return;
+    }
+
+    UCSR0A |= _BV(TXC0);            /* Clear transmit complete flag */
+    UDR0 = g_txBuffer[g_txTail];
+    g_txTail = (g_txTail + 1) & c_txMask;
+}
 
+void UART::init(uint32_t baudrate)
+{
     UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);     /* 8-bit data */
-    UCSR0B = _BV(RXEN0)  | _BV(TXEN0);      /* Enable RX and TX */    
+    UCSR0B = _BV(RXEN0)  | _BV(TXEN0) | _BV(RXCIE0);   /* Enable RX and TX, RX interrupt */
+
+    setBaudRate(baudrate);
+    sei();
+}
+
+uint16_t UART::ubrrValue(uint32_t baudrate)
+{
+    // always run in double speed mode, which has the finer
+    // granularity at the high rates: baud = F_CPU / (8*(UBRR+1))
+    return static_cast<uint16_t>(((F_CPU + 4*baudrate) / (8*baudrate)) - 1);
+}
+
+bool UART::isValidBaudRate(uint32_t baudrate)
+{
+    if ((baudrate < 2400) || (baudrate > (F_CPU / 8)))
+    {
+        return false;
+    }
+
+    const uint32_t ubrr   = ubrrValue(baudrate);
+    if (ubrr > 4095)
+    {
+        return false;
+    }
+
+    const uint32_t actual = F_CPU / (8*(ubrr+1));
+    const uint32_t error  = (actual > baudrate) ? (actual - baudrate) : (baudrate - actual);
+
+    return (error*1000 / baudrate) <= 25;
+}
+
+bool UART::setBaudRate(uint32_t baudrate)
+{
+    if (!isValidBaudRate(baudrate))
+    {
+        return false;
+    }
+
+    const uint16_t ubrr = ubrrValue(baudrate);
+    UBRR0H = ubrr >> 8;
+    UBRR0L = ubrr & 0xFF;
+    UCSR0A |= _BV(U2X0);
+
+    m_baudRate = baudrate;
+    return true;
 }
 
 void UART::write(uint8_t byte)
 {
-    loop_until_bit_is_set(UCSR0A, UDRE0);   /* Wait until data register empty */
-    UDR0 = byte;
+    const uint8_t next = (g_txHead + 1) & c_txMask;
+    while(next == g_txTail) {};             /* Wait until there is room */
+
+    g_txBuffer[g_txHead] = byte;
+    g_txHead = next;
+    UCSR0B |= _BV(UDRIE0);                  /* (re)start the transmitter */
+}
+
+void UART::flush()
+{
+    while(g_txHead != g_txTail) {};
+    loop_until_bit_is_set(UCSR0A, TXC0);
 }
 
 uint8_t UART::read()
 {
-    loop_until_bit_is_set(UCSR0A, RXC0);    /* Wait until data exists. */
-    return UDR0;
+    while(!hasData()) {};                   /* Wait until data exists. */
+
+    const uint8_t byte = g_rxBuffer[g_rxTail];
+    g_rxTail = (g_rxTail + 1) & c_rxMask;
+    return byte;
 }
 
 bool UART::hasData() const
 {
-    return (UCSR0A & _BV(RXC0));
+    return g_rxHead != g_rxTail;
+}
+
+bool UART::hasOverflowed() const
+{
+    return g_rxOverflow;
+}
+
+void UART::clearOverflow()
+{
+    g_rxOverflow = false;
+}
+
+bool UART::waitForData(uint16_t timeoutMs) const
+{
+    for(uint16_t ms=0; ms<timeoutMs; ms++)
+    {
+        for(uint8_t i=0; i<100; i++)
+        {
+            if (hasData())
+            {
+                return true;
+            }
+            _delay_us(10);
+        }
+    }
+    return hasData();
 }
@@ -5,11 +5,58 @@
 
 #include <stdint.h>
 
+/** Interrupt driven UART0 with receive and transmit ring buffers.
+    There is only one UART on the ATmega328P so the buffers are
+    shared by all instances.
+*/
 class UART
 {
 public:
-    void    init();
+    /** rate after reset, must match Serial::c_defaultBaudRate on the host */
+    constexpr static uint32_t c_defaultBaudRate = 57600;
+
+    /** ring buffer sizes, must be powers of two.
+        The receive buffer holds a full WritePageSeq frame for 
+        a 64-word page, so the host can send it while the 
+        previous page is still being handled.
+        Must match PIC16A::c_programmerRxBufferSize on the host.
+        The transmit buffer holds a full ReadRange data frame, so
+        the next words can be read while it is being sent.
+    */
+    constexpr static uint16_t c_rxBufferSize = 256;
+    constexpr static uint16_t c_txBufferSize = 128;
+
+    void    init(uint32_t baudrate = c_defaultBaudRate);
+
+    /** switch to a new rate. returns false if the rate cannot be 
+        generated from F_CPU within 2.5% */
+    bool    setBaudRate(uint32_t baudrate);
+    static bool isValidBaudRate(uint32_t baudrate);
+
+    uint32_t baudRate() const
+    {
+        return m_baudRate;
+    }
+
+    /** queue a byte for transmission, waits only when the buffer is full */
     void    write(uint8_t byte);
+
+    /** take a byte from the receive buffer, waits when it is empty */
     uint8_t read();
     bool    hasData() const;
+
+    /** wait until the last byte has left the shift register */
+    void    flush();
+
+    /** wait at most timeoutMs milliseconds for a byte to arrive */
+    bool    waitForData(uint16_t timeoutMs) const;
+
+    /** true if bytes were dropped because the receive buffer was full */
+    bool    hasOverflowed() const;
+    void    clearOverflow();
+
+protected:
+    static uint16_t ubrrValue(uint32_t baudrate);
+
+    uint32_t m_baudRate = c_defaultBaudRate;
 };
@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+/** timing for the benchmarks. They are small programs that print their
+    results; they are not built unless PICMEUP_BENCH is set.
+*/
+namespace Bench
+{
+    using Clock = std::chrono::steady_clock;
+
+    /** keeps the compiler from dropping work whose result is not used */
+    inline volatile size_t g_sink = 0;
+
+    /** the best time of a few runs of fn(), in seconds */
+    template<typename Function>
+    double bestOf(size_t runs, Function &&fn)
+    {
+        double best = 0;
+        for(size_t run = 0; run < runs; run++)
+        {
+            const auto start = Clock::now();
+            fn();
+            const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            if ((run == 0) || (seconds < best))
+            {
+                best = seconds;
+            }
+        }
+        return best;
+    }
+
+    /** print the build type first, so results of an unoptimized build stand out */
+    inline void printBuild()
+    {
+        const std::string buildType = PICMEUP_BUILD_TYPE;
+        std::cout << "build type " << (buildType.empty() ? "not set" : buildType);
+#ifdef __OPTIMIZE__
+        std::cout << ", optimized";
+#else
+        std::cout << ", not optimized";
+#endif
+#ifndef NDEBUG
+        std::cout << ", assertions on";
+#endif
+        std::cout << "\n";
+    }
+
+    /** print a result line: what was timed, the time per item and an optional rate */
+    inline void report(const std::string &what, double seconds, size_t items, const std::string &itemName)
+    {
+        std::cout << std::left << std::setw(36) << what << std::right << std::fixed;
+        std::cout << std::setw(12) << std::setprecision(1) << (seconds*1e9 / items) << " ns/" << itemName;
+        std::cout << std::setw(14) << std::setprecision(0) << (items / seconds) << " " << itemName << "s/s\n";
+    }
+};
@@ -0,0 +1,161 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "bench.h"
+#include "devicedb.h"
+#include "utils.h"
+
+/** a device as the parser that ran at every startup held it */
+struct ParsedDevice
+{
+    std::string deviceName;
+    uint32_t    flashMemSize  = 0;
+    uint32_t    flashPageSize = 0;
+    uint32_t    deviceId      = 0;
+    uint32_t    deviceIdMask  = 0;
+    std::string deviceFamily;
+};
+
+/** devices.dat parsed like readDeviceInfo() in main.cpp did before the table was generated */
+static std::vector<ParsedDevice> parseDevices(const std::string &text)
+{
+    const std::array<std::string, 13> families =
+    {
+        "CF_P16F_A", "CF_P16F_B", "CF_P16F_C", "CF_P16F_D", "CF_P18F_A", "CF_P18F_B", "CF_P18F_C",
+        "CF_P18F_D", "CF_P18F_E", "CF_P18F_F", "CF_P18F_G", "CF_P18F_Q", "CF_P16F_PGM_A"
+    };
+
+    std::vector<ParsedDevice> devices;
+    std::istringstream deviceFile(text);
+    std::string line;
+    while(std::getline(deviceFile, line))
+    {
+        if ((line.size() <= 2) || (line.at(0) == '#'))
+        {
+            continue;
+        }
+
+        auto tokens = Utils::tokenize(line, ' ');
+        if (tokens.size() < 6)
+        {
+            return {};
+        }
+
+        auto &dev = devices.emplace_back();
+        dev.deviceName    = tokens.at(0);
+        dev.flashMemSize  = Utils::intStrToint32(tokens.at(1)).value_or(0) / 2;
+        dev.flashPageSize = Utils::intStrToint32(tokens.at(2)).value_or(0) / 2;
+        dev.deviceId      = Utils::hexStrToUint32(tokens.at(3)).value_or(0);
+        dev.deviceIdMask  = Utils::hexStrToUint32(tokens.at(4)).value_or(0);
+        if (std::find(families.begin(), families.end(), tokens.at(5)) == families.end())
+        {
+            return {};
+        }
+        dev.deviceFamily  = tokens.at(5);
+    }
+    return devices;
+}
+
+int main()
+{
+    std::ifstream file(DEVICES_DAT);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    const std::string text = contents.str();
+
+    const auto parsed = parseDevices(text);
+    if (parsed.size() != DeviceDB::devices().size())
+    {
+        std::cerr << "Cannot read " << DEVICES_DAT << "\n";
+        return EXIT_FAILURE;
+    }
+
+    // the table holds the names in lower case, the file does not
+    std::vector<std::string> names;
+    std::vector<std::string> lowerNames;
+    for(auto const &device : parsed)
+    {
+        names.push_back(device.deviceName);
+        lowerNames.push_back(Utils::toLower(device.deviceName));
+    }
+
+    Bench::printBuild();
+    std::cout << DeviceDB::devices().size() << " devices\n\n";
+
+    // startup before: parse the file, then find the target
+    constexpr size_t c_startups = 200;
+    double seconds = Bench::bestOf(5, [&]()
+        {
+            for(size_t i = 0; i < c_startups; i++)
+            {
+                auto devices = parseDevices(text);
+                auto iter = std::find_if(devices.begin(), devices.end(),
+                    [&names, i](const ParsedDevice &device)
+                    {
+                        return device.deviceName == names.at(i % names.size());
+                    }
+                );
+                Bench::g_sink = Bench::g_sink + iter->flashMemSize;
+            }
+        }
+    );
+    Bench::report("parse devices.dat and find_if", seconds, c_startups, "startup");
+
+    // lookups in the parsed list
+    constexpr size_t c_rounds = 200;
+    seconds = Bench::bestOf(5, [&]()
+        {
+            for(size_t round = 0; round < c_rounds; round++)
+            {
+                for(auto const &name : names)
+                {
+                    auto iter = std::find_if(parsed.begin(), parsed.end(),
+                        [&name](const ParsedDevice &device)
+                        {
+                            return device.deviceName == name;
+                        }
+                    );
+                    Bench::g_sink = Bench::g_sink + iter->flashMemSize;
+                }
+            }
+        }
+    );
+    Bench::report("find_if by name", seconds, c_rounds*names.size(), "lookup");
+
+    // startup now: the generated table needs no parsing
+    seconds = Bench::bestOf(5, [&]()
+        {
+            for(size_t round = 0; round < c_rounds; round++)
+            {
+                for(auto const &name : lowerNames)
+                {
+                    Bench::g_sink = Bench::g_sink + DeviceDB::findByName(name)->flashMemSize;
+                }
+            }
+        }
+    );
+    Bench::report("DeviceDB::findByName", seconds, c_rounds*names.size(), "lookup");
+
+    seconds = Bench::bestOf(5, [&]()
+        {
+            for(size_t round = 0; round < c_rounds; round++)
+            {
+                for(auto const &device : DeviceDB::devices())
+                {
+                    for(size_t mask = 0; mask < DeviceDB::idMasks().size(); mask++)
+                    {
+                        Bench::g_sink = Bench::g_sink + DeviceDB::findById(mask, device.deviceId).size();
+                    }
+                }
+            }
+        }
+    );
+    Bench::report("DeviceDB::findById, all masks", seconds, c_rounds*names.size(), "lookup");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,228 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "bench.h"
+#include "asyncport.h"
+#include "eventloop.h"
+#include "framing.h"
+#include "serial.h"
+
+/** a programmer on the other side of a pty that answers every frame
+    like the Echo command: the reply holds the payload of the request.
+*/
+class EchoProgrammer
+{
+public:
+    EchoProgrammer()
+    {
+        m_master = posix_openpt(O_RDWR | O_NOCTTY);
+        if ((m_master >= 0) && (grantpt(m_master) == 0) && (unlockpt(m_master) == 0))
+        {
+            m_port = ptsname(m_master);
+            m_thread = std::thread([this]() { serve(); });
+        }
+    }
+
+    ~EchoProgrammer()
+    {
+        ::close(m_master);
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+    /** the pty for the host side, empty if it could not be created */
+    const std::string& port() const noexcept
+    {
+        return m_port;
+    }
+
+protected:
+    void serve()
+    {
+        std::array<uint8_t, 4096> input;
+        std::vector<uint8_t> frame;
+        while(true)
+        {
+            const auto bytes = ::read(m_master, input.data(), input.size());
+            if (bytes <= 0)
+            {
+                return;     // the host side was closed
+            }
+
+            for(ssize_t i = 0; i < bytes; i++)
+            {
+                if (input[i] != Framing::c_delimiter)
+                {
+                    frame.push_back(input[i]);
+                    continue;
+                }
+
+                reply(frame);
+                frame.clear();
+            }
+        }
+    }
+
+    /** answer a request [op, length, payload.., seq, crc] with [op | 0x80, payload.., seq, crc] */
+    void reply(std::vector<uint8_t> &frame)
+    {
+        const size_t bytes = Framing::cobsDecode(frame.data(), frame.size(), frame.data());
+        if ((bytes < 5) || (bytes != (frame[1] + 5u)))
+        {
+            return;
+        }
+
+        std::vector<uint8_t> raw;
+        raw.push_back(frame[0] | 0x80);
+        raw.insert(raw.end(), frame.begin() + 2, frame.begin() + bytes - 2);
+        const uint16_t crc = Framing::crc16(raw.data(), raw.size());
+        raw.push_back(crc & 0xFF);
+        raw.push_back(crc >> 8);
+
+        std::vector<uint8_t> encoded;
+        Framing::cobsEncode(raw.data(), raw.size(), [&encoded](uint8_t b) { encoded.push_back(b); });
+        encoded.push_back(Framing::c_delimiter);
+        if (::write(m_master, encoded.data(), encoded.size()) < 0)
+        {
+            return;
+        }
+    }
+
+    int         m_master = -1;
+    std::string m_port;
+    std::thread m_thread;
+};
+
+/** all ports on one EventLoop, each with a chain of requests */
+static double runEventLoop(std::vector<std::shared_ptr<Serial> > &serials, size_t requests,
+    const std::vector<uint8_t> &payload, EventLoop::Stats &stats)
+{
+    EventLoop loop;
+    std::vector<std::unique_ptr<AsyncPort> > ports;
+    for(auto &serial : serials)
+    {
+        ports.push_back(std::make_unique<AsyncPort>(loop, serial));
+    }
+
+    std::atomic<size_t> failed{0};
+    std::vector<std::function<void(size_t)> > next(ports.size());
+    for(size_t i = 0; i < ports.size(); i++)
+    {
+        next[i] = [&, i](size_t sent)
+        {
+            if (sent == requests)
+            {
+                ports[i]->close();
+                return;
+            }
+
+            ports[i]->send(AsyncPort::Request{PGMOperation::Echo, payload},
+                [&, i, sent](bool ok, std::span<const uint8_t>)
+                {
+                    failed += ok ? 0 : 1;
+                    next[i](sent + 1);
+                }
+            );
+        };
+    }
+
+    const auto start = Bench::Clock::now();
+    for(size_t i = 0; i < ports.size(); i++)
+    {
+        next[i](0);
+    }
+    loop.run();
+    const double seconds = std::chrono::duration<double>(Bench::Clock::now() - start).count();
+
+    stats = loop.stats();
+    if (failed > 0)
+    {
+        std::cerr << failed << " requests failed\n";
+    }
+    return seconds;
+}
+
+/** a thread per port, with blocking reads */
+static double runThreads(std::vector<std::shared_ptr<Serial> > &serials, size_t requests,
+    const std::vector<uint8_t> &payload)
+{
+    std::atomic<size_t> failed{0};
+    std::vector<std::thread> threads;
+
+    const auto start = Bench::Clock::now();
+    for(auto &serial : serials)
+    {
+        threads.emplace_back([&, serial]()
+            {
+                std::array<uint8_t, Framing::c_maxBodySize> reply;
+                for(size_t i = 0; i < requests; i++)
+                {
+                    const uint8_t seq = serial->writeFrame(PGMOperation::Echo, payload.data(), payload.size());
+                    auto result = serial->readFrame(reply.data(), reply.size(), Serial::deadlineFromNow());
+                    failed += (result.ok() && (result.seq == seq)) ? 0 : 1;
+                }
+            }
+        );
+    }
+
+    for(auto &thread : threads)
+    {
+        thread.join();
+    }
+    const double seconds = std::chrono::duration<double>(Bench::Clock::now() - start).count();
+
+    if (failed > 0)
+    {
+        std::cerr << failed << " requests failed\n";
+    }
+    return seconds;
+}
+
+/** usage: eventloop_bench [ports [requests per port [payload bytes]]] */
+int main(int argc, char *argv[])
+{
+    const size_t portCount    = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 8;
+    const size_t requests     = (argc > 2) ? strtoul(argv[2], nullptr, 10) : 2000;
+    const size_t payloadBytes = (argc > 3) ? strtoul(argv[3], nullptr, 10) : 64;
+
+    std::vector<std::unique_ptr<EchoProgrammer> > programmers;
+    std::vector<std::shared_ptr<Serial> > serials;
+    for(size_t i = 0; i < portCount; i++)
+    {
+        auto &programmer = programmers.emplace_back(std::make_unique<EchoProgrammer>());
+        auto serial = programmer->port().empty() ? nullptr : Serial::open(programmer->port());
+        if (!serial)
+        {
+            std::cerr << "Cannot open a pty\n";
+            return EXIT_FAILURE;
+        }
+        serials.push_back(serial);
+    }
+
+    const std::vector<uint8_t> payload(std::min<size_t>(payloadBytes, 255), 0x5A);
+    const size_t total = portCount*requests;
+    Bench::printBuild();
+    std::cout << portCount << " ptys, " << requests << " requests of " << payload.size();
+    std::cout << " bytes per port\n\n";
+
+    EventLoop::Stats stats;
+    double seconds = runEventLoop(serials, requests, payload, stats);
+    Bench::report("EventLoop, one thread", seconds, total, "request");
+    std::cout << "  " << std::setprecision(2) << (static_cast<double>(stats.wakeups) / total);
+    std::cout << " wakeups and " << (static_cast<double>(stats.events) / total) << " events per request\n";
+
+    seconds = runThreads(serials, requests, payload);
+    Bench::report("a thread per port", seconds, total, "request");
+    return EXIT_SUCCESS;
+}
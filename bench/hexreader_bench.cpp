@@ -0,0 +1,222 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "bench.h"
+#include "devicedb.h"
+#include "hexreader.h"
+#include "hexwriter.h"
+
+/** the line based reader HexReader replaced: getline, substr and a
+    string to number conversion per byte
+*/
+static bool parseLines(const std::string &text, MemoryImage &flash, std::vector<uint8_t> &config)
+{
+    std::istringstream hexfile(text);
+    uint32_t addressOffset = 0;
+    std::string line;
+    while(std::getline(hexfile, line))
+    {
+        if (line.empty() || (line.at(0) != ':'))
+        {
+            continue;
+        }
+
+        auto lineLength  = Utils::hexStrToUint32(line.substr(1, 2));
+        auto lineAddress = Utils::hexStrToUint32(line.substr(3, 4));
+        auto lineType    = Utils::hexStrToUint32(line.substr(7, 2));
+        if (!lineLength || !lineAddress || !lineType)
+        {
+            return false;
+        }
+
+        const uint32_t effectiveAddress = lineAddress.value() + (addressOffset << 16);
+        if (lineType.value() == 4)
+        {
+            addressOffset = Utils::hexStrToUint32(line.substr(9, 4)).value_or(0);
+            continue;
+        }
+
+        if (lineType.value() != 0)
+        {
+            continue;
+        }
+
+        for(size_t i=0; i<lineLength.value(); i++)
+        {
+            auto byte = Utils::hexStrToUint32(line.substr(9 + i*2, 2));
+            if (!byte)
+            {
+                return false;
+            }
+
+            if (effectiveAddress < (flash.sizeWords()*2))
+            {
+                flash.setByte(effectiveAddress + i, byte.value());
+            }
+            else if ((addressOffset == 1) && ((lineAddress.value() + i - 0xE) < config.size()))
+            {
+                config.at(lineAddress.value() + i - 0xE) = byte.value();
+            }
+        }
+    }
+    return true;
+}
+
+/** the image a HEX file is loaded into */
+struct Target
+{
+    size_t sizeWords;
+    size_t pageWords;
+    size_t configBytes;
+};
+
+/** write an image that is full of code as a compiler would */
+static std::string makeHexFile(const std::string &filename, const Target &target)
+{
+    MemoryImage flash(target.sizeWords, target.pageWords);
+    for(size_t address = 0; address < target.sizeWords; address++)
+    {
+        flash.setByte(address*2, static_cast<uint8_t>(address*7));
+        flash.setByte(address*2 + 1, static_cast<uint8_t>(address >> 3) & 0x3F);
+    }
+
+    HexWriter writer;
+    writer.open(filename);
+    for(size_t page = 0; page < flash.pageCount(); page++)
+    {
+        writer.write(page*flash.pageBytes(), flash.page(page));
+    }
+
+    writer.close();
+
+    std::ifstream file(filename);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+/** usage: hexreader_bench [megabytes | file.hex [target]]
+
+    A HEX file of about that many megabytes, 8 by default, is generated
+    with an extended linear address record every 64 KB. A file is loaded
+    into the flash of the target, a 16F1509 by default.
+*/
+int main(int argc, char *argv[])
+{
+    const auto *info = DeviceDB::findByName((argc > 2) ? argv[2] : "16f1509");
+    if (info == nullptr)
+    {
+        std::cerr << "Unknown target\n";
+        return EXIT_FAILURE;
+    }
+
+    Target target{info->flashMemSize, info->flashPageSize, info->configSize*2};
+
+    size_t megabytes = (argc > 1) ? 0 : 8;
+    if (argc == 2)
+    {
+        char *end = nullptr;
+        megabytes = std::strtoul(argv[1], &end, 10);
+        if (*end != 0)
+        {
+            megabytes = 0;
+        }
+    }
+
+    const bool generate = (megabytes > 0);
+    std::string filename;
+    std::string text;
+    if (generate)
+    {
+        filename = (std::filesystem::temp_directory_path() /
+            ("picmeup_hexreader_bench_" + std::to_string(getpid()) + ".hex")).string();
+
+        // a record of 16 data bytes takes 44 characters
+        constexpr size_t c_pageWords = 32;
+        const size_t words = megabytes*(1 << 20)*16/44/2;
+        target = {(words / c_pageWords)*c_pageWords, c_pageWords, 0};
+        text = makeHexFile(filename, target);
+    }
+    else
+    {
+        filename = argv[1];
+        std::ifstream file(filename);
+        if (!file)
+        {
+            std::cerr << "Cannot open " << filename << "\n";
+            return EXIT_FAILURE;
+        }
+        std::stringstream contents;
+        contents << file.rdbuf();
+        text = contents.str();
+    }
+
+    Bench::printBuild();
+    std::cout << filename << ": " << text.size() << " bytes, ";
+    if (generate)
+    {
+        std::cout << (target.sizeWords*2 + 0xFFFF) / 0x10000 << " 64 KB segments\n\n";
+    }
+    else
+    {
+        std::cout << "target " << info->deviceName << "\n\n";
+    }
+
+    // load about the same number of bytes whatever the size of the file
+    constexpr size_t c_benchBytes = 16 << 20;
+    const size_t loads = std::max<size_t>(1, c_benchBytes / std::max<size_t>(1, text.size()));
+    auto timeLoads = [&](size_t runs, auto &&load)
+    {
+        return Bench::bestOf(runs, [&]()
+            {
+                for(size_t i = 0; i < loads; i++)
+                {
+                    MemoryImage flash(target.sizeWords, target.pageWords);
+                    std::vector<uint8_t> config(target.configBytes, 0xFF);
+                    if (!load(flash, config))
+                    {
+                        std::cerr << "Cannot parse the HEX file\n";
+                        exit(EXIT_FAILURE);
+                    }
+                    Bench::g_sink = Bench::g_sink + flash.usedPages().size();
+                }
+            }
+        );
+    };
+
+    // the line based reader is slow, fewer runs keep the total time down
+    double seconds = timeLoads(2, [&](MemoryImage &flash, std::vector<uint8_t> &config)
+        {
+            return parseLines(text, flash, config);
+        }
+    );
+    Bench::report("line based reader", seconds, loads*text.size(), "byte");
+
+    seconds = timeLoads(5, [&](MemoryImage &flash, std::vector<uint8_t> &config)
+        {
+            return HexReader::parse(text, flash, config);
+        }
+    );
+    Bench::report("HexReader::parse", seconds, loads*text.size(), "byte");
+
+    seconds = timeLoads(5, [&](MemoryImage &flash, std::vector<uint8_t> &config)
+        {
+            return HexReader::read(filename, flash, config);
+        }
+    );
+    Bench::report("HexReader::read, mapped file", seconds, loads*text.size(), "byte");
+
+    if (generate)
+    {
+        std::filesystem::remove(filename);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,269 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include "asyncport.h"
+
+AsyncPort::AsyncPort(EventLoop &loop, std::shared_ptr<Serial> serial)
+    : m_loop(loop), m_serial(serial)
+{
+    m_watching = m_serial->setNonBlocking(true) &&
+        m_loop.watch(m_serial->fd(), [this]()
+            {
+                onReadable();
+            }
+        );
+}
+
+AsyncPort::~AsyncPort()
+{
+    close();
+}
+
+void AsyncPort::close()
+{
+    cancelTimer();
+    m_state = State::Idle;
+    m_done  = nullptr;
+    if (m_watching)
+    {
+        m_loop.unwatch(m_serial->fd());
+        m_serial->setNonBlocking(false);
+        m_watching = false;
+    }
+}
+
+void AsyncPort::armTimer(int milliSeconds)
+{
+    cancelTimer();
+    m_timer = m_loop.addTimer(milliSeconds, [this]()
+        {
+            m_timer = 0;
+            onTimeout();
+        }
+    );
+}
+
+void AsyncPort::cancelTimer()
+{
+    if (m_timer != 0)
+    {
+        m_loop.cancelTimer(m_timer);
+        m_timer = 0;
+    }
+}
+
+void AsyncPort::after(int milliSeconds, std::function<void()> callback)
+{
+    // the port is idle while the caller waits, so the reply timer is free
+    m_state = State::Idle;
+    cancelTimer();
+    m_timer = m_loop.addTimer(milliSeconds, [this, callback = std::move(callback)]()
+        {
+            m_timer = 0;
+            callback();
+        }
+    );
+}
+
+void AsyncPort::send(Request request, ReplyHandler done)
+{
+    m_request = std::move(request);
+    m_done    = std::move(done);
+    m_attempt = 0;
+    m_state   = State::Request;
+
+    if (!m_watching)
+    {
+        complete(false, {});
+        return;
+    }
+    sendRequest(false);
+}
+
+void AsyncPort::sendRequest(bool resend)
+{
+    if (resend)
+    {
+        m_serial->rewriteFrame(m_seq, m_request.op, m_request.args.data(), m_request.args.size());
+    }
+    else
+    {
+        m_seq = m_serial->writeFrame(m_request.op, m_request.args.data(), m_request.args.size());
+    }
+
+    m_serial->flush();
+    armTimer(m_request.timeoutMs);
+}
+
+void AsyncPort::waitForProgrammer(int timeoutMilliSeconds, std::function<void(bool ok)> done)
+{
+    m_done = [done = std::move(done)](bool ok, std::span<const uint8_t>)
+    {
+        done(ok);
+    };
+
+    m_state = State::Syncing;
+    m_syncDeadline = EventLoop::Clock::now() + std::chrono::milliseconds(timeoutMilliSeconds);
+    if (!m_watching)
+    {
+        complete(false, {});
+        return;
+    }
+    sendSync();
+}
+
+void AsyncPort::sendSync()
+{
+    // the extra delimiter ends any partial frame the programmer holds
+    m_serial->write(Framing::c_delimiter);
+    m_seq = m_serial->writeFrame(PGMOperation::Sync);
+    m_serial->flush();
+    armTimer((m_state == State::Syncing) ? c_syncIntervalMs : Serial::c_defaultTimeoutMs);
+}
+
+void AsyncPort::complete(bool ok, std::span<const uint8_t> reply)
+{
+    cancelTimer();
+    m_state = State::Idle;
+
+    // the handler usually sends the next request, which sets m_done again
+    auto done = std::move(m_done);
+    m_done = nullptr;
+    if (done)
+    {
+        done(ok, reply);
+    }
+}
+
+void AsyncPort::onReadable()
+{
+    auto status = m_serial->readAvailable();
+    if (status == Serial::ReadStatus::Error)
+    {
+        // the device has gone away
+        m_loop.unwatch(m_serial->fd());
+        m_watching = false;
+        complete(false, {});
+        return;
+    }
+
+    while(m_watching)
+    {
+        auto result = m_serial->nextFrame(m_reply.data(), m_reply.size());
+        if (result.status == Serial::ReadStatus::Timeout)
+        {
+            return;
+        }
+        onFrame(result);
+    }
+}
+
+void AsyncPort::onFrame(const Serial::FrameResult &result)
+{
+    const uint8_t syncReply = static_cast<uint8_t>(PGMOperation::Sync) | 0x80;
+    auto reply = std::span<const uint8_t>(m_reply.data(), result.bytes);
+
+    switch(m_state)
+    {
+    case State::Idle:
+        return;
+
+    case State::Syncing:
+        // ignore anything the bootloader might send and
+        // the replies to earlier Sync frames.
+        if (result.ok() && (result.seq == m_seq) && (result.bytes > 0) && (reply[0] == syncReply))
+        {
+            complete(true, reply);
+        }
+        return;
+
+    case State::Resync:
+        if (result.ok() && (result.seq == m_seq) && (result.bytes > 0) && (reply[0] == syncReply))
+        {
+            // numbering restarted, send the request as a new frame
+            m_state = State::Request;
+            sendRequest(false);
+        }
+        return;
+
+    case State::Request:
+        break;
+    }
+
+    if (result.status == Serial::ReadStatus::Corrupt)
+    {
+        // the corrupted frame might have been our reply:
+        // wait for the line to go quiet, then send again
+        armTimer(c_corruptQuietMs);
+        return;
+    }
+
+    if ((result.bytes == 0) || (reply[0] == c_replyCorrupt))
+    {
+        onTimeout();
+        return;
+    }
+
+    if (result.seq != m_seq)
+    {
+        // a reply to an earlier frame: the programmer is still busy with those
+        armTimer(m_request.timeoutMs);
+        return;
+    }
+
+    if ((reply[0] == c_replyData) && m_request.onData)
+    {
+        m_request.onData(reply);
+        armTimer(m_request.timeoutMs);
+        return;
+    }
+
+    if ((reply[0] == c_replyOutOfSequence) && (m_request.op != PGMOperation::Sync))
+    {
+        // the programmer lost track of the numbering, restart it
+        m_state = State::Resync;
+        m_seq = m_serial->writeFrame(PGMOperation::Sync);
+        m_serial->flush();
+        armTimer(Serial::c_defaultTimeoutMs);
+        return;
+    }
+
+    complete(true, reply);
+}
+
+void AsyncPort::onTimeout()
+{
+    switch(m_state)
+    {
+    case State::Idle:
+        return;
+
+    case State::Syncing:
+        if (EventLoop::Clock::now() >= m_syncDeadline)
+        {
+            complete(false, {});
+        }
+        else
+        {
+            sendSync();
+        }
+        return;
+
+    case State::Resync:
+        complete(false, {});
+        return;
+
+    case State::Request:
+        break;
+    }
+
+    // a stream that stopped is picked up again by the caller
+    if (m_request.onData || (m_attempt >= m_request.retries))
+    {
+        complete(false, {});
+        return;
+    }
+
+    m_attempt++;
+    sendRequest(true);
+}
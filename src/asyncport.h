@@ -0,0 +1,248 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <span>
+#include <array>
+#include <functional>
+#include <coroutine>
+#include <algorithm>
+#include "serial.h"
+#include "eventloop.h"
+
+/** a programmer driven from an EventLoop. One request at a time is
+    sent and the reply is handed to a callback, or to a coroutine that
+    awaits transact(), so many ports can share a thread. Lost and
+    corrupted frames are handled as in PIC16A::transact.
+*/
+class AsyncPort
+{
+public:
+    /** ok is false if no valid reply arrived. reply holds the status
+        byte and the reply data, and is only valid during the call.
+    */
+    using ReplyHandler = std::function<void(bool ok, std::span<const uint8_t> reply)>;
+
+    /** called for every c_replyData frame of a streaming request */
+    using DataHandler  = std::function<void(std::span<const uint8_t> reply)>;
+
+    struct Request
+    {
+        PGMOperation            op;
+        std::vector<uint8_t>    args;
+        int                     timeoutMs = Serial::c_defaultTimeoutMs;
+        size_t                  retries   = c_maxRetries;
+
+        /** set for streaming requests. A stream that stops is not sent
+            again: the reply handler is called with ok = false and the
+            caller asks for the items it has not received.
+        */
+        DataHandler             onData = nullptr;
+    };
+
+    AsyncPort(EventLoop &loop, std::shared_ptr<Serial> serial);
+    ~AsyncPort();
+
+    AsyncPort(const AsyncPort&) = delete;
+    AsyncPort& operator=(const AsyncPort&) = delete;
+
+    /** false if the port could not be added to the event loop */
+    bool isOpen() const noexcept
+    {
+        return m_watching;
+    }
+
+    /** send a request. Only one request can be outstanding. */
+    void send(Request request, ReplyHandler done);
+
+    /** poll the programmer with Sync frames until it answers, see Session::waitForProgrammer */
+    void waitForProgrammer(int timeoutMilliSeconds, std::function<void(bool ok)> done);
+
+    /** call a function after a delay, for ICSP delays and back-offs */
+    void after(int milliSeconds, std::function<void()> callback);
+
+    /** a reply, copied out of the receive buffer for the awaiting coroutine */
+    struct Reply
+    {
+        bool    ok    = false;      ///< false if no valid reply arrived
+        size_t  bytes = 0;
+        std::array<uint8_t, Framing::c_maxBodySize> data;   ///< status byte and reply data
+
+        std::span<const uint8_t> view() const noexcept
+        {
+            return std::span<const uint8_t>(data.data(), bytes);
+        }
+    };
+
+    class TransactAwaiter
+    {
+    public:
+        TransactAwaiter(AsyncPort &port, Request request) : m_port(port), m_request(std::move(request)) {}
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> caller)
+        {
+            m_port.send(std::move(m_request), [this, caller](bool ok, std::span<const uint8_t> reply)
+                {
+                    m_reply.ok    = ok;
+                    m_reply.bytes = reply.size();
+                    std::copy(reply.begin(), reply.end(), m_reply.data.begin());
+                    caller.resume();
+                }
+            );
+        }
+
+        Reply await_resume() const noexcept
+        {
+            return m_reply;
+        }
+
+    protected:
+        AsyncPort   &m_port;
+        Request     m_request;
+        Reply       m_reply;
+    };
+
+    class SyncAwaiter
+    {
+    public:
+        SyncAwaiter(AsyncPort &port, int timeoutMilliSeconds) : m_port(port), m_timeoutMs(timeoutMilliSeconds) {}
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> caller)
+        {
+            m_port.waitForProgrammer(m_timeoutMs, [this, caller](bool ok)
+                {
+                    m_ok = ok;
+                    caller.resume();
+                }
+            );
+        }
+
+        bool await_resume() const noexcept
+        {
+            return m_ok;
+        }
+
+    protected:
+        AsyncPort   &m_port;
+        int         m_timeoutMs;
+        bool        m_ok = false;
+    };
+
+    class DelayAwaiter
+    {
+    public:
+        DelayAwaiter(AsyncPort &port, int milliSeconds) : m_port(port), m_delayMs(milliSeconds) {}
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> caller)
+        {
+            m_port.after(m_delayMs, [caller]()
+                {
+                    caller.resume();
+                }
+            );
+        }
+
+        void await_resume() const noexcept {}
+
+    protected:
+        AsyncPort   &m_port;
+        int         m_delayMs;
+    };
+
+    /** co_await transact(request) sends the request and yields the Reply */
+    TransactAwaiter transact(Request request)
+    {
+        return TransactAwaiter(*this, std::move(request));
+    }
+
+    /** co_await online(timeout) polls the programmer with Sync frames and yields true when it answers */
+    SyncAwaiter online(int timeoutMilliSeconds)
+    {
+        return SyncAwaiter(*this, timeoutMilliSeconds);
+    }
+
+    /** co_await delay(ms) resumes the coroutine after a delay */
+    DelayAwaiter delay(int milliSeconds)
+    {
+        return DelayAwaiter(*this, milliSeconds);
+    }
+
+    /** stop watching the port and drop the outstanding request, if any */
+    void close();
+
+    Serial& serial() noexcept
+    {
+        return *m_serial;
+    }
+
+    EventLoop& loop() noexcept
+    {
+        return m_loop;
+    }
+
+    /** number of times a frame is sent again before giving up */
+    constexpr static size_t c_maxRetries = 3;
+
+    /** quiet time after a corrupted frame before a frame is sent again */
+    constexpr static int c_corruptQuietMs = 50;
+
+    /** interval of the Sync frames sent by waitForProgrammer */
+    constexpr static int c_syncIntervalMs = 20;
+
+protected:
+    enum class State
+    {
+        Idle,
+        Request,        ///< waiting for the reply to m_request
+        Resync,         ///< restarting the sequence numbering before m_request is sent again
+        Syncing         ///< waitForProgrammer
+    };
+
+    void onReadable();
+    void onFrame(const Serial::FrameResult &result);
+    void onTimeout();
+
+    /** (re)start the reply timer */
+    void armTimer(int milliSeconds);
+    void cancelTimer();
+
+    /** send m_request as a new frame or with its original sequence number */
+    void sendRequest(bool resend);
+    void sendSync();
+
+    /** finish the outstanding request or Sync polling */
+    void complete(bool ok, std::span<const uint8_t> reply);
+
+    EventLoop               &m_loop;
+    std::shared_ptr<Serial> m_serial;
+    bool                    m_watching = false;
+
+    State                   m_state = State::Idle;
+    Request                 m_request;
+    ReplyHandler            m_done;
+    uint8_t                 m_seq = 0;
+    size_t                  m_attempt = 0;
+
+    EventLoop::TimerId      m_timer = 0;
+    EventLoop::Clock::time_point m_syncDeadline;
+
+    std::array<uint8_t, Framing::c_maxBodySize> m_reply;
+};
@@ -0,0 +1,397 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include <algorithm>
+#include <cstring>
+#include "asyncprogrammer.h"
+#include "utils.h"
+
+// defined in pic16a.cpp
+std::ostream& operator<<(std::ostream &os, const PGMOperation &op);
+
+void AsyncProgrammer::replyError(PGMOperation op, const AsyncPort::Reply &reply)
+{
+    m_log.err << "CMD " << op << " failed! reply=";
+    m_log.err << std::hex << static_cast<uint16_t>(reply.data[0]) << std::dec << "\n";
+}
+
+Task<bool> AsyncProgrammer::command(PGMOperation op, std::vector<uint8_t> args, uint8_t *data, size_t dataLen)
+{
+    AsyncPort::Request request{op, std::move(args)};
+    auto reply = co_await m_port.transact(std::move(request));
+    if (!reply.ok)
+    {
+        m_log.err << "No response to cmd " << op << "\n";
+        co_return false;
+    }
+
+    if ((reply.data[0] != (static_cast<uint8_t>(op) | 0x80)) || (reply.bytes != (dataLen + 1)))
+    {
+        replyError(op, reply);
+        co_return false;
+    }
+
+    if (dataLen > 0)
+    {
+        memcpy(data, &reply.data[1], dataLen);
+    }
+    co_return true;
+}
+
+Task<bool> AsyncProgrammer::enterProgMode(EntrySequence sequence)
+{
+    co_return co_await command((sequence == EntrySequence::PGMPin) ?
+        PGMOperation::EnterProgModeWithPGM : PGMOperation::EnterProgMode);
+}
+
+Task<bool> AsyncProgrammer::exitProgMode(EntrySequence sequence)
+{
+    co_return co_await command((sequence == EntrySequence::PGMPin) ?
+        PGMOperation::ExitProgModeWithPGM : PGMOperation::ExitProgMode);
+}
+
+Task<std::optional<uint16_t> > AsyncProgrammer::readDeviceId()
+{
+    std::array<uint8_t, 2> bytes;
+    if (!co_await command(PGMOperation::LoadConfig) ||
+        !co_await command(PGMOperation::PointerIncrement, 6) ||
+        !co_await command(PGMOperation::ReadPage, 1, bytes.data(), bytes.size()))
+    {
+        co_return std::nullopt;
+    }
+
+    co_return static_cast<uint16_t>(bytes.at(0) | (static_cast<uint16_t>(bytes.at(1)) << 8));
+}
+
+Task<bool> AsyncProgrammer::massErase()
+{
+    // the programmer acks once the erase has completed
+    co_return co_await command(PGMOperation::ResetPointer) &&
+        co_await command(PGMOperation::MassErasePIC16A);
+}
+
+Task<std::optional<bool> > AsyncProgrammer::isDeviceBlank(const DeviceInfo &info)
+{
+    for(size_t start = 0; start < info.flashMemSize; start += c_blankCheckWords)
+    {
+        const size_t count = std::min<size_t>(info.flashMemSize - start, c_blankCheckWords);
+        std::vector<uint8_t> args =
+        {
+            static_cast<uint8_t>(start & 0xFF),
+            static_cast<uint8_t>(start >> 8),
+            static_cast<uint8_t>(count & 0xFF),
+            static_cast<uint8_t>(count >> 8)
+        };
+
+        AsyncPort::Request request{PGMOperation::BlankCheckRange, std::move(args)};
+        auto reply = co_await m_port.transact(std::move(request));
+
+        if (!reply.ok)
+        {
+            m_log.err << "No response to cmd " << PGMOperation::BlankCheckRange << "\n";
+            co_return std::nullopt;
+        }
+
+        const bool ok = reply.data[0] == (static_cast<uint8_t>(PGMOperation::BlankCheckRange) | 0x80);
+        if (ok && (reply.bytes == 5))
+        {
+            m_log.out << "### Warning: uC is not blank! ###\n";
+            m_log.out << "  address " << Utils::toHex(reply.data[1] | (static_cast<uint32_t>(reply.data[2]) << 8));
+            m_log.out << " holds " << Utils::toHex(reply.data[3] | (static_cast<uint32_t>(reply.data[4]) << 8)) << "\n";
+            co_return false;
+        }
+
+        if (!ok || (reply.bytes != 1))
+        {
+            replyError(PGMOperation::BlankCheckRange, reply);
+            co_return std::nullopt;
+        }
+    }
+    co_return true;
+}
+
+Task<bool> AsyncProgrammer::uploadFlash(const MemoryImage &memory, size_t &words)
+{
+    // every page carries its address, so blank pages are simply not sent
+    uint8_t pageSeq = 0;
+    for(auto index : memory.usedPages())
+    {
+        const size_t address = index*memory.pageWords();
+        auto data = memory.page(index);
+
+        std::vector<uint8_t> args;
+        args.reserve(5 + data.size());
+        args.push_back(pageSeq);
+        args.push_back(data.size()/2);      // number of words, not bytes.
+        args.push_back(1);                  // speed, 1 = slow, 0 = fast ?
+        args.push_back(address & 0xFF);
+        args.push_back(address >> 8);
+        args.insert(args.end(), data.begin(), data.end());
+
+        AsyncPort::Request request{PGMOperation::WritePageSeq, std::move(args)};
+        auto reply = co_await m_port.transact(std::move(request));
+        const bool acked = reply.ok &&
+            (((reply.data[0] == (static_cast<uint8_t>(PGMOperation::WritePageSeq) | 0x80))
+                && (reply.bytes == 2) && (reply.data[1] == pageSeq))
+            || (reply.data[0] == c_replyDuplicate));     // executed before, the reply got lost
+
+        if (!acked)
+        {
+            m_log.err << "CMD WritePageSeq failed for page " << static_cast<int>(pageSeq);
+            if (reply.ok)
+            {
+                m_log.err << " reply=" << std::hex << static_cast<uint16_t>(reply.data[0]) << std::dec;
+            }
+            m_log.err << "\n";
+            co_return false;
+        }
+
+        pageSeq++;
+        words += memory.pageWords();
+    }
+    co_return true;
+}
+
+Task<bool> AsyncProgrammer::uploadConfig(const DeviceInfo &info, std::span<const uint8_t> config)
+{
+    if (config.size() != (info.configSize*2))
+    {
+        m_log.err << "Error: writeConfig requires " << info.configSize*2 << " bytes\n";
+        co_return false;
+    }
+
+    if (!co_await command(PGMOperation::ResetPointer) ||
+        !co_await command(PGMOperation::LoadConfig) ||
+        !co_await command(PGMOperation::PointerIncrement, 7))
+    {
+        co_return false;
+    }
+
+    for(size_t i=0; i<config.size(); i += 2)
+    {
+        // slow write, one word at a time
+        std::vector<uint8_t> args = {1, 1, config[i], config[i+1]};
+        if (!co_await command(PGMOperation::WritePage, std::move(args)))
+        {
+            co_return false;
+        }
+    }
+    co_return true;
+}
+
+Task<bool> AsyncProgrammer::seekPointer(size_t address)
+{
+    if (!co_await command(PGMOperation::ResetPointer))
+    {
+        co_return false;
+    }
+
+    while(address > 0)
+    {
+        const uint8_t step = std::min<size_t>(address, 255);
+        if (!co_await command(PGMOperation::PointerIncrement, step))
+        {
+            co_return false;
+        }
+        address -= step;
+    }
+    co_return true;
+}
+
+template<typename MakeRequest>
+Task<bool> AsyncProgrammer::streamItems(PGMOperation op, size_t count, size_t maxCount, size_t itemBytes,
+    uint8_t *dest, MakeRequest makeRequest)
+{
+    std::vector<ItemRange> todo;
+    for(size_t first = 0; first < count; first += maxCount)
+    {
+        todo.push_back({first, std::min(count - first, maxCount), 0});
+    }
+
+    while(!todo.empty())
+    {
+        const auto range = todo.front();
+        todo.erase(todo.begin());
+
+        auto request = co_await makeRequest(range.first, range.count);
+        if (!request)
+        {
+            co_return false;
+        }
+
+        // items after a lost frame are kept, the gap is asked for again
+        std::vector<ItemRange> missing;
+        size_t next     = 0;    // first item of the range not received yet
+        size_t received = 0;
+        request->onData = [&missing, &next, &received, range, itemBytes, dest](std::span<const uint8_t> reply)
+        {
+            if ((reply.size() <= 3) || (((reply.size() - 3) % itemBytes) != 0))
+            {
+                return;
+            }
+
+            const size_t offset = reply[1] | (static_cast<size_t>(reply[2]) << 8);
+            const size_t items  = (reply.size() - 3) / itemBytes;
+            if ((offset < next) || ((offset + items) > range.count))
+            {
+                return;
+            }
+
+            if (offset > next)
+            {
+                missing.push_back({range.first + next, offset - next, 0});
+            }
+
+            memcpy(dest + (range.first + offset)*itemBytes, &reply[3], items*itemBytes);
+            next = offset + items;
+            received += items;
+        };
+
+        auto reply = co_await m_port.transact(std::move(*request));
+        if (reply.ok && (reply.data[0] != (static_cast<uint8_t>(op) | 0x80)))
+        {
+            replyError(op, reply);
+            co_return false;
+        }
+
+        if (next < range.count)
+        {
+            missing.push_back({range.first + next, range.count - next, 0});
+        }
+
+        // a range that keeps failing without any progress is given up
+        const size_t tries = (received > 0) ? 0 : range.tries + 1;
+        if (tries > AsyncPort::c_maxRetries)
+        {
+            m_log.err << "CMD " << op << ": too many retries\n";
+            co_return false;
+        }
+
+        for(auto &m : missing)
+        {
+            m.tries = tries;
+            m_port.serial().countRetry();
+            todo.push_back(m);
+        }
+    }
+    co_return true;
+}
+
+Task<bool> AsyncProgrammer::downloadFlash(const DeviceInfo &info, size_t address, std::span<uint8_t> dest)
+{
+    const size_t words = dest.size() / 2;
+    if (((dest.size() & 1) != 0) || ((address + words) > info.flashMemSize))
+    {
+        co_return false;
+    }
+
+    co_return co_await streamItems(PGMOperation::ReadRange, words, 0xFFFF, 2, dest.data(),
+        [this, address](size_t first, size_t count) -> Task<std::optional<AsyncPort::Request> >
+        {
+            if (!co_await seekPointer(address + first))
+            {
+                co_return std::nullopt;
+            }
+
+            AsyncPort::Request request{PGMOperation::ReadRange,
+                {
+                    static_cast<uint8_t>(count & 0xFF),
+                    static_cast<uint8_t>(count >> 8)
+                }
+            };
+            co_return request;
+        }
+    );
+}
+
+Task<std::vector<uint32_t> > AsyncProgrammer::readPageCrcs(const DeviceInfo &info)
+{
+    const size_t blockWords = info.flashPageSize;
+    const size_t blocks = info.flashMemSize / blockWords;
+    std::vector<uint8_t> crcBytes(blocks*4);
+    const bool ok = co_await streamItems(PGMOperation::CrcRange, blocks, 0xFFFF / blockWords, 4, crcBytes.data(),
+        [blockWords](size_t first, size_t count) -> Task<std::optional<AsyncPort::Request> >
+        {
+            const size_t start = first*blockWords;
+            const size_t words = count*blockWords;
+            AsyncPort::Request request{PGMOperation::CrcRange,
+                {
+                    static_cast<uint8_t>(start & 0xFF),
+                    static_cast<uint8_t>(start >> 8),
+                    static_cast<uint8_t>(words & 0xFF),
+                    static_cast<uint8_t>(words >> 8),
+                    static_cast<uint8_t>(blockWords)
+                }
+            };
+            co_return request;
+        }
+    );
+
+    std::vector<uint32_t> crcs;
+    if (!ok)
+    {
+        co_return crcs;
+    }
+
+    crcs.resize(blocks);
+    for(size_t i=0; i<blocks; i++)
+    {
+        crcs.at(i) = static_cast<uint32_t>(crcBytes.at(4*i))
+            | (static_cast<uint32_t>(crcBytes.at(4*i+1)) << 8)
+            | (static_cast<uint32_t>(crcBytes.at(4*i+2)) << 16)
+            | (static_cast<uint32_t>(crcBytes.at(4*i+3)) << 24);
+    }
+    co_return crcs;
+}
+
+Task<std::optional<std::vector<FlashMismatch> > > AsyncProgrammer::verifyFlash(const DeviceInfo &info,
+    const MemoryImage &memory, size_t address, size_t words)
+{
+    if (((address + words) > info.flashMemSize) || ((address + words) > memory.sizeWords()))
+    {
+        co_return std::nullopt;
+    }
+
+    std::vector<FlashMismatch> mismatches;
+    for(size_t offset = 0; offset < words; offset += c_maxVerifyWords)
+    {
+        const size_t start = address + offset;
+        const size_t count = std::min(words - offset, c_maxVerifyWords);
+        std::vector<uint8_t> args = {static_cast<uint8_t>(start & 0xFF), static_cast<uint8_t>(start >> 8)};
+        for(size_t i=0; i<count; i++)
+        {
+            const uint16_t word = memory.word(start + i);
+            args.push_back(word & 0xFF);
+            args.push_back(word >> 8);
+        }
+
+        AsyncPort::Request request{PGMOperation::VerifyPage, std::move(args)};
+        auto reply = co_await m_port.transact(std::move(request));
+        if (!reply.ok)
+        {
+            m_log.err << "No response to cmd " << PGMOperation::VerifyPage << "\n";
+            co_return std::nullopt;
+        }
+
+        if ((reply.data[0] != (static_cast<uint8_t>(PGMOperation::VerifyPage) | 0x80))
+            || (reply.bytes < 2) || (reply.bytes != (2 + 3*static_cast<size_t>(reply.data[1]))))
+        {
+            replyError(PGMOperation::VerifyPage, reply);
+            co_return std::nullopt;
+        }
+
+        for(size_t i=0; i<reply.data[1]; i++)
+        {
+            const uint8_t *entry = &reply.data[2 + 3*i];
+            const size_t wordAddress = start + entry[0];
+            mismatches.push_back(
+                {
+                    wordAddress,
+                    memory.word(wordAddress),
+                    static_cast<uint16_t>(entry[1] | (static_cast<uint16_t>(entry[2]) << 8))
+                }
+            );
+        }
+    }
+    co_return mismatches;
+}
@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <vector>
+#include <span>
+#include "asyncport.h"
+#include "task.h"
+#include "session.h"
+#include "devicepgminterface.h"
+#include "pgmfactory.h"
+
+/** the IDeviceProgrammer operations of the PIC16A command set as
+    coroutines on an AsyncPort. They read like the PIC16A code, but
+    every co_await hands the thread to the other sessions on the loop
+    until the reply arrives. Messages go to the session log.
+*/
+class AsyncProgrammer
+{
+public:
+    AsyncProgrammer(AsyncPort &port, SessionLog &log) : m_port(port), m_log(log) {}
+
+    /** enter or leave programming mode with the given entry sequence */
+    Task<bool> enterProgMode(EntrySequence sequence = EntrySequence::LowVoltageKey);
+    Task<bool> exitProgMode(EntrySequence sequence = EntrySequence::LowVoltageKey);
+
+    Task<std::optional<uint16_t> > readDeviceId();
+
+    Task<bool> massErase();
+
+    /** true if blank, false if not blank, nullopt if the check could not be done */
+    Task<std::optional<bool> > isDeviceBlank(const DeviceInfo &info);
+
+    /** program the non-blank pages of an image. words counts the words programmed. */
+    Task<bool> uploadFlash(const MemoryImage &memory, size_t &words);
+
+    Task<bool> uploadConfig(const DeviceInfo &info, std::span<const uint8_t> config);
+
+    /** read words from a word address, dest.size()/2 words */
+    Task<bool> downloadFlash(const DeviceInfo &info, size_t address, std::span<uint8_t> dest);
+
+    /** CRC-32 of each flash page, empty on error */
+    Task<std::vector<uint32_t> > readPageCrcs(const DeviceInfo &info);
+
+    /** compare words of flash against the image, see IDeviceProgrammer::verifyFlash */
+    Task<std::optional<std::vector<FlashMismatch> > > verifyFlash(const DeviceInfo &info,
+        const MemoryImage &memory, size_t address, size_t words);
+
+protected:
+    /** send a command and check that it succeeded. The reply data, if any,
+        must be exactly dataLen bytes and is copied to data.
+    */
+    Task<bool> command(PGMOperation op, std::vector<uint8_t> args = std::vector<uint8_t>(),
+        uint8_t *data = nullptr, size_t dataLen = 0);
+
+    /** a command with a one byte argument */
+    Task<bool> command(PGMOperation op, uint8_t arg, uint8_t *data = nullptr, size_t dataLen = 0)
+    {
+        return command(op, std::vector<uint8_t>(1, arg), data, dataLen);
+    }
+
+    /** move the pointer to a flash word address */
+    Task<bool> seekPointer(size_t address);
+
+    /** a range of streamed items, see PIC16A::ItemRange */
+    struct ItemRange
+    {
+        size_t first;
+        size_t count;
+        size_t tries;   ///< attempts that did not make any progress
+    };
+
+    /** fetch count items of itemBytes each, in requests of at most maxCount items.
+        request(first, count) makes the request for a range of items; it is a
+        coroutine so it can send commands of its own first. Items lost from a
+        stream, or not sent when it stopped early, are asked for again.
+    */
+    template<typename MakeRequest>
+    Task<bool> streamItems(PGMOperation op, size_t count, size_t maxCount, size_t itemBytes,
+        uint8_t *dest, MakeRequest makeRequest);
+
+    /** report a reply that is not the success status of op */
+    void replyError(PGMOperation op, const AsyncPort::Reply &reply);
+
+    AsyncPort   &m_port;
+    SessionLog  &m_log;
+
+    /** words per BlankCheckRange request, see PIC16A::c_blankCheckWords */
+    constexpr static size_t c_blankCheckWords = 2048;
+
+    /** words per VerifyPage request, see PIC16A::c_maxVerifyWords */
+    constexpr static size_t c_maxVerifyWords = 64;
+};
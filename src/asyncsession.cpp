@@ -0,0 +1,280 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include <array>
+#include <algorithm>
+#include "asyncsession.h"
+
+AsyncSession::AsyncSession(EventLoop &loop, const std::string &port, uint32_t baudrate,
+    const DeviceInfo *target, const std::string &hexFilename, ImageStore &images,
+    const JobOptions &options, bool verbose, Gang::PortResult &result)
+    : m_loop(loop), m_portName(port), m_baudRate(baudrate), m_target(target),
+      m_hexFilename(hexFilename), m_images(images), m_options(options), m_result(result),
+      m_log{m_messages, m_messages, verbose}
+{
+}
+
+bool AsyncSession::supports(const DeviceInfo *target, const JobOptions &options)
+{
+    const bool supportedTarget = (target == nullptr) ||
+        (ProgrammerFactory::entrySequence(target->deviceFamily) == EntrySequence::LowVoltageKey);
+    return supportedTarget && !options.delta && !options.partial;
+}
+
+void AsyncSession::start()
+{
+    m_task = run();
+    m_task.start();
+}
+
+void AsyncSession::startImageLoad(const DeviceInfo &info)
+{
+    if (m_hexFilename.empty())
+    {
+        m_image = std::make_shared<const ProgramImage>(info);
+        return;
+    }
+
+    m_loading = std::make_unique<Background>(m_loop, [this, &info]()
+        {
+            SessionLog loadLog{m_loadMessages, m_loadMessages, m_log.verbose};
+            m_image = m_images.get(m_hexFilename, info, loadLog);
+        }
+    );
+}
+
+Task<bool> AsyncSession::imageLoaded()
+{
+    if (m_loading)
+    {
+        co_await *m_loading;
+        m_loading.reset();
+        m_messages << m_loadMessages.str();
+    }
+    co_return m_image != nullptr;
+}
+
+Task<void> AsyncSession::run()
+{
+    const auto start = Serial::Clock::now();
+    m_result.port = m_portName;
+
+    // the HEX file is read while the programmer comes online
+    if (m_target != nullptr)
+    {
+        startImageLoad(*m_target);
+    }
+
+    if (co_await openProgrammer())
+    {
+        if (m_target == nullptr)
+        {
+            m_target = co_await detectDevice();
+            if (m_target == nullptr)
+            {
+                m_log.err << "Could not detect the target device\n";
+            }
+            else if (!supports(m_target, m_options))
+            {
+                m_log.err << "Device family " << familyName(m_target->deviceFamily);
+                m_log.err << " is not supported by the event loop\n";
+                m_target = nullptr;
+            }
+            else
+            {
+                startImageLoad(*m_target);
+            }
+        }
+
+        if ((m_target != nullptr) && co_await m_pgm->enterProgMode())
+        {
+            m_result.device = m_target->deviceName;
+            m_result.ok = co_await runJob(*m_target);
+            co_await m_pgm->exitProgMode();
+        }
+    }
+
+    // the background load uses the session, so it must be done first
+    co_await imageLoaded();
+    if (m_port)
+    {
+        m_port->close();
+    }
+
+    if (!m_result.ok)
+    {
+        m_result.words = 0;
+    }
+    m_result.seconds = std::chrono::duration<double>(Serial::Clock::now() - start).count();
+    m_result.log = m_messages.str();
+}
+
+Task<bool> AsyncSession::openProgrammer()
+{
+    auto serial = Serial::open(m_portName, Serial::c_defaultBaudRate);
+    if (!serial)
+    {
+        m_log.err << "Error opening serial port " << m_portName << " !\n";
+        co_return false;
+    }
+
+    m_port = std::make_unique<AsyncPort>(m_loop, serial);
+    m_pgm  = std::make_unique<AsyncProgrammer>(*m_port, m_log);
+    if (!m_port->isOpen())
+    {
+        m_log.err << "Cannot watch serial port " << m_portName << "\n";
+        co_return false;
+    }
+
+    if (m_log.verbose)
+    {
+        m_log.out << "Serial port " << m_portName << " opened, waiting for the programmer to come online..\n";
+    }
+
+    // Arduino resets when the UART connects.
+    // and we have to wait a bit before the uC comes online.
+    const auto syncStart = Serial::Clock::now();
+    if (!co_await m_port->online(3000))
+    {
+        m_log.err << "Programmer does not respond on " << m_portName << "\n";
+        co_return false;
+    }
+
+    if (m_log.verbose)
+    {
+        auto syncTime = std::chrono::duration_cast<std::chrono::milliseconds>(Serial::Clock::now() - syncStart);
+        m_log.out << "Programmer online after " << syncTime.count() << " ms\n";
+    }
+
+    if (co_await negotiateBaudRate() && m_log.verbose)
+    {
+        m_log.out << "Link running at " << m_port->serial().baudRate() << " baud\n";
+    }
+    co_return true;
+}
+
+Task<bool> AsyncSession::negotiateBaudRate()
+{
+    auto &serial = m_port->serial();
+    const uint32_t oldRate = serial.baudRate();
+    if (m_baudRate == oldRate)
+    {
+        co_return true;
+    }
+
+    std::vector<uint8_t> args(4);
+    for(uint32_t i=0; i<4; i++)
+    {
+        args.at(i) = static_cast<uint8_t>(m_baudRate >> (i*8));
+    }
+
+    AsyncPort::Request request{PGMOperation::SetBaudRate, std::move(args)};
+    auto reply = co_await m_port->transact(std::move(request));
+    if (!reply.ok || (reply.data[0] != (static_cast<uint8_t>(PGMOperation::SetBaudRate) | 0x80)))
+    {
+        m_log.err << "Programmer does not support " << m_baudRate << " baud\n";
+        co_return false;
+    }
+
+    // the programmer has switched; follow it and check the link.
+    const std::array<uint8_t, 5> echo = {static_cast<uint8_t>(PGMOperation::Echo) | 0x80, 0x55, 0xAA, 0x00, 0xFF};
+    if (serial.setBaudRate(m_baudRate))
+    {
+        std::vector<uint8_t> pattern(echo.begin() + 1, echo.end());
+        AsyncPort::Request echoRequest{PGMOperation::Echo, std::move(pattern), 100, 0};
+        reply = co_await m_port->transact(std::move(echoRequest));
+        if (reply.ok && std::equal(echo.begin(), echo.end(), reply.view().begin(), reply.view().end()))
+        {
+            co_return true;
+        }
+    }
+
+    // the programmer reverts to the old rate when it
+    // does not see a valid echo frame within 250ms.
+    m_log.err << "Link test at " << m_baudRate << " baud failed, falling back to " << oldRate << " baud\n";
+    co_await m_port->delay(300);
+    serial.setBaudRate(oldRate);
+
+    // the echo frame used up a sequence number the programmer never saw
+    co_await m_port->online(500);
+    co_return false;
+}
+
+Task<const DeviceInfo*> AsyncSession::detectDevice()
+{
+    for(auto const &probe : Session::c_detectProbes)
+    {
+        co_await m_pgm->enterProgMode(probe.first);
+        auto idOpt = co_await m_pgm->readDeviceId();
+        co_await m_pgm->exitProgMode(probe.first);
+        if (auto target = Session::identify(probe.first, idOpt, m_log))
+        {
+            co_return target.value();
+        }
+    }
+    co_return nullptr;
+}
+
+Task<bool> AsyncSession::runJob(const DeviceInfo &info)
+{
+    auto idOpt = co_await m_pgm->readDeviceId();
+    if (!Session::checkDeviceId(idOpt, info, m_log))
+    {
+        co_return false;
+    }
+
+    using Step = Session::JobFlow::Step;
+    Session::JobFlow flow(m_options, m_log);
+    for(auto step = flow.next(); step != Step::Done; step = flow.next())
+    {
+        // nothing is erased before the image is known to be good
+        if ((step != Step::BlankCheck) && !co_await imageLoaded())
+        {
+            co_return false;
+        }
+
+        switch(step)
+        {
+        case Step::BlankCheck:
+            flow.blankCheckDone(co_await m_pgm->isDeviceBlank(info));
+            break;
+        case Step::Erase:
+            flow.stepDone(co_await m_pgm->massErase());
+            break;
+        case Step::Upload:
+            flow.stepDone(co_await m_pgm->uploadFlash(m_image->flash, m_result.words) &&
+                co_await m_pgm->uploadConfig(info, m_image->config));
+            break;
+        case Step::Verify:
+            flow.stepDone(co_await verifyImage(info, m_image->flash));
+            break;
+        default:
+            // delta and partial jobs are not run here, see supports()
+            flow.stepDone(false);
+            break;
+        }
+    }
+    co_return flow.ok();
+}
+
+Task<bool> AsyncSession::verifyImage(const DeviceInfo &info, const MemoryImage &flash)
+{
+    Session::VerifyReport report(flash, m_options.partial, m_log);
+    auto deviceCrcs = co_await m_pgm->readPageCrcs(info);
+    auto pages = report.pagesToCheck(deviceCrcs);
+    if (!pages)
+    {
+        co_return false;
+    }
+
+    for(auto page : pages.value())
+    {
+        const size_t pageSize = info.flashPageSize;
+        auto mismatches = co_await m_pgm->verifyFlash(info, flash, page*pageSize, pageSize);
+        if (!report.pageChecked(page, mismatches))
+        {
+            co_return false;
+        }
+    }
+    co_return report.ok();
+}
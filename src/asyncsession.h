@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#pragma once
+#include <memory>
+#include <sstream>
+#include <string>
+#include "asyncport.h"
+#include "asyncprogrammer.h"
+#include "task.h"
+#include "session.h"
+#include "imagestore.h"
+#include "gang.h"
+
+/** a session on one port as a coroutine, so it can run on an EventLoop
+    next to the sessions on other ports. It follows the steps of a
+    single port run: open the programmer, find or check the target,
+    then blank check, erase, program and verify.
+
+    The HEX file is loaded on a background thread as soon as the target
+    is known, while the session waits for the programmer or runs the
+    blank check.
+*/
+class AsyncSession
+{
+public:
+    /** target is nullptr to detect the target */
+    AsyncSession(EventLoop &loop, const std::string &port, uint32_t baudrate, const DeviceInfo *target,
+        const std::string &hexFilename, ImageStore &images, const JobOptions &options, bool verbose,
+        Gang::PortResult &result);
+
+    /** run the session until it first waits. The result is stored when it is done. */
+    void start();
+
+    bool isDone() const noexcept
+    {
+        return m_task.isDone();
+    }
+
+    /** true if the job can be run by AsyncSession, else use Session */
+    static bool supports(const DeviceInfo *target, const JobOptions &options);
+
+protected:
+    Task<void> run();
+
+    /** wait for the programmer and switch to the baud rate, see Session::openProgrammer */
+    Task<bool> openProgrammer();
+    Task<bool> negotiateBaudRate();
+
+    /** find the target by reading its ID, see Session::detectDevice */
+    Task<const DeviceInfo*> detectDevice();
+
+    /** the job on a target in programming mode, see Session::runJob */
+    Task<bool> runJob(const DeviceInfo &info);
+
+    /** compare the flash with the image by page CRCs, then word by word */
+    Task<bool> verifyImage(const DeviceInfo &info, const MemoryImage &flash);
+
+    /** load the image for the target on a background thread */
+    void startImageLoad(const DeviceInfo &info);
+
+    /** wait for the image. returns false if it could not be loaded. */
+    Task<bool> imageLoaded();
+
+    EventLoop                   &m_loop;
+    std::string                 m_portName;
+    uint32_t                    m_baudRate;
+    const DeviceInfo            *m_target;
+    std::string                 m_hexFilename;
+    ImageStore                  &m_images;
+    JobOptions                  m_options;
+    Gang::PortResult            &m_result;
+
+    std::ostringstream          m_messages;
+    SessionLog                  m_log;
+
+    std::unique_ptr<AsyncPort>          m_port;
+    std::unique_ptr<AsyncProgrammer>    m_pgm;
+
+    /** the image and the messages of loading it, written by the background thread */
+    std::shared_ptr<const ProgramImage> m_image;
+    std::ostringstream                  m_loadMessages;
+    std::unique_ptr<Background>         m_loading;
+
+    Task<void>                  m_task;
+};
@@ -0,0 +1,439 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include <array>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "daemon.h"
+#include "devicedb.h"
+#include "pgmfactory.h"
+#include "utils.h"
+
+static constexpr const char *c_resultLine = "result ";
+
+std::string DaemonJob::encode() const
+{
+    std::ostringstream ss;
+    ss << "port="       << port << "\n";
+    ss << "baud="       << baudrate << "\n";
+    ss << "target="     << target << "\n";
+    ss << "input="      << hexFilename << "\n";
+    ss << "upload="     << options.upload << "\n";
+    ss << "verify="     << options.verify << "\n";
+    ss << "erase="      << options.erase << "\n";
+    ss << "blankcheck=" << options.blankCheck << "\n";
+    ss << "delta="      << options.delta << "\n";
+    ss << "partial="    << options.partial << "\n";
+    ss << "verbose="    << verbose << "\n";
+    ss << "\n";
+    return ss.str();
+}
+
+std::optional<DaemonJob> DaemonJob::decode(const std::string &text)
+{
+    DaemonJob job;
+    const std::map<std::string, std::string*> strings =
+    {
+        {"port",    &job.port},
+        {"target",  &job.target},
+        {"input",   &job.hexFilename}
+    };
+
+    const std::map<std::string, bool*> flags =
+    {
+        {"upload",      &job.options.upload},
+        {"verify",      &job.options.verify},
+        {"erase",       &job.options.erase},
+        {"blankcheck",  &job.options.blankCheck},
+        {"delta",       &job.options.delta},
+        {"partial",     &job.options.partial},
+        {"verbose",     &job.verbose}
+    };
+
+    std::istringstream ss(text);
+    std::string line;
+    while(std::getline(ss, line) && !line.empty())
+    {
+        const auto equals = line.find('=');
+        if (equals == std::string::npos)
+        {
+            return std::nullopt;
+        }
+
+        const auto key   = line.substr(0, equals);
+        const auto value = line.substr(equals + 1);
+        if (auto iter = strings.find(key); iter != strings.end())
+        {
+            *iter->second = value;
+        }
+        else if (auto iter = flags.find(key); iter != flags.end())
+        {
+            *iter->second = (value == "1");
+        }
+        else if (key == "baud")
+        {
+            job.baudrate = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 10));
+        }
+        else
+        {
+            return std::nullopt;
+        }
+    }
+
+    if (job.port.empty() || (job.baudrate == 0))
+    {
+        return std::nullopt;
+    }
+    return job;
+}
+
+static bool makeAddress(const std::string &socketPath, struct sockaddr_un &address)
+{
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        return false;
+    }
+
+    memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+    return true;
+}
+
+/** a socket connected to the daemon, -1 if there is none */
+static int connectTo(const std::string &socketPath)
+{
+    struct sockaddr_un address;
+    if (!makeAddress(socketPath, address))
+    {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool writeAll(int fd, const std::string &data)
+{
+    size_t offset = 0;
+    while(offset < data.size())
+    {
+        auto bytes = send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        offset += bytes;
+    }
+    return true;
+}
+
+std::string Daemon::defaultSocketPath()
+{
+    if (auto path = getenv("PICMEUP_SOCKET"); (path != nullptr) && (path[0] != 0))
+    {
+        return path;
+    }
+
+    if (auto dir = getenv("XDG_RUNTIME_DIR"); (dir != nullptr) && (dir[0] != 0))
+    {
+        return std::string(dir) + "/picmeupd.sock";
+    }
+
+    return "/tmp/picmeupd-" + std::to_string(getuid()) + ".sock";
+}
+
+Daemon::~Daemon()
+{
+    if (m_listenHandle >= 0)
+    {
+        ::close(m_listenHandle);
+        unlink(m_socketPath.c_str());
+    }
+}
+
+bool Daemon::listen(const std::string &socketPath)
+{
+    struct sockaddr_un address;
+    if (!makeAddress(socketPath, address))
+    {
+        std::cerr << "Socket path " << socketPath << " is too long\n";
+        return false;
+    }
+
+    // a socket file without a daemon is left over from one that died
+    if (int fd = connectTo(socketPath); fd >= 0)
+    {
+        ::close(fd);
+        std::cerr << "Another picmeupd is listening on " << socketPath << "\n";
+        return false;
+    }
+    unlink(socketPath.c_str());
+
+    m_listenHandle = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_listenHandle < 0)
+    {
+        return false;
+    }
+
+    if ((bind(m_listenHandle, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0) ||
+        (::listen(m_listenHandle, 16) != 0))
+    {
+        std::cerr << "Cannot listen on " << socketPath << ": " << strerror(errno) << "\n";
+        ::close(m_listenHandle);
+        m_listenHandle = -1;
+        return false;
+    }
+
+    // the programmers are only for this user
+    chmod(socketPath.c_str(), S_IRUSR | S_IWUSR);
+    m_socketPath = socketPath;
+    return true;
+}
+
+bool Daemon::openPort(const std::string &port, uint32_t baudrate, SessionLog &log)
+{
+    auto s = station(port);
+    std::lock_guard<std::mutex> lock(s->mutex);
+    return connect(*s, port, baudrate, log) != nullptr;
+}
+
+void Daemon::run()
+{
+    while(!m_stopped)
+    {
+        // wake up now and then to see if the daemon was stopped
+        struct pollfd pfd{m_listenHandle, POLLIN, 0};
+        if (poll(&pfd, 1, 250) <= 0)
+        {
+            continue;
+        }
+
+        int fd = accept4(m_listenHandle, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_clientMutex);
+            m_clients++;
+        }
+
+        std::thread([this, fd]()
+            {
+                serveClient(fd);
+
+                std::lock_guard<std::mutex> lock(m_clientMutex);
+                m_clients--;
+                m_clientsDone.notify_all();
+            }
+        ).detach();
+    }
+
+    std::unique_lock<std::mutex> lock(m_clientMutex);
+    m_clientsDone.wait(lock, [this]() { return m_clients == 0; });
+}
+
+std::shared_ptr<Daemon::Station> Daemon::station(const std::string &port)
+{
+    std::lock_guard<std::mutex> lock(m_stationMutex);
+    auto &s = m_stations[port];
+    if (!s)
+    {
+        s = std::make_shared<Station>();
+    }
+    return s;
+}
+
+std::shared_ptr<Serial> Daemon::connect(Station &station, const std::string &port, uint32_t baudrate,
+    SessionLog &log)
+{
+    // the programmer may have been unplugged or reset since the last job
+    if (station.serial && !Session::waitForProgrammer(*station.serial, c_aliveTimeoutMs))
+    {
+        log.out << "Programmer on " << port << " does not respond, opening the port again\n";
+        station.serial.reset();
+    }
+
+    if (!station.serial)
+    {
+        station.serial = Session::openProgrammer(port, baudrate, log);
+        return station.serial;
+    }
+
+    if ((station.serial->baudRate() != baudrate) &&
+        Session::negotiateBaudRate(*station.serial, baudrate, log) && log.verbose)
+    {
+        log.out << "Link running at " << station.serial->baudRate() << " baud\n";
+    }
+    return station.serial;
+}
+
+bool Daemon::runJob(const DaemonJob &job, SessionLog &log)
+{
+    const DeviceInfo *target = nullptr;
+    if (!job.target.empty())
+    {
+        target = DeviceDB::findByName(Utils::toLower(job.target));
+        if (target == nullptr)
+        {
+            log.err << "Cannot find target device " << job.target << " in device list\n";
+            return false;
+        }
+    }
+
+    auto s = station(job.port);
+    std::lock_guard<std::mutex> lock(s->mutex);
+    auto serial = connect(*s, job.port, job.baudrate, log);
+    if (!serial)
+    {
+        return false;
+    }
+
+    if (target == nullptr)
+    {
+        target = Session::detectDevice(serial, log);
+        if (target == nullptr)
+        {
+            log.err << "Could not detect the target device\n";
+            return false;
+        }
+        log.out << "Target " << target->deviceName << "\n";
+    }
+
+    auto pgm = ProgrammerFactory::create(target->deviceFamily, serial);
+    if (!pgm)
+    {
+        log.err << "Device family " << familyName(target->deviceFamily) << " is not supported\n";
+        return false;
+    }
+
+    auto image = job.hexFilename.empty() ? std::make_shared<const ProgramImage>(*target)
+        : m_images.get(job.hexFilename, *target, log);
+    if (!image)
+    {
+        return false;
+    }
+
+    pgm->enterProgMode();
+    const bool ok = Session::checkDevice(*pgm, *target, log) &&
+        Session::runJob(*pgm, *target, *image, job.options, log);
+    pgm->exitProgMode();
+    return ok;
+}
+
+void Daemon::serveClient(int fd)
+{
+    // the request ends with an empty line
+    std::string request;
+    std::array<char, 4096> buffer;
+    while((request.find("\n\n") == std::string::npos) && (request.size() < c_maxRequestSize))
+    {
+        auto bytes = ::read(fd, buffer.data(), buffer.size());
+        if ((bytes < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+
+        if (bytes <= 0)
+        {
+            break;
+        }
+        request.append(buffer.data(), bytes);
+    }
+
+    std::ostringstream messages;
+    bool ok = false;
+    auto job = DaemonJob::decode(request);
+    if (!job)
+    {
+        messages << "Malformed job request\n";
+    }
+    else
+    {
+        const auto start = Serial::Clock::now();
+        SessionLog log{messages, messages, job->verbose};
+        ok = runJob(*job, log);
+
+        const double seconds = std::chrono::duration<double>(Serial::Clock::now() - start).count();
+        std::ostringstream summary;
+        summary << job->port << " " << (ok ? "PASS" : "FAIL") << " ";
+        summary << std::fixed << std::setprecision(2) << seconds << " s\n";
+        std::cout << summary.str() << std::flush;
+    }
+
+    messages << c_resultLine << (ok ? "ok" : "failed") << "\n";
+    writeAll(fd, messages.str());
+    ::close(fd);
+}
+
+std::optional<bool> Daemon::submit(const std::string &socketPath, const DaemonJob &job, std::ostream &os)
+{
+    int fd = connectTo(socketPath);
+    if (fd < 0)
+    {
+        return std::nullopt;
+    }
+
+    if (!writeAll(fd, job.encode()))
+    {
+        ::close(fd);
+        return std::nullopt;
+    }
+    shutdown(fd, SHUT_WR);
+
+    std::string reply;
+    std::array<char, 4096> buffer;
+    while(true)
+    {
+        auto bytes = ::read(fd, buffer.data(), buffer.size());
+        if ((bytes < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+
+        if (bytes <= 0)
+        {
+            break;
+        }
+        reply.append(buffer.data(), bytes);
+    }
+    ::close(fd);
+
+    // the last line holds the result, the rest are the messages of the job
+    const auto lastLine = reply.rfind(c_resultLine);
+    if ((lastLine == std::string::npos) || ((lastLine > 0) && (reply.at(lastLine-1) != '\n')))
+    {
+        os << reply;
+        return std::nullopt;
+    }
+
+    os << reply.substr(0, lastLine);
+    return reply.compare(lastLine, std::string::npos, std::string(c_resultLine) + "ok\n") == 0;
+}
@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <optional>
+#include <ostream>
+#include "serial.h"
+#include "session.h"
+#include "imagestore.h"
+
+/** a job for picmeupd, as sent by the client.
+
+    On the socket a job is a line "key=value" per field, ended by an
+    empty line. The daemon replies with the messages of the job and a
+    last line "result ok" or "result failed", then closes the connection.
+*/
+struct DaemonJob
+{
+    std::string port;
+    uint32_t    baudrate = Serial::c_defaultBaudRate;
+    std::string target;         ///< device name, empty to detect the target
+    std::string hexFilename;    ///< absolute path, the daemon has its own working directory
+    JobOptions  options;
+    bool        verbose  = false;
+
+    std::string encode() const;
+
+    /** nullopt if a line is malformed or the port is missing */
+    static std::optional<DaemonJob> decode(const std::string &text);
+};
+
+/** picmeupd: keeps the programmers open between jobs, so a job does not
+    wait for the Arduino to reset when the port is opened, and keeps the
+    images it has loaded. Jobs arrive on a Unix domain socket; jobs for
+    different ports run at the same time, jobs for a port one by one.
+*/
+class Daemon
+{
+public:
+    explicit Daemon(bool useCache = true) : m_images(useCache) {}
+    ~Daemon();
+
+    Daemon(const Daemon&) = delete;
+    Daemon& operator=(const Daemon&) = delete;
+
+    /** $PICMEUP_SOCKET, $XDG_RUNTIME_DIR/picmeupd.sock or /tmp/picmeupd-<uid>.sock */
+    static std::string defaultSocketPath();
+
+    /** create the socket. Fails if another daemon is listening on it. */
+    bool listen(const std::string &socketPath);
+
+    /** open a programmer before the first job for it arrives */
+    bool openPort(const std::string &port, uint32_t baudrate, SessionLog &log);
+
+    /** accept jobs until stop() is called, then wait for the running jobs */
+    void run();
+
+    /** make run() return. Safe to call from a signal handler. */
+    void stop() noexcept
+    {
+        m_stopped = true;
+    }
+
+    /** run a job on a programmer of the daemon */
+    bool runJob(const DaemonJob &job, SessionLog &log);
+
+    /** send a job to the daemon and copy its messages to os.
+        returns the result of the job, or nullopt if the daemon cannot be reached.
+    */
+    static std::optional<bool> submit(const std::string &socketPath, const DaemonJob &job, std::ostream &os);
+
+protected:
+    /** a port with the programmer that stays open between jobs */
+    struct Station
+    {
+        std::mutex              mutex;      ///< held while a job runs on the port
+        std::shared_ptr<Serial> serial;
+    };
+
+    std::shared_ptr<Station> station(const std::string &port);
+
+    /** the programmer of a station, opened again if it no longer responds.
+        The station must be locked.
+    */
+    std::shared_ptr<Serial> connect(Station &station, const std::string &port, uint32_t baudrate,
+        SessionLog &log);
+
+    /** read a job from a client, run it and send the reply */
+    void serveClient(int fd);
+
+    /** time a programmer that was left open gets to answer a Sync frame */
+    constexpr static int c_aliveTimeoutMs = 100;
+
+    /** longest job request accepted */
+    constexpr static size_t c_maxRequestSize = 64*1024;
+
+    ImageStore          m_images;
+    std::string         m_socketPath;
+    int                 m_listenHandle = -1;
+    std::atomic<bool>   m_stopped{false};
+
+    std::mutex          m_stationMutex;
+    std::map<std::string, std::shared_ptr<Station> > m_stations;
+
+    /** clients are served on threads of their own */
+    std::mutex              m_clientMutex;
+    std::condition_variable m_clientsDone;
+    size_t                  m_clients = 0;
+};
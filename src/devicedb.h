@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#pragma once
+
+#include <span>
+#include <string_view>
+#include "deviceinfo.h"
+#include "devicetable.h"    // generated from devices.dat by devicegen
+
+/** The device database. The tables are generated at build time,
+    so looking up a device does not parse or allocate anything.
+*/
+namespace DeviceDB
+{
+    constexpr std::span<const DeviceInfo> devices()
+    {
+        return Generated::c_devices;
+    }
+
+    /** the distinct ID masks used by the devices */
+    constexpr std::span<const uint32_t> idMasks()
+    {
+        return Generated::c_idMasks;
+    }
+
+    /** find a device by its lower case name. returns nullptr if it is unknown. */
+    constexpr const DeviceInfo* findByName(std::string_view name)
+    {
+        const auto &seeds = Generated::c_nameSeeds;
+        const auto &slots = Generated::c_nameSlots;
+        const uint32_t seed = seeds[hash(name, 0) % seeds.size()];
+        const uint16_t index = slots[hash(name, seed) % slots.size()];
+        if ((index == c_noEntry) || (Generated::c_devices[index].deviceName != name))
+        {
+            return nullptr;
+        }
+        return &Generated::c_devices[index];
+    }
+
+    /** devices whose ID, masked with idMasks()[maskIndex], equals the 
+        masked ID read from a device. Several devices can share an ID.
+        returns indices into devices().
+    */
+    constexpr std::span<const uint16_t> findById(size_t maskIndex, uint32_t id)
+    {
+        const auto &seeds = Generated::c_idSeeds;
+        const auto &slots = Generated::c_idSlots;
+        const uint32_t key = idKey(maskIndex, id & Generated::c_idMasks[maskIndex]);
+        const uint32_t seed = seeds[hash(key, 0) % seeds.size()];
+        const uint16_t index = slots[hash(key, seed) % slots.size()];
+        if ((index == c_noEntry) || (Generated::c_idGroups[index].key != key))
+        {
+            return {};
+        }
+
+        const auto &group = Generated::c_idGroups[index];
+        return std::span<const uint16_t>(Generated::c_idDevices).subspan(group.first, group.count);
+    }
+};
@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#pragma once
+
+// Note: this file is also used by the devicegen build tool.
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <string_view>
+
+enum class DeviceFamily : uint8_t
+{
+    CF_P16F_A = 0,
+    CF_P16F_B,
+    CF_P16F_C,
+    CF_P16F_D,
+    CF_P18F_A,
+    CF_P18F_B,
+    CF_P18F_C,
+    CF_P18F_D,
+    CF_P18F_E,
+    CF_P18F_F,
+    CF_P18F_G,
+    CF_P18F_Q,
+    CF_P16F_PGM_A
+};
+
+struct FamilyInfo
+{
+    std::string_view name;          ///< name used in devices.dat
+    DeviceFamily     family;
+    uint32_t         configSize;    ///< in words
+    uint32_t         eraseBlockSize;    ///< in words, see eraseBlockWords()
+};
+
+constexpr std::array<FamilyInfo, 13> c_families =
+{
+    {{"CF_P16F_A",      DeviceFamily::CF_P16F_A,  2, 32},
+    {"CF_P16F_B",       DeviceFamily::CF_P16F_B,  3, 32},
+    {"CF_P16F_C",       DeviceFamily::CF_P16F_C,  2, 0},
+    {"CF_P16F_D",       DeviceFamily::CF_P16F_D,  2, 0},
+    {"CF_P18F_A",       DeviceFamily::CF_P18F_A, 16, 0},
+    {"CF_P18F_B",       DeviceFamily::CF_P18F_B,  8, 0},
+    {"CF_P18F_C",       DeviceFamily::CF_P18F_C, 16 /* basically CF_P18F_A */, 0},
+    {"CF_P18F_D",       DeviceFamily::CF_P18F_D, 16, 0},
+    {"CF_P18F_E",       DeviceFamily::CF_P18F_E, 16, 0},
+    {"CF_P18F_F",       DeviceFamily::CF_P18F_F, 12, 0},
+    {"CF_P18F_G",       DeviceFamily::CF_P18F_G, 10 /* basically CF_P18F_F */, 0},
+    {"CF_P18F_Q",       DeviceFamily::CF_P18F_Q, 12, 0},
+    {"CF_P16F_PGM_A",   DeviceFamily::CF_P16F_PGM_A, 1, 0}}
+};
+
+constexpr const FamilyInfo& familyInfo(DeviceFamily family)
+{
+    return c_families[static_cast<size_t>(family)];
+}
+
+constexpr std::string_view familyName(DeviceFamily family)
+{
+    return familyInfo(family).name;
+}
+
+struct DeviceInfo
+{
+    std::string_view deviceName;
+    uint32_t    flashMemSize;   ///< in words
+    uint32_t    flashPageSize;  ///< in words
+    uint32_t    configSize;     ///< in words
+    uint32_t    deviceId;
+    uint32_t    deviceIdMask;
+    DeviceFamily deviceFamily;
+};
+
+/** words that are erased and programmed together when single rows are
+    updated, 0 if the family cannot erase rows. The erase row of a part
+    can be larger than its write page (devices.dat holds the write latch
+    size), e.g. 32 words for the 8 word pages of the 16F1826. A block is
+    the largest erase row of the family, so it holds whole rows on every
+    part, and every page of it is written again after the erase.
+*/
+constexpr size_t eraseBlockWords(const DeviceInfo &info)
+{
+    return familyInfo(info.deviceFamily).eraseBlockSize;
+}
+
+namespace DeviceDB
+{
+    /** hash functions of the perfect hash tables made by devicegen.
+        A key is looked up with seed 0 to find its bucket, then with
+        the seed stored for that bucket to find its slot.
+    */
+    constexpr uint32_t hash(std::string_view key, uint32_t seed)
+    {
+        // FNV-1a with the seed mixed into the offset basis
+        uint32_t h = 2166136261u ^ (seed * 0x9E3779B9u);
+        for(char c : key)
+        {
+            h ^= static_cast<uint8_t>(c);
+            h *= 16777619u;
+        }
+        h ^= h >> 15;
+        return h;
+    }
+
+    constexpr uint32_t hash(uint32_t key, uint32_t seed)
+    {
+        // murmur3 finaliser
+        uint32_t h = key ^ (seed * 0x9E3779B9u);
+        h ^= h >> 16;
+        h *= 0x85EBCA6Bu;
+        h ^= h >> 13;
+        h *= 0xC2B2AE35u;
+        h ^= h >> 16;
+        return h;
+    }
+
+    /** key of the ID index: the index of the mask and the masked ID */
+    constexpr uint32_t idKey(size_t maskIndex, uint32_t maskedId)
+    {
+        return (static_cast<uint32_t>(maskIndex) << 16) | (maskedId & 0xFFFF);
+    }
+
+    /** devices that share a key in the ID index */
+    struct IdGroup
+    {
+        uint32_t key;
+        uint16_t first;     ///< index into the ID device list
+        uint16_t count;
+    };
+
+    constexpr uint16_t c_noEntry = 0xFFFF;
+};
@@ -6,20 +6,19 @@
 #include <memory>
 #include <vector>
 #include <cstdint>
+#include <span>
 #include "serial.h"
+#include "deviceinfo.h"
+#include "memoryimage.h"
 
-struct DeviceInfo
+/** a flash word that does not hold the expected value */
+struct FlashMismatch
 {
-    std::string deviceName;
-    uint32_t    flashMemSize;   ///< in words
-    uint32_t    flashPageSize;  ///< in words
-    uint32_t    configSize;     ///< in words
-    uint32_t    deviceId;
-    uint32_t    deviceIdMask;
-    std::string deviceFamily;
+    size_t   address;   ///< in words
+    uint16_t wanted;
+    uint16_t got;
 };
 
-
 class IDeviceProgrammer
 {
 public:
@@ -31,20 +30,83 @@ public:
     virtual std::optional<uint16_t> readDeviceId() = 0;
 
     /** Upload to flash */
-    virtual bool uploadFlash(const DeviceInfo &info, const std::vector<uint8_t> &memory) = 0;
+    virtual bool uploadFlash(const DeviceInfo &info, const MemoryImage &memory) = 0;
+
+    /** Upload some pages of an image to flash. Blank pages are skipped. */
+    virtual bool uploadFlash(const DeviceInfo &info, const MemoryImage &memory, std::span<const size_t> pages) = 0;
+
+    /** Upload to flash from a full size flash image, words LSB first. Blank pages are skipped. */
+    virtual bool uploadFlash(const DeviceInfo &info, std::span<const uint8_t> memory) = 0;
+
+    /** Download from flash into dest, which must hold flashMemSize*2 bytes */
+    virtual bool downloadFlash(const DeviceInfo &info, std::span<uint8_t> dest) = 0;
+
+    /** Download words from flash, starting at a word address. 
+        The number of words is dest.size()/2.
+    */
+    virtual bool downloadFlash(const DeviceInfo &info, size_t address, std::span<uint8_t> dest) = 0;
 
     /** Download from flash */
-    virtual std::vector<uint8_t> downloadFlash(const DeviceInfo &info) = 0;
+    std::vector<uint8_t> downloadFlash(const DeviceInfo &info)
+    {
+        return downloadFlash(info, 0, info.flashMemSize);
+    }
+
+    /** Download words from flash, starting at a word address */
+    std::vector<uint8_t> downloadFlash(const DeviceInfo &info, size_t address, size_t words)
+    {
+        std::vector<uint8_t> contents(words*2);
+        if (!downloadFlash(info, address, contents))
+        {
+            return std::vector<uint8_t>();  // error
+        }
+        return contents;
+    }
+
+    /** CRC-32 of each flash page, computed on the programmer. 
+        Words are taken LSB first, see MemoryImage::pageCrc. Empty on error.
+    */
+    virtual std::vector<uint32_t> readPageCrcs(const DeviceInfo &info) = 0;
+
+    /** Compare words of flash against the image on the programmer. 
+        Returns every mismatch, or nullopt on error.
+    */
+    virtual std::optional<std::vector<FlashMismatch> > verifyFlash(const DeviceInfo &info, 
+        const MemoryImage &memory, size_t address, size_t words) = 0;
 
     /** Upload configuration bits */
-    virtual bool uploadConfig(const DeviceInfo &info, const std::vector<uint8_t> &config) = 0;
+    virtual bool uploadConfig(const DeviceInfo &info, std::span<const uint8_t> config) = 0;
+
+    /** Download configuration bits into dest, which must hold configSize*2 bytes */
+    virtual bool downloadConfig(const DeviceInfo &info, std::span<uint8_t> dest) = 0;
 
     /** Download configuration bits */
-    virtual std::vector<uint8_t> downloadConfig(const DeviceInfo &info) = 0;
+    std::vector<uint8_t> downloadConfig(const DeviceInfo &info)
+    {
+        std::vector<uint8_t> config(info.configSize*2);
+        if (!downloadConfig(info, config))
+        {
+            return std::vector<uint8_t>();  // error
+        }
+        return config;
+    }
+
+    /** Erase the flash rows from a word address. address must be a multiple of
+        eraseBlockWords() and words a multiple of the page size; a row erase is
+        sent for every page, so parts with rows of any size up to the block are
+        erased completely. returns false if the family cannot erase rows.
+    */
+    virtual bool eraseRows(const DeviceInfo &info, size_t address, size_t words) = 0;
 
     /** check the device is blank. returns true if device is blank */
     virtual bool isDeviceBlank(const DeviceInfo &info) = 0;
 
+    /** print a progress bar while programming */
+    void showProgress(bool show) noexcept
+    {
+        m_showProgress = show;
+    }
+
     /** Enter LV programming mode */
     virtual void enterProgMode() = 0;
 
@@ -53,5 +115,6 @@ public:
 
 protected:
     bool m_verbose = false;
+    bool m_showProgress = true;
     std::shared_ptr<Serial> m_serial;
 };
@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include <array>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "eventloop.h"
+
+EventLoop::EventLoop()
+{
+    m_epollHandle = epoll_create1(EPOLL_CLOEXEC);
+    m_wakeHandle  = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    struct epoll_event event{};
+    event.events  = EPOLLIN;
+    event.data.fd = m_wakeHandle;
+    if ((m_epollHandle < 0) || (m_wakeHandle < 0) ||
+        (epoll_ctl(m_epollHandle, EPOLL_CTL_ADD, m_wakeHandle, &event) != 0))
+    {
+        if (m_epollHandle >= 0)
+        {
+            ::close(m_epollHandle);
+        }
+        m_epollHandle = -1;
+    }
+}
+
+EventLoop::~EventLoop()
+{
+    for(auto &thread : m_threads)
+    {
+        thread.join();
+    }
+
+    if (m_epollHandle >= 0)
+    {
+        ::close(m_epollHandle);
+    }
+
+    if (m_wakeHandle >= 0)
+    {
+        ::close(m_wakeHandle);
+    }
+}
+
+bool EventLoop::watch(int fd, Callback onReadable)
+{
+    struct epoll_event event{};
+    event.events  = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(m_epollHandle, EPOLL_CTL_ADD, fd, &event) != 0)
+    {
+        return false;
+    }
+
+    m_watches[fd] = std::move(onReadable);
+    return true;
+}
+
+void EventLoop::unwatch(int fd)
+{
+    if (m_watches.erase(fd) > 0)
+    {
+        epoll_ctl(m_epollHandle, EPOLL_CTL_DEL, fd, nullptr);
+    }
+}
+
+EventLoop::TimerId EventLoop::addTimer(int milliSeconds, Callback callback)
+{
+    const TimerId id = m_nextTimerId++;
+    const auto deadline = Clock::now() + std::chrono::milliseconds(milliSeconds);
+    m_timers.emplace(std::make_pair(deadline, id), std::move(callback));
+    m_timerDeadlines.emplace(id, deadline);
+    return id;
+}
+
+void EventLoop::cancelTimer(TimerId id)
+{
+    auto iter = m_timerDeadlines.find(id);
+    if (iter != m_timerDeadlines.end())
+    {
+        m_timers.erase(std::make_pair(iter->second, id));
+        m_timerDeadlines.erase(iter);
+    }
+}
+
+void EventLoop::runInBackground(std::function<void()> work, Callback done)
+{
+    m_background++;
+    m_threads.emplace_back([this, work = std::move(work), done = std::move(done)]()
+        {
+            work();
+            post([this, done]()
+                {
+                    m_background--;
+                    done();
+                }
+            );
+        }
+    );
+}
+
+void EventLoop::post(Callback callback)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_postMutex);
+        m_posted.push_back(std::move(callback));
+    }
+
+    const uint64_t one = 1;
+    [[maybe_unused]] auto bytes = ::write(m_wakeHandle, &one, sizeof(one));
+}
+
+void EventLoop::runPosted()
+{
+    uint64_t count;
+    [[maybe_unused]] auto bytes = ::read(m_wakeHandle, &count, sizeof(count));
+
+    std::vector<Callback> posted;
+    {
+        std::lock_guard<std::mutex> lock(m_postMutex);
+        posted.swap(m_posted);
+    }
+
+    for(auto &callback : posted)
+    {
+        callback();
+    }
+}
+
+int EventLoop::runTimers()
+{
+    while(!m_timers.empty() && !m_stopped)
+    {
+        auto first = m_timers.begin();
+        const auto now = Clock::now();
+        if (first->first.first > now)
+        {
+            // round up, so the timer is due when epoll_wait returns
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(first->first.first - now);
+            return static_cast<int>(wait.count()) + 1;
+        }
+
+        // the callback may add or cancel timers, so take it out first
+        auto callback = std::move(first->second);
+        m_timerDeadlines.erase(first->first.second);
+        m_timers.erase(first);
+        m_stats.timers++;
+        callback();
+    }
+    return m_timers.empty() ? -1 : 0;
+}
+
+void EventLoop::run()
+{
+    std::array<struct epoll_event, 64> events;
+
+    m_stopped = false;
+    while(!m_stopped)
+    {
+        const int timeout = runTimers();
+        if (m_stopped || ((timeout < 0) && m_watches.empty() && (m_background == 0)))
+        {
+            return;
+        }
+
+        const int count = epoll_wait(m_epollHandle, events.data(), events.size(), timeout);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+
+        m_stats.wakeups++;
+        for(int i=0; (i < count) && !m_stopped; i++)
+        {
+            if (events[i].data.fd == m_wakeHandle)
+            {
+                runPosted();
+                continue;
+            }
+
+            // an earlier callback may have removed this descriptor
+            auto iter = m_watches.find(events[i].data.fd);
+            if (iter == m_watches.end())
+            {
+                continue;
+            }
+
+            m_stats.events++;
+            auto callback = iter->second;
+            callback();
+        }
+    }
+}
@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <thread>
+#include <mutex>
+
+/** single threaded event loop: file descriptors that become readable
+    and timers, multiplexed with epoll. Callbacks run on the thread
+    that calls run() and may add or remove descriptors and timers.
+    Work that would block the loop can be run on a thread of its own
+    with runInBackground().
+*/
+class EventLoop
+{
+public:
+    using Clock    = std::chrono::steady_clock;
+    using Callback = std::function<void()>;
+    using TimerId  = uint64_t;
+
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool isOpen() const noexcept
+    {
+        return m_epollHandle >= 0;
+    }
+
+    /** call onReadable whenever fd has data, until unwatch(fd) */
+    bool watch(int fd, Callback onReadable);
+    void unwatch(int fd);
+
+    /** call a function once, after a delay. returns an id for cancelTimer */
+    TimerId addTimer(int milliSeconds, Callback callback);
+
+    /** cancel a timer that has not fired yet, unknown ids are ignored */
+    void cancelTimer(TimerId id);
+
+    /** run work on a new thread, then call done on the loop thread.
+        run() does not return while background work is pending.
+    */
+    void runInBackground(std::function<void()> work, Callback done);
+
+    /** handle events until there is nothing left to wait for or stop() is called */
+    void run();
+
+    /** make run() return after the current callback */
+    void stop() noexcept
+    {
+        m_stopped = true;
+    }
+
+    /** counters to check the cost of the loop */
+    struct Stats
+    {
+        size_t wakeups = 0;     ///< number of epoll_wait calls that returned
+        size_t events  = 0;     ///< number of readable descriptors handled
+        size_t timers  = 0;     ///< number of timers fired
+    };
+
+    const Stats& stats() const noexcept
+    {
+        return m_stats;
+    }
+
+protected:
+    /** queue a callback for the loop thread, safe to call from any thread */
+    void post(Callback callback);
+
+    /** run the callbacks queued by post() */
+    void runPosted();
+
+    /** fire the timers that are due. returns the milliseconds until the next one, or -1 */
+    int runTimers();
+
+    int     m_epollHandle = -1;
+    int     m_wakeHandle  = -1;     ///< eventfd, signalled by post()
+    bool    m_stopped = false;
+    TimerId m_nextTimerId = 1;
+
+    std::unordered_map<int, Callback> m_watches;
+
+    /** pending timers, ordered by deadline and then by id */
+    std::map<std::pair<Clock::time_point, TimerId>, Callback> m_timers;
+    std::unordered_map<TimerId, Clock::time_point> m_timerDeadlines;
+
+    size_t                      m_background = 0;   ///< background work not finished yet
+    std::vector<std::thread>    m_threads;
+    std::mutex                  m_postMutex;
+    std::vector<Callback>       m_posted;
+
+    Stats m_stats;
+};
@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#pragma once
+
+// Note: this file is shared with the Arduino firmware
+//       so it cannot use the standard library.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __AVR__
+#include <util/crc16.h>
+#endif
+
+/** Framing of the messages between the host and the programmer.
+
+    A request is  [opcode, payload length, payload..., seq, crc LSB, crc MSB]
+    A reply is    [status, data..., seq, crc LSB, crc MSB]
+
+    The CRC is CRC-16/CCITT-FALSE over everything before it.
+    The frame is COBS encoded and terminated by a single 0x00, so the
+    receiver can always resynchronise at the next delimiter.
+*/
+namespace Framing
+{
+    constexpr uint8_t c_delimiter   = 0x00;
+    constexpr uint16_t c_crcInit    = 0xFFFF;
+
+    /** bytes added to the body: sequence number and CRC */
+    constexpr size_t c_trailerSize  = 3;
+
+    /** largest body: opcode, length and a 255 byte payload */
+    constexpr size_t c_maxBodySize  = 2 + 255;
+    constexpr size_t c_maxRawSize   = c_maxBodySize + c_trailerSize;
+
+    /** worst case size of a COBS encoded block, without delimiter */
+    constexpr size_t maxEncodedSize(size_t rawSize)
+    {
+        return rawSize + (rawSize / 254) + 1;
+    }
+
+    inline uint16_t crc16Update(uint16_t crc, uint8_t data)
+    {
+#ifdef __AVR__
+        return _crc_xmodem_update(crc, data);
+#else
+        crc ^= static_cast<uint16_t>(data) << 8;
+        for(uint8_t i=0; i<8; i++)
+        {
+            if (crc & 0x8000)
+            {
+                crc = (crc << 1) ^ 0x1021;
+            }
+            else
+            {
+                crc <<= 1;
+            }
+        }
+        return crc;
+#endif
+    }
+
+    inline uint16_t crc16(const uint8_t *data, size_t len, uint16_t crc = c_crcInit)
+    {
+        for(size_t i=0; i<len; i++)
+        {
+            crc = crc16Update(crc, data[i]);
+        }
+        return crc;
+    }
+
+    constexpr uint32_t c_crc32Init = 0xFFFFFFFF;
+
+    /** CRC-32 (IEEE 802.3, reflected) update, without the final inversion. 
+        Used for the CrcRange command, where flash words are processed 
+        LSB first.
+    */
+    inline uint32_t crc32Update(uint32_t crc, uint8_t data)
+    {
+        crc ^= data;
+        for(uint8_t i=0; i<8; i++)
+        {
+            if (crc & 1)
+            {
+                crc = (crc >> 1) ^ 0xEDB88320UL;
+            }
+            else
+            {
+                crc >>= 1;
+            }
+        }
+        return crc;
+    }
+
+    inline uint32_t crc32(const uint8_t *data, size_t len)
+    {
+        uint32_t crc = c_crc32Init;
+        for(size_t i=0; i<len; i++)
+        {
+            crc = crc32Update(crc, data[i]);
+        }
+        return ~crc;
+    }
+
+    /** COBS encode len bytes, passing every output byte to out(uint8_t).
+        The delimiter is not written.
+    */
+    template<typename Output>
+    void cobsEncode(const uint8_t *src, size_t len, Output &&out)
+    {
+        size_t idx = 0;
+        while(true)
+        {
+            // find the run of non-zero bytes, at most 254 long
+            size_t run = 0;
+            while(((idx + run) < len) && (src[idx + run] != 0) && (run < 254))
+            {
+                run++;
+            }
+
+            out(static_cast<uint8_t>(run + 1));
+            for(size_t i=0; i<run; i++)
+            {
+                out(src[idx + i]);
+            }
+
+            idx += run;
+            if (idx >= len)
+            {
+                break;
+            }
+
+            if (run < 254)
+            {
+                idx++;  // skip the zero that ended the run
+                if (idx == len)
+                {
+                    out(1); // the data ended with a zero
+                    break;
+                }
+            }
+        }
+    }
+
+    /** decode a COBS block without delimiter. dst may be equal to src.
+        returns the number of decoded bytes or 0 on malformed input.
+    */
+    inline size_t cobsDecode(const uint8_t *src, size_t len, uint8_t *dst)
+    {
+        size_t in  = 0;
+        size_t out = 0;
+        while(in < len)
+        {
+            const uint8_t code = src[in++];
+            if (code == 0)
+            {
+                return 0;
+            }
+
+            for(uint8_t i=1; i<code; i++)
+            {
+                if ((in >= len) || (src[in] == 0))
+                {
+                    return 0;
+                }
+                dst[out++] = src[in++];
+            }
+
+            if ((code < 0xFF) && (in < len))
+            {
+                dst[out++] = 0;
+            }
+        }
+        return out;
+    }
+};
@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include <sstream>
+#include <thread>
+#include <iomanip>
+#include "gang.h"
+#include "pgmfactory.h"
+#include "eventloop.h"
+#include "asyncsession.h"
+
+static Gang::PortResult programPort(const std::string &port, uint32_t baudrate,
+    const DeviceInfo *target, const std::string &hexFilename, ImageStore &images,
+    const JobOptions &options, bool verbose)
+{
+    Gang::PortResult result;
+    result.port = port;
+
+    std::ostringstream messages;
+    SessionLog log{messages, messages, verbose};
+    const auto start = Serial::Clock::now();
+
+    auto serial = Session::openProgrammer(port, baudrate, log);
+    if (serial && (target == nullptr))
+    {
+        target = Session::detectDevice(serial, log);
+        if (target == nullptr)
+        {
+            log.err << "Could not detect the target device\n";
+        }
+    }
+
+    if (serial && (target != nullptr))
+    {
+        result.device = target->deviceName;
+        auto image = hexFilename.empty() ? std::make_shared<const ProgramImage>(*target)
+            : images.get(hexFilename, *target, log);
+        auto pgm = ProgrammerFactory::create(target->deviceFamily, serial);
+        if (!pgm)
+        {
+            log.err << "Device family " << familyName(target->deviceFamily) << " is not supported\n";
+        }
+        else if (image)
+        {
+            pgm->showProgress(false);
+            pgm->enterProgMode();
+            result.ok = Session::checkDevice(*pgm, *target, log) &&
+                Session::runJob(*pgm, *target, *image, options, log);
+            pgm->exitProgMode();
+
+            if (result.ok && options.upload)
+            {
+                result.words = image->flash.usedPages().size() * image->flash.pageWords();
+            }
+        }
+    }
+
+    result.seconds = std::chrono::duration<double>(Serial::Clock::now() - start).count();
+    result.log = messages.str();
+    return result;
+}
+
+std::vector<Gang::PortResult> Gang::run(const std::vector<std::string> &ports, uint32_t baudrate,
+    const DeviceInfo *target, const std::string &hexFilename, ImageStore &images,
+    const JobOptions &options, bool verbose)
+{
+    std::vector<PortResult> results(ports.size());
+    std::vector<std::thread> threads;
+    threads.reserve(ports.size());
+    for(size_t i=0; i<ports.size(); i++)
+    {
+        threads.emplace_back([&, i]()
+            {
+                results.at(i) = programPort(ports.at(i), baudrate, target, hexFilename, 
+                    images, options, verbose);
+            }
+        );
+    }
+
+    for(auto &thread : threads)
+    {
+        thread.join();
+    }
+    return results;
+}
+
+std::vector<Gang::PortResult> Gang::runEventLoop(const std::vector<std::string> &ports, uint32_t baudrate,
+    const DeviceInfo *target, const std::string &hexFilename, ImageStore &images,
+    const JobOptions &options, bool verbose)
+{
+    std::vector<PortResult> results(ports.size());
+
+    EventLoop loop;
+    std::vector<std::unique_ptr<AsyncSession> > sessions;
+    sessions.reserve(ports.size());
+    for(size_t i=0; i<ports.size(); i++)
+    {
+        sessions.push_back(std::make_unique<AsyncSession>(loop, ports.at(i), baudrate, target, 
+            hexFilename, images, options, verbose, results.at(i)));
+        sessions.back()->start();
+    }
+
+    loop.run();
+    return results;
+}
+
+void Gang::report(const std::vector<PortResult> &results, double seconds, std::ostream &os)
+{
+    size_t passed = 0;
+    size_t words  = 0;
+    for(auto const &result : results)
+    {
+        os << std::left << std::setw(20) << result.port << " ";
+        os << std::setw(12) << (result.device.empty() ? "-" : result.device) << " ";
+        os << (result.ok ? "PASS" : "FAIL") << "  ";
+        os << std::fixed << std::setprecision(1) << result.seconds << " s\n";
+
+        if (result.ok)
+        {
+            passed++;
+            words += result.words;
+        }
+    }
+
+    os << passed << " of " << results.size() << " targets passed in ";
+    os << std::fixed << std::setprecision(1) << seconds << " s";
+    if (seconds > 0)
+    {
+        os << ", " << std::setprecision(0) << (passed * 3600.0 / seconds) << " boards/hour";
+        os << ", " << (words / seconds) << " words/s";
+    }
+    os << "\n";
+    os.unsetf(std::ios::floatfield | std::ios::adjustfield);
+}
@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#pragma once
+#include <string>
+#include <vector>
+#include "session.h"
+#include "imagestore.h"
+
+/** Gang programming: the same image on the targets of several
+    programmers at once, with a thread per serial port or with
+    all ports on a single event loop.
+*/
+namespace Gang
+{
+    struct PortResult
+    {
+        std::string port;
+        bool        ok      = false;
+        std::string device;         ///< name of the target, empty if it was not found
+        size_t      words   = 0;    ///< flash words programmed
+        double      seconds = 0;
+        std::string log;            ///< messages of the session on this port
+    };
+
+    /** run the job on every port. target is nullptr to detect the target on each port.
+        returns the results in the order of the ports.
+    */
+    std::vector<PortResult> run(const std::vector<std::string> &ports, uint32_t baudrate,
+        const DeviceInfo *target, const std::string &hexFilename, ImageStore &images,
+        const JobOptions &options, bool verbose);
+
+    /** run the job on every port from a single thread, see AsyncSession. target is
+        nullptr to detect the target on each port. returns the results in the order of the ports.
+    */
+    std::vector<PortResult> runEventLoop(const std::vector<std::string> &ports, uint32_t baudrate,
+        const DeviceInfo *target, const std::string &hexFilename, ImageStore &images,
+        const JobOptions &options, bool verbose);
+
+    /** print a line per port and the totals */
+    void report(const std::vector<PortResult> &results, double seconds, std::ostream &os);
+};
@@ -2,8 +2,9 @@
 // Copyright N.A. Moseley 2022
 
 #include <iostream>
-#include <fstream>
+#include <array>
 #include "hexreader.h"
+#include "mappedfile.h"
 
 #define IHEX_DATA   0
 #define IHEX_EOL    1
@@ -12,114 +13,153 @@
 #define IHEX_EXTLIN 4
 #define IHEX_STARTLINADD 5
 
-bool HexReader::read(const std::string &filename, 
-    std::vector<uint8_t> &flash,
+/** value of a hex digit, or 0xFF for any other character */
+static constexpr std::array<uint8_t, 256> c_nibbleLUT = []()
+{
+    std::array<uint8_t, 256> lut{};
+    for(size_t i=0; i<lut.size(); i++)
+    {
+        lut[i] = 0xFF;
+    }
+    for(uint8_t i=0; i<10; i++)
+    {
+        lut['0'+i] = i;
+    }
+    for(uint8_t i=0; i<6; i++)
+    {
+        lut['A'+i] = 10+i;
+        lut['a'+i] = 10+i;
+    }
+    return lut;
+}();
+
+/** decode n hex pairs into dst. returns false on a non-hex character */
+static bool decodeHex(const char *src, size_t n, uint8_t *dst)
+{
+    uint8_t invalid = 0;
+    for(size_t i=0; i<n; i++)
+    {
+        const uint8_t hi = c_nibbleLUT[static_cast<uint8_t>(src[2*i])];
+        const uint8_t lo = c_nibbleLUT[static_cast<uint8_t>(src[2*i+1])];
+        invalid |= hi | lo;
+        dst[i] = (hi << 4) | (lo & 0x0F);
+    }
+    return (invalid & 0xF0) == 0;
+}
+
+bool HexReader::read(const std::string &filename,
+    MemoryImage &flash,
     std::vector<uint8_t> &config)
 {
-    const bool dump = true;
-    std::ifstream hexfile(filename);
-    if (!hexfile.is_open())
+    MappedFile hexfile(filename);
+    if (!hexfile.isOpen())
     {
         std::cerr << "Cannot open HEX file\n";
         return false;
     }
 
-    uint32_t addressOffset = 0;
-    while(!hexfile.eof())
+    return parse(hexfile.text(), flash, config);
+}
+
+bool HexReader::parse(std::string_view text,
+    MemoryImage &flash,
+    std::vector<uint8_t> &config)
+{
+    // length, address, type, up to 255 data bytes and the checksum
+    std::array<uint8_t, 5 + 255> record;
+
+    uint32_t baseAddress = 0;
+    size_t lineNum = 1;
+    size_t idx = 0;
+    while(idx < text.size())
     {
-        std::string line;
-        std::getline(hexfile, line);
-        
-        if (line.empty() || line.at(0) != ':')
+        // anything that is not a record is skipped, like the old line based reader did
+        const char c = text[idx++];
+        if (c == '\n')
+        {
+            lineNum++;
+        }
+
+        if (c != ':')
         {
             continue;
         }
 
-        auto lineLengthOpt  = Utils::hexStrToUint32(line.substr(1, 2));
-        auto lineAddressOpt = Utils::hexStrToUint32(line.substr(3, 4));
-        auto lineTypeOpt    = Utils::hexStrToUint32(line.substr(7, 2));
+        if (((text.size() - idx) < 10) || !decodeHex(&text[idx], 4, &record[0]))
+        {
+            std::cerr << "Error reading HEX file at line " << lineNum << "\n";
+            return false;
+        }
 
-        if ((!lineLengthOpt) || (!lineAddressOpt) || (!lineTypeOpt))
+        const size_t dataLength = record[0];
+        const size_t recordLength = 5 + dataLength;
+        if (((text.size() - idx) < (recordLength*2)) ||
+            !decodeHex(&text[idx + 8], dataLength + 1, &record[4]))
         {
-            std::cerr << "Error reading HEX file\n";
+            std::cerr << "Error reading HEX file at line " << lineNum << "\n";
             return false;
         }
+        idx += recordLength*2;
 
-        auto lineLength     = lineLengthOpt.value();
-        auto lineAddress    = lineAddressOpt.value();
-        auto lineType       = lineTypeOpt.value();
+        uint8_t checksum = 0;
+        for(size_t i=0; i<recordLength; i++)
+        {
+            checksum += record[i];
+        }
+
+        if (checksum != 0)
+        {
+            std::cerr << "HEX record checksum error at line " << lineNum << "\n";
+            return false;
+        }
 
-        uint32_t effectiveAddress = lineAddress + (addressOffset << 16);
+        const uint32_t lineAddress = (static_cast<uint32_t>(record[1]) << 8) | record[2];
+        const std::span<const uint8_t> data(&record[4], dataLength);
 
-        switch(lineType)
+        switch(record[3])
         {
         case IHEX_DATA:
-            if constexpr (dump)
             {
-                printf("\n%06X: ", effectiveAddress);
-            }
-
-            for(size_t i=0; i<lineLength; i++)
-            {
-                auto byteHexStr = line.substr(9 + i*2, 2);
-                auto byteOpt = Utils::hexStrToUint32(byteHexStr);
-                if (!byteOpt)
+                const uint32_t effectiveAddress = baseAddress + lineAddress;
+                const size_t stored = flash.setBytes(effectiveAddress, data);
+                if ((stored == dataLength) || (baseAddress != 0x10000))
                 {
-                    std::cerr << "Error reading IHEX data record\n";
-                    return false;
+                    break;
                 }
-                
-                uint32_t byte = byteOpt.value();
 
-                if (effectiveAddress < flash.size())
+                // Special code to get the configuration bits for PIC16:
+                for(size_t i=stored; i<dataLength; i++)
                 {
-                    flash.at(effectiveAddress+i) = byte;
-                }
-                else if (addressOffset == 0x01)
-                {
-                    // Special code to get the configuration bits for PIC16:
-                    auto offset = lineAddress + i - 0xE;
-                    if (offset < config.size())
-                    {
-                        config.at(offset) = byte;
-                    }
-                    else
+                    const size_t offset = lineAddress + i - 0xE;
+                    if (offset >= config.size())
                     {
                         std::cerr << "This HEX file contains more configuration bits than the target accepts!";
                         return false;
                     }
-                }
-
-                if constexpr (dump)
-                {
-                    printf("%02X", byte);
-                    fflush(stdout);
+                    config[offset] = data[i];
                 }
             }
             break;
+        case IHEX_EOL:
+            return true;
+        case IHEX_EXTSEG:
         case IHEX_EXTLIN:
-            auto addrHexStr = line.substr(9, 4);
-            auto addrOpt = Utils::hexStrToUint32(addrHexStr);
-            if (!addrOpt)
+            if (dataLength != 2)
             {
-                std::cerr << "Error reading IHEX extended linear record\n";
+                std::cerr << "Error reading IHEX extended address record at line " << lineNum << "\n";
                 return false;
-            }   
-
-            addressOffset = addrOpt.value();
-            if constexpr (dump)
-            {
-                //printf("\noffset: %04X\n", addressOffset);
-            }             
+            }
+            baseAddress = (static_cast<uint32_t>(data[0]) << 8) | data[1];
+            baseAddress <<= (record[3] == IHEX_EXTLIN) ? 16 : 4;
+            break;
+        case IHEX_STARTSEGADDR:
+        case IHEX_STARTLINADD:
             break;
+        default:
+            std::cerr << "Unknown HEX record type at line " << lineNum << "\n";
+            return false;
         }
-
-        //std::cout << lineLength << " " << lineAddress << " " << lineType << "\n";
     }
 
-    if constexpr (dump)
-    {
-        printf("\nok\n");
-    }    
     return true;
 }
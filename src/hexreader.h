@@ -1,17 +1,26 @@
 // SPDX-License-Identifier: GPL-3.0-only
 // Copyright N.A. Moseley 2022
 
-#pragma
+#pragma once
 #include <cstdint>
 #include <vector>
+#include <string>
+#include <string_view>
 #include "utils.h"
+#include "memoryimage.h"
 
 namespace HexReader
 {
-
+    /** read an Intel HEX file. The file is memory mapped and parsed in place. */
     bool read(const std::string &filename,
-            std::vector<uint8_t> &flash,
+            MemoryImage &flash,
             std::vector<uint8_t> &config);
-    
-};
 
+    /** parse Intel HEX text. Every record must have a valid checksum.
+        Data below the end of flash goes into the image, data at byte
+        address 0x1000E and up goes into the configuration words.
+    */
+    bool parse(std::string_view text,
+            MemoryImage &flash,
+            std::vector<uint8_t> &config);
+};
@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include "hexwriter.h"
+
+#define IHEX_DATA   0
+#define IHEX_EOL    1
+#define IHEX_EXTLIN 4
+
+/** two upper case hex digits for every byte value */
+static constexpr std::array<char, 512> c_hexPairs = []()
+{
+    constexpr char digits[] = "0123456789ABCDEF";
+    std::array<char, 512> pairs{};
+    for(size_t i=0; i<256; i++)
+    {
+        pairs[2*i]   = digits[i >> 4];
+        pairs[2*i+1] = digits[i & 0x0F];
+    }
+    return pairs;
+}();
+
+HexWriter::HexWriter(uint16_t blankWord)
+{
+    for(size_t i=0; i<m_blank.size(); i++)
+    {
+        m_blank[i] = ((i & 1) == 0) ? (blankWord & 0xFF) : (blankWord >> 8);
+    }
+}
+
+HexWriter::~HexWriter()
+{
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+    }
+}
+
+bool HexWriter::open(const std::string &filename)
+{
+    m_fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    m_error = (m_fd < 0);
+    m_upperAddress = 0;
+    m_used = 0;
+    return !m_error;
+}
+
+bool HexWriter::write(uint32_t byteAddress, std::span<const uint8_t> data, bool skipBlank)
+{
+    size_t idx = 0;
+    while(idx < data.size())
+    {
+        const uint32_t address = byteAddress + idx;
+        const size_t len = std::min(c_recordBytes - (address % c_recordBytes), data.size() - idx);
+        const uint8_t *bytes = &data[idx];
+        idx += len;
+
+        if (skipBlank && (memcmp(bytes, &m_blank[address & 1], len) == 0))
+        {
+            continue;
+        }
+
+        if ((address >> 16) != m_upperAddress)
+        {
+            m_upperAddress = address >> 16;
+            const uint8_t upper[2] = {static_cast<uint8_t>(m_upperAddress >> 8),
+                static_cast<uint8_t>(m_upperAddress)};
+            record(IHEX_EXTLIN, 0, upper, 2);
+        }
+
+        record(IHEX_DATA, address & 0xFFFF, bytes, len);
+    }
+    return !m_error;
+}
+
+bool HexWriter::close()
+{
+    if (m_fd < 0)
+    {
+        return false;
+    }
+
+    record(IHEX_EOL, 0, nullptr, 0);
+    flushBuffer();
+
+    if (::close(m_fd) != 0)
+    {
+        m_error = true;
+    }
+    m_fd = -1;
+    return !m_error;
+}
+
+void HexWriter::record(uint8_t type, uint16_t address, const uint8_t *data, size_t len)
+{
+    if ((m_buffer.size() - m_used) < c_maxRecordChars)
+    {
+        flushBuffer();
+    }
+
+    char *out = &m_buffer[m_used];
+    auto putByte = [&out](uint8_t b)
+    {
+        *out++ = c_hexPairs[2*b];
+        *out++ = c_hexPairs[2*b+1];
+    };
+
+    const uint8_t header[4] = {static_cast<uint8_t>(len),
+        static_cast<uint8_t>(address >> 8), static_cast<uint8_t>(address), type};
+
+    uint8_t checksum = 0;
+    *out++ = ':';
+    for(auto b : header)
+    {
+        putByte(b);
+        checksum += b;
+    }
+
+    for(size_t i=0; i<len; i++)
+    {
+        putByte(data[i]);
+        checksum += data[i];
+    }
+
+    putByte(static_cast<uint8_t>(-checksum));
+    *out++ = '\n';
+    m_used = out - m_buffer.data();
+}
+
+bool HexWriter::flushBuffer()
+{
+    size_t idx = 0;
+    while((idx < m_used) && !m_error)
+    {
+        const ssize_t written = ::write(m_fd, &m_buffer[idx], m_used - idx);
+        if (written < 0)
+        {
+            if (errno != EINTR)
+            {
+                m_error = true;
+            }
+            continue;
+        }
+        idx += written;
+    }
+
+    m_used = 0;
+    return !m_error;
+}
@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#pragma once
+#include <cstdint>
+#include <array>
+#include <string>
+#include <span>
+
+/** Writes an Intel HEX file while the data arrives.
+
+    Records are formatted into a fixed buffer, which is written to
+    the file when it fills up. Data records hold up to 16 bytes and
+    never cross a 16 byte boundary, so records in which every word
+    is blank can be left out.
+*/
+class HexWriter
+{
+public:
+    /** blankWord is the value of an erased word, LSB first in the file */
+    explicit HexWriter(uint16_t blankWord = 0x3FFF);
+    ~HexWriter();
+
+    HexWriter(const HexWriter&) = delete;
+    HexWriter& operator=(const HexWriter&) = delete;
+
+    /** create or truncate the output file */
+    bool open(const std::string &filename);
+
+    /** write data at a byte address. Extended linear address records
+        are added when needed. If skipBlank is set, records that only
+        hold blank words are not written.
+    */
+    bool write(uint32_t byteAddress, std::span<const uint8_t> data, bool skipBlank = true);
+
+    /** write the end of file record and close the file.
+        returns false if any write failed.
+    */
+    bool close();
+
+protected:
+    void record(uint8_t type, uint16_t address, const uint8_t *data, size_t len);
+    bool flushBuffer();
+
+    constexpr static size_t c_recordBytes = 16;
+
+    /** longest record: colon, 5+16 bytes as hex pairs and a newline */
+    constexpr static size_t c_maxRecordChars = 1 + 2*(5 + c_recordBytes) + 1;
+
+    int  m_fd = -1;
+    bool m_error = false;
+    uint32_t m_upperAddress = 0;    ///< address bits 16..31 of the last extended linear record
+
+    /** blank bytes for an even address, one extra for an odd start */
+    std::array<uint8_t, c_recordBytes + 1> m_blank;
+
+    std::array<char, 16384> m_buffer;
+    size_t m_used = 0;
+};
@@ -0,0 +1,260 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+#include <cstdlib>
+#include <bit>
+#include <algorithm>
+#include <unistd.h>
+#include "imagecache.h"
+#include "hexreader.h"
+#include "mappedfile.h"
+#include "utils.h"
+
+// the .pimg fields are stored in host order
+static_assert(std::endian::native == std::endian::little);
+
+/** offsets of the sections of a .pimg file */
+struct PimgLayout
+{
+    size_t bitmap;
+    size_t crcs;
+    size_t pageMap;
+    size_t config;
+    size_t pages;
+    size_t total;
+};
+
+static constexpr size_t align8(size_t bytes)
+{
+    return (bytes + 7) & ~static_cast<size_t>(7);
+}
+
+static PimgLayout layout(const ImageCache::PimgHeader &header)
+{
+    PimgLayout l;
+    l.bitmap  = sizeof(ImageCache::PimgHeader);
+    l.crcs    = l.bitmap  + ((header.pageCount + 63) / 64)*8;
+    l.pageMap = l.crcs    + align8(header.pageCount*4);
+    l.config  = l.pageMap + align8(header.storedPages*4);
+    l.pages   = l.config  + align8(header.configBytes);
+    l.total   = l.pages   + static_cast<size_t>(header.storedPages)*header.pageWords*2;
+    return l;
+}
+
+std::string ImageCache::cacheDirectory()
+{
+    if (auto dir = getenv("PICMEUP_CACHE"); (dir != nullptr) && (dir[0] != 0))
+    {
+        return dir;
+    }
+
+    if (auto dir = getenv("XDG_CACHE_HOME"); (dir != nullptr) && (dir[0] != 0))
+    {
+        return std::string(dir) + "/picmeup";
+    }
+
+    if (auto dir = getenv("HOME"); (dir != nullptr) && (dir[0] != 0))
+    {
+        return std::string(dir) + "/.cache/picmeup";
+    }
+
+    return std::string();
+}
+
+uint64_t ImageCache::contentHash(std::span<const uint8_t> data)
+{
+    constexpr uint64_t P1 = 0x9E3779B185EBCA87ULL;
+    constexpr uint64_t P2 = 0xC2B2AE3D27D4EB4FULL;
+
+    auto round = [](uint64_t h, uint64_t word)
+    {
+        h ^= word * P2;
+        return ((h << 31) | (h >> 33)) * P1;
+    };
+
+    // 8 bytes per step, the tail is zero padded
+    uint64_t h = P1 ^ data.size();
+    size_t idx = 0;
+    for(; (idx + 8) <= data.size(); idx += 8)
+    {
+        uint64_t word;
+        memcpy(&word, &data[idx], 8);
+        h = round(h, word);
+    }
+
+    if (idx < data.size())
+    {
+        uint64_t word = 0;
+        memcpy(&word, &data[idx], data.size() - idx);
+        h = round(h, word);
+    }
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P1;
+    h ^= h >> 32;
+    return h;
+}
+
+bool ImageCache::store(const std::string &filename, uint64_t hash, uint64_t hexSize,
+    const MemoryImage &flash, const std::vector<uint8_t> &config)
+{
+    const auto usedPages = flash.usedPages();
+
+    PimgHeader header{};
+    memcpy(header.magic, "PIMG", 4);
+    header.version     = c_version;
+    header.blankWord   = flash.blankWord();
+    header.flashWords  = flash.sizeWords();
+    header.pageWords   = flash.pageWords();
+    header.pageCount   = flash.pageCount();
+    header.storedPages = usedPages.size();
+    header.configBytes = config.size();
+    header.contentHash = hash;
+    header.hexSize     = hexSize;
+
+    const auto l = layout(header);
+    std::vector<uint8_t> contents(l.total, 0);
+    memcpy(&contents[0], &header, sizeof(header));
+
+    for(size_t page = 0; page < flash.pageCount(); page++)
+    {
+        const uint32_t crc = flash.pageCrc(page);
+        memcpy(&contents[l.crcs + page*4], &crc, 4);
+    }
+
+    for(size_t i = 0; i < usedPages.size(); i++)
+    {
+        const uint32_t page = usedPages.at(i);
+        contents.at(l.bitmap + page/8) |= 1 << (page % 8);
+        memcpy(&contents[l.pageMap + i*4], &page, 4);
+
+        auto data = flash.page(page);
+        std::copy(data.begin(), data.end(), contents.begin() + l.pages + i*flash.pageBytes());
+    }
+
+    std::copy(config.begin(), config.end(), contents.begin() + l.config);
+
+    // write under a temporary name, so other instances never see a partial file
+    const std::string tmpName = filename + ".tmp" + std::to_string(getpid());
+    std::ofstream out(tmpName, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(contents.data()), contents.size());
+    out.close();
+
+    std::error_code ec;
+    if (!out.good())
+    {
+        std::filesystem::remove(tmpName, ec);
+        return false;
+    }
+
+    std::filesystem::rename(tmpName, filename, ec);
+    if (ec)
+    {
+        std::filesystem::remove(tmpName, ec);
+        return false;
+    }
+    return true;
+}
+
+bool ImageCache::restore(const std::string &filename, uint64_t hash, uint64_t hexSize,
+    MemoryImage &flash, std::vector<uint8_t> &config)
+{
+    MappedFile file(filename);
+    auto contents = file.data();
+    if (contents.size() < sizeof(PimgHeader))
+    {
+        return false;
+    }
+
+    PimgHeader header;
+    memcpy(&header, contents.data(), sizeof(header));
+    if ((memcmp(header.magic, "PIMG", 4) != 0) ||
+        (header.version     != c_version) ||
+        (header.contentHash != hash) ||
+        (header.hexSize     != hexSize) ||
+        (header.blankWord   != flash.blankWord()) ||
+        (header.flashWords  != flash.sizeWords()) ||
+        (header.pageWords   != flash.pageWords()) ||
+        (header.pageCount   != flash.pageCount()) ||
+        (header.storedPages >  header.pageCount) ||
+        (header.configBytes != config.size()))
+    {
+        return false;
+    }
+
+    const auto l = layout(header);
+    if (contents.size() != l.total)
+    {
+        return false;
+    }
+
+    // check the page map before anything is copied into the image
+    std::vector<uint32_t> pageMap(header.storedPages);
+    memcpy(pageMap.data(), &contents[l.pageMap], pageMap.size()*4);
+    for(auto page : pageMap)
+    {
+        if ((page >= header.pageCount) || ((contents[l.bitmap + page/8] & (1 << (page % 8))) == 0))
+        {
+            return false;
+        }
+    }
+
+    const size_t pageBytes = flash.pageBytes();
+    for(size_t i = 0; i < pageMap.size(); i++)
+    {
+        uint32_t crc;
+        memcpy(&crc, &contents[l.crcs + pageMap.at(i)*4], 4);
+        flash.setPage(pageMap.at(i), contents.subspan(l.pages + i*pageBytes, pageBytes), crc);
+    }
+
+    std::copy_n(contents.begin() + l.config, config.size(), config.begin());
+    return true;
+}
+
+ImageCache::LoadResult ImageCache::load(const std::string &hexFilename, const DeviceInfo &info,
+    MemoryImage &flash, std::vector<uint8_t> &config, bool useCache)
+{
+    MappedFile hexfile(hexFilename);
+    if (!hexfile.isOpen())
+    {
+        std::cerr << "Cannot open HEX file\n";
+        return LoadResult::Error;
+    }
+
+    const auto hexSize = hexfile.data().size();
+    const auto hash = contentHash(hexfile.data());
+
+    std::string dir = useCache ? cacheDirectory() : std::string();
+    std::string cacheName;
+    if (!dir.empty())
+    {
+        cacheName = dir + "/" + Utils::toHex(hash >> 32, 8) + Utils::toHex(hash, 8)
+            + "-" + std::string(info.deviceName) + ".pimg";
+
+        if (restore(cacheName, hash, hexSize, flash, config))
+        {
+            return LoadResult::Cached;
+        }
+    }
+
+    if (!HexReader::parse(hexfile.text(), flash, config))
+    {
+        return LoadResult::Error;
+    }
+
+    if (!cacheName.empty())
+    {
+        // the cache is an optimisation, failing to write it is not an error
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        store(cacheName, hash, hexSize, flash, config);
+    }
+
+    return LoadResult::Parsed;
+}
@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <span>
+#include "deviceinfo.h"
+#include "memoryimage.h"
+
+/** Cache of parsed HEX files.
+
+    A HEX file is parsed once per target and the result is stored as a
+    .pimg file, named after a hash of the HEX file contents and the
+    target name. Later loads map the .pimg file and copy the pages
+    into the image, together with their CRC-32s.
+
+    .pimg layout, all fields little endian and 8 byte aligned:
+        PimgHeader
+        non-blank bitmap    one bit per page, LSB first, in 64 bit words
+        page CRCs           uint32 per page, including the blank pages
+        page map            uint32 page index per stored page, ascending
+        config              configBytes bytes
+        page data           pageWords*2 bytes per stored page
+*/
+namespace ImageCache
+{
+    constexpr uint32_t c_version = 1;
+
+    struct PimgHeader
+    {
+        char     magic[4];      ///< "PIMG"
+        uint16_t version;
+        uint16_t blankWord;
+        uint32_t flashWords;
+        uint32_t pageWords;
+        uint32_t pageCount;
+        uint32_t storedPages;
+        uint32_t configBytes;
+        uint32_t reserved;
+        uint64_t contentHash;   ///< hash of the HEX file, see contentHash()
+        uint64_t hexSize;       ///< size of the HEX file in bytes
+    };
+
+    static_assert(sizeof(PimgHeader) == 48);
+
+    enum class LoadResult
+    {
+        Error,
+        Parsed,     ///< the HEX file was parsed, and cached if possible
+        Cached      ///< the image was read from the cache
+    };
+
+    /** directory of the .pimg files: $PICMEUP_CACHE, $XDG_CACHE_HOME/picmeup
+        or ~/.cache/picmeup. Empty if none can be determined.
+    */
+    std::string cacheDirectory();
+
+    /** 64 bit hash of the HEX file contents */
+    uint64_t contentHash(std::span<const uint8_t> data);
+
+    /** load a HEX file for a target, from the cache if it holds the file.
+        flash and config must be blank and sized for the target.
+    */
+    LoadResult load(const std::string &hexFilename, const DeviceInfo &info,
+        MemoryImage &flash, std::vector<uint8_t> &config, bool useCache = true);
+
+    /** write an image as a .pimg file */
+    bool store(const std::string &filename, uint64_t hash, uint64_t hexSize,
+        const MemoryImage &flash, const std::vector<uint8_t> &config);
+
+    /** read a .pimg file. Returns false if it does not match the hash or the image sizes. */
+    bool restore(const std::string &filename, uint64_t hash, uint64_t hexSize,
+        MemoryImage &flash, std::vector<uint8_t> &config);
+};
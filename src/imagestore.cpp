@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include <sys/stat.h>
+#include "imagestore.h"
+#include "imagecache.h"
+
+ImageStore::FileStamp ImageStore::stampOf(const std::string &filename)
+{
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0)
+    {
+        return FileStamp{};
+    }
+
+    return FileStamp{
+        static_cast<int64_t>(info.st_mtim.tv_sec)*1000000000 + info.st_mtim.tv_nsec,
+        static_cast<int64_t>(info.st_size)
+    };
+}
+
+std::shared_ptr<const ProgramImage> ImageStore::get(const std::string &hexFilename, 
+    const DeviceInfo &info, SessionLog &log)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const Key key(hexFilename, &info);
+    const auto stamp = stampOf(hexFilename);
+    auto iter = m_images.find(key);
+    if ((iter != m_images.end()) && (iter->second.stamp == stamp))
+    {
+        return iter->second.image;
+    }
+
+    if (log.verbose)
+    {
+        log.out << "Reading IHEX file " << hexFilename << "\n";
+    }
+
+    auto image = std::make_shared<ProgramImage>(info);
+    auto loaded = ImageCache::load(hexFilename, info, image->flash, image->config, m_useCache);
+    if (loaded == ImageCache::LoadResult::Error)
+    {
+        log.err << "Error reading HEX file\n";
+        return nullptr;
+    }
+
+    if (log.verbose && (loaded == ImageCache::LoadResult::Cached))
+    {
+        log.out << "Using the cached image from " << ImageCache::cacheDirectory() << "\n";
+    }
+
+    // after this the image is only read, also from other threads
+    image->flash.updateCache();
+
+    m_images[key] = Entry{stamp, image};
+    return image;
+}
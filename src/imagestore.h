@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#pragma once
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <cstdint>
+#include "session.h"
+
+/** Loaded program images, shared by the sessions of a process.
+    An image is loaded from its HEX file, or the image cache, the first
+    time a target asks for it, and again when the HEX file has changed
+    since. Safe to use from several threads.
+*/
+class ImageStore
+{
+public:
+    explicit ImageStore(bool useCache = true) : m_useCache(useCache) {}
+
+    /** the image of a HEX file for a target. nullptr if the file cannot be read. */
+    std::shared_ptr<const ProgramImage> get(const std::string &hexFilename, const DeviceInfo &info,
+        SessionLog &log);
+
+protected:
+    using Key = std::pair<std::string, const DeviceInfo*>;
+
+    /** modification time and size of a HEX file, to see that it was rebuilt */
+    struct FileStamp
+    {
+        int64_t mtimeNs = 0;
+        int64_t size    = 0;
+
+        bool operator==(const FileStamp&) const = default;
+    };
+
+    static FileStamp stampOf(const std::string &filename);
+
+    struct Entry
+    {
+        FileStamp                           stamp;
+        std::shared_ptr<const ProgramImage> image;
+    };
+
+    bool m_useCache;
+    std::mutex m_mutex;
+    std::map<Key, Entry> m_images;
+};
@@ -6,18 +6,23 @@
 #include <string>
 #include <vector>
 #include <algorithm>
-#include <streambuf>
+#include <array>
+#include <filesystem>
+#include <atomic>
+#include <csignal>
 
 #include "utils.h"
 #include "serial.h"
 #include "pgmfactory.h"
+#include "devicedb.h"
 
 #include "contrib/cxxopts.hpp"
-#include "hexreader.h"
-
-extern "C" char g_devices[];
-extern "C" size_t g_devices_size;
-
+#include "hexwriter.h"
+#include "session.h"
+#include "imagestore.h"
+#include "gang.h"
+#include "asyncsession.h"
+#include "daemon.h"
 
 void showTargetDeviceInfo(const DeviceInfo &info)
 {
@@ -26,162 +31,30 @@ void showTargetDeviceInfo(const DeviceInfo &info)
     std::cout << "  Flash page size : " << info.flashPageSize << " words\n";
     std::cout << "  Device ID       : " << Utils::toHex(info.deviceId);
     std::cout << std::dec << std::nouppercase << "\n";
-    std::cout << "  Device Family   : " << info.deviceFamily << "\n";
+    std::cout << "  Device Family   : " << familyName(info.deviceFamily) << "\n";
 }
 
-struct MemoryStream : std::streambuf
-{
-    MemoryStream(char *begin, char *end)
-    {
-        this->setg(begin, begin, end);
-    }
-};
+/** set by Ctrl-C to end the --repeat loop after the current target */
+static std::atomic<bool> g_stopRepeat{false};
 
-std::vector<DeviceInfo> readDeviceInfo()
+static void onInterrupt(int)
 {
-    std::vector<DeviceInfo> info;
-    //std::ifstream deviceFile(filename);
-
-    MemoryStream memstream(g_devices, g_devices + g_devices_size);
-    std::istream deviceFile(&memstream);
-
-    struct FamilyInfo
-    {
-        std::string name;
-        uint32_t    configSize; // in words
-    };
-
-    const std::array<FamilyInfo, 13> validFamilies = 
-    {
-        {{"CF_P16F_A", 2},
-        {"CF_P16F_B",  3},
-        {"CF_P16F_C",  2},  
-        {"CF_P16F_D",  2},
-        {"CF_P18F_A", 16},
-        {"CF_P18F_B",  8},
-        {"CF_P18F_C", 16 /* basically CF_P18F_A */},
-        {"CF_P18F_D", 16},
-        {"CF_P18F_E", 16},
-        {"CF_P18F_F", 12},
-        {"CF_P18F_G", 10 /* basically CF_P18F_F */},
-        {"CF_P18F_Q", 12},
-        {"CF_P16F_PGM_A", 1}}
-    };
-
-    //if (!deviceFile.is_good())
-    //{
-    //    std::cerr << "Cannot open device file: " << filename << "\n";
-    //    return info;
-    //}
-
-    size_t lineNum = 0;
-    while(!deviceFile.eof())
-    {
-        std::string line;
-        std::getline(deviceFile, line);
-
-        lineNum++;
-
-        // skip empty lines and comments
-        if ((line.size() <= 2) || (line.at(0) == '#'))
-        {
-            continue;
-        }
-
-        auto tokens = Utils::tokenize(line, ' ');
-        
-        auto &dev = info.emplace_back();
-
-        if (tokens.size() < 6)
-        {
-            std::cerr << "Error parsing device file - not enough columns on line " << lineNum << "\n";
-            return std::vector<DeviceInfo>();
-        }
-
-        // read device name
-        dev.deviceName = tokens.at(0);
-
-        // read flash mem size (in words)
-        auto flashMemOpt = Utils::intStrToint32(tokens.at(1));
-        if (!flashMemOpt)
-        {
-            std::cerr << "Error parsing flash mem size on line " << lineNum << "\n";
-            return std::vector<DeviceInfo>();
-        }
-        dev.flashMemSize = flashMemOpt.value() / 2;     // convert bytes to words
-
-        // read flash mem size (in words)
-        auto flashPageOpt = Utils::intStrToint32(tokens.at(2));
-        if (!flashPageOpt)
-        {
-            std::cerr << "Error parsing flash page size on line " << lineNum << "\n";
-            return std::vector<DeviceInfo>();
-        }
-        dev.flashPageSize = flashPageOpt.value() / 2;   // convert bytes to words
-
-        // read device ID
-        auto deviceIdOpt = Utils::hexStrToUint32(tokens.at(3));
-        if (!deviceIdOpt)
-        {
-            std::cerr << "Error parsing device ID on line " << lineNum << "\n";
-            return std::vector<DeviceInfo>();            
-        }
-        dev.deviceId = deviceIdOpt.value();
-
-        // read device ID bit mask
-        auto deviceIdMaskOpt = Utils::hexStrToUint32(tokens.at(4));
-        if (!deviceIdMaskOpt)
-        {
-            std::cerr << "Error parsing device ID mask on line " << lineNum << "\n";
-            return std::vector<DeviceInfo>();            
-        }        
-        dev.deviceIdMask = deviceIdMaskOpt.value();
-
-        // read device family
-        const auto deviceFamily = tokens.at(5);
-        auto iter = std::find_if(validFamilies.begin(), validFamilies.end(), 
-            [&deviceFamily](const FamilyInfo &device)
-            {
-                return device.name == deviceFamily;
-            }
-        );
-
-        if (iter == validFamilies.end())
-        {
-            std::cerr << "Error parsing device family on line " << lineNum << "\n";
-            return std::vector<DeviceInfo>();            
-        }        
-
-        dev.deviceFamily = iter->name;
-        dev.configSize   = iter->configSize;
-    }
-
-    return info;
-};
+    g_stopRepeat = true;
+}
 
-bool checkDevice(std::shared_ptr<IDeviceProgrammer> iface, const DeviceInfo &target)
+/** print the transfer statistics of a serial port */
+void showStats(const Serial::Stats &stats)
 {
-    // read the device ID from the interface.
-    // note: the programmer must be in programming mode to make this work
-
-    auto idOpt = iface->readDeviceId();
-    if (!idOpt)
+    std::cout << "Serial TX: " << stats.txBytes << " bytes in " << stats.txFrames << " frames, ";
+    std::cout << stats.txSyscalls << " syscalls";
+    if (stats.txFrames > 0)
     {
-        std::cerr << "Could not read device ID!\n";
-        return false;
+        std::cout << " (" << (stats.txBytes / stats.txFrames) << " bytes/frame)";
     }
- 
-    const uint32_t IDcheck = idOpt.value() & target.deviceIdMask;
-
-    bool IDok = (IDcheck == target.deviceId);
-    std::cout << "  device ID = " << Utils::toHex(IDcheck) << "\n";
-    if (!IDok)
-    {
-        std::cerr << "Device ID mismatch! Wanted " << Utils::toHex(target.deviceId) << " but got " << Utils::toHex(IDcheck) << "\n";
-        return false;
-    }
-
-    return true;    
+    std::cout << "\n";
+    std::cout << "Serial RX: " << stats.rxBytes << " bytes in " << stats.rxSyscalls << " syscalls\n";
+    std::cout << "Frames   : " << stats.rxFrames << " received, " << stats.rxCorrupt << " corrupt, ";
+    std::cout << stats.txRetries << " sent again\n";
 }
 
 int main(int argc, char *argv[])
@@ -190,6 +63,7 @@ int main(int argc, char *argv[])
     std::string targetName;
     std::string uploadHexfileName;
     std::string downloadHexfileName;
+    uint32_t baudrate;
     bool verify;
     bool upload;
     bool download;
@@ -197,6 +71,13 @@ int main(int argc, char *argv[])
     bool cpuErase;
     bool showConfig;
     bool showDevices;
+    bool noCache;
+    bool delta;
+    bool partial;
+    bool eventLoop;
+    bool useDaemon = false;
+    bool repeat;
+    std::string daemonSocket;
     bool blankCheck = true;
 
     std::cout << "--== PICMEUP version 0.1a ==--\n\n";
@@ -210,16 +91,23 @@ int main(int argc, char *argv[])
         options
             .set_width(70)
             .add_options()
-            ("t,target","target cpu name", cxxopts::value<std::string>(targetName))
-            ("p,port",  "serial port device name", cxxopts::value<std::string>(comName)->default_value("/dev/ttyUSB0"))
+            ("t,target","target cpu name, detected from the device ID if omitted", cxxopts::value<std::string>(targetName))
+            ("p,port",  "serial port device name, several separated by commas for gang programming", cxxopts::value<std::string>(comName)->default_value("/dev/ttyUSB0"))
+            ("b,baud",  "serial link baud rate, e.g. 115200, 250000, 500000, 1000000 or 2000000", cxxopts::value<uint32_t>(baudrate)->default_value("57600"))
             ("i,input", "upload Intel HEX file", cxxopts::value<std::string>(uploadHexfileName))
             ("o,output","download Intel HEX file", cxxopts::value<std::string>(downloadHexfileName)->default_value("download.hex"))
             ("v,verify","Verify program", cxxopts::value<bool>(verify)->default_value("false"))
             ("verbose","Verbose output", cxxopts::value<bool>(verbose)->default_value("false"))
-            ("d,download","Download program", cxxopts::value<bool>(download)->default_value("false"))
+            ("d,download","Download program, before anything is erased or programmed", cxxopts::value<bool>(download)->default_value("false"))
             ("e,erase","Erase before programming", cxxopts::value<bool>(cpuErase)->default_value("true"))
             ("u,upload","Upload program", cxxopts::value<bool>(upload)->default_value("false"))
+            ("delta","Only erase and program the rows that differ from the device", cxxopts::value<bool>(delta)->default_value("false"))
+            ("partial","Only erase and program the rows that hold data in the HEX file, leave the rest of the device alone", cxxopts::value<bool>(partial)->default_value("false"))
+            ("eventloop","Drive all ports from a single thread instead of a thread per port", cxxopts::value<bool>(eventLoop)->default_value("false"))
+            ("repeat","Keep programming: wait for the next target after each one, until Ctrl-C", cxxopts::value<bool>(repeat)->default_value("false"))
+            ("daemon","Hand the job to picmeupd, on its default socket or --daemon=socket", cxxopts::value<std::string>(daemonSocket)->implicit_value(""))
             ("showconfig","Print the configuration bits", cxxopts::value<bool>(showConfig)->default_value("false"))
+            ("nocache","Always parse the HEX file, do not use the image cache", cxxopts::value<bool>(noCache)->default_value("false"))
             ("showdevices","Print supported devices", cxxopts::value<bool>(showDevices)->default_value("false"))
             ("h, help", "Print help");
 
@@ -230,6 +118,8 @@ int main(int argc, char *argv[])
             std::cout << options.help({"", "Group"}) << std::endl;
             return EXIT_FAILURE;
         }
+
+        useDaemon = result.count("daemon") > 0;
     }
     catch(const cxxopts::OptionException& e)
     {
@@ -237,26 +127,19 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    if (targetName.empty())
-    {
-        std::cerr << "Please specify a target name\n";
-        return EXIT_FAILURE;
-    }
 
-    // read the device file
-    //auto deviceInfo = readDeviceInfo("devices.dat");
-    auto deviceInfo = readDeviceInfo();
-    if (deviceInfo.empty())
+    if (delta && partial)
     {
+        std::cerr << "--delta and --partial cannot be combined\n";
         return EXIT_FAILURE;
     }
 
     if (showDevices)
     {
         std::cout << "Supported devices:\n";
-        for(auto const device : deviceInfo)
+        for(auto const &device : DeviceDB::devices())
         {
-            if (device.deviceFamily == "CF_P16F_A")
+            if (device.deviceFamily == DeviceFamily::CF_P16F_A)
             {
                 std::cout << "  " << device.deviceName << "\n";
             }
@@ -264,59 +147,168 @@ int main(int argc, char *argv[])
     }
 
     // find the target device in the device list
-    targetName = Utils::toLower(targetName);
-    auto iter = std::find_if(deviceInfo.begin(), deviceInfo.end(),
-        [&targetName](const DeviceInfo &device)
+    const DeviceInfo *targetDevice = nullptr;
+    if (!targetName.empty())
+    {
+        targetName = Utils::toLower(targetName);
+        targetDevice = DeviceDB::findByName(targetName);
+        if (targetDevice == nullptr)
         {
-            return device.deviceName == targetName;
+            std::cerr << "Cannot find target device " << targetName << " in device list\n";
+            return EXIT_FAILURE;
         }
-    );
 
-    if (iter == deviceInfo.end())
+        showTargetDeviceInfo(*targetDevice);
+        std::cout << "\n";
+    }
+
+    JobOptions jobOptions;
+    jobOptions.upload     = upload;
+    jobOptions.verify     = verify;
+    jobOptions.erase      = cpuErase;
+    jobOptions.blankCheck = blankCheck;
+    jobOptions.delta      = delta;
+    jobOptions.partial    = partial;
+
+    ImageStore images(!noCache);
+    SessionLog log{std::cout, std::cerr, verbose};
+
+    auto ports = Utils::tokenize(comName, ',');
+
+    if (repeat && ((ports.size() != 1) || download || showConfig || eventLoop || useDaemon))
     {
-        std::cerr << "Cannot find target device " << targetName << " in device list\n";
+        std::cerr << "--repeat needs a single port and cannot download, show the configuration\n";
+        std::cerr << "or be combined with --eventloop or --daemon\n";
         return EXIT_FAILURE;
     }
 
-    auto targetDeviceInfo = *iter;
+    // picmeupd has the programmer open already
+    if (useDaemon)
+    {
+        if ((ports.size() != 1) || download || showConfig || eventLoop)
+        {
+            std::cerr << "--daemon needs a single port and cannot download or show the configuration\n";
+            return EXIT_FAILURE;
+        }
 
-    showTargetDeviceInfo(targetDeviceInfo);
+        DaemonJob job;
+        job.port     = comName;
+        job.baudrate = baudrate;
+        job.options  = jobOptions;
+        job.verbose  = verbose;
+        if (targetDevice != nullptr)
+        {
+            job.target = targetDevice->deviceName;
+        }
 
-    std::cout << "\n";
+        if (!uploadHexfileName.empty())
+        {
+            job.hexFilename = std::filesystem::absolute(uploadHexfileName).string();
+        }
+
+        const auto socketPath = daemonSocket.empty() ? Daemon::defaultSocketPath() : daemonSocket;
+        auto ok = Daemon::submit(socketPath, job, std::cout);
+        if (!ok)
+        {
+            std::cerr << "Cannot reach picmeupd on " << socketPath << "\n";
+            return EXIT_FAILURE;
+        }
 
-    auto serial = Serial::open(comName.c_str(), 57600);
-    if (serial)
+        std::cout << (ok.value() ? "Done.\n" : "Failed.\n");
+        return ok.value() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // several ports: program them all at the same time
+    if ((ports.size() > 1) || eventLoop)
     {
-        std::cout << "Serial port opened!\n";
+        if (download || showConfig)
+        {
+            std::cerr << "Downloading and showing the configuration need a single port\n";
+            return EXIT_FAILURE;
+        }
+
+        if (eventLoop && !AsyncSession::supports(targetDevice, jobOptions))
+        {
+            std::cerr << "--eventloop needs a family that enters programming mode with the\n";
+            std::cerr << "key sequence and cannot be combined with --delta or --partial\n";
+            return EXIT_FAILURE;
+        }
+
+        std::cout << "Gang programming on " << ports.size() << " ports..\n";
+        const auto start = Serial::Clock::now();
+        auto results = eventLoop ?
+            Gang::runEventLoop(ports, baudrate, targetDevice, uploadHexfileName, images, jobOptions, verbose) :
+            Gang::run(ports, baudrate, targetDevice, uploadHexfileName, images, jobOptions, verbose);
+        const double seconds = std::chrono::duration<double>(Serial::Clock::now() - start).count();
+
+        bool ok = true;
+        for(auto const &result : results)
+        {
+            if (verbose || !result.ok)
+            {
+                std::cout << "--- " << result.port << " ---\n" << result.log;
+            }
+            ok &= result.ok;
+        }
+
+        Gang::report(results, seconds, std::cout);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
     }
-    else
+
+    auto serial = Session::openProgrammer(comName, baudrate, log);
+    if (!serial)
     {
-        std::cout << "Error opening serial port " << comName << " !\n";
         return EXIT_FAILURE;
     }
+    std::cout << "Serial port opened!\n";
 
-    // Arduino resets when the UART connects.
-    // and we have to wait a bit before the uC comes online.
-    // This is why we can't have nice things.
-    if (verbose)
+    if (targetDevice == nullptr)
     {
-        std::cout << "Waiting for the programmer to come online..\n";
+        std::cout << "Detecting target..\n";
+        targetDevice = Session::detectDevice(serial, log);
+        if (targetDevice == nullptr)
+        {
+            std::cerr << "Could not detect the target device, please specify it with -t\n";
+            return EXIT_FAILURE;
+        }
+
+        showTargetDeviceInfo(*targetDevice);
+        std::cout << "\n";
     }
 
-    sleep(2);
+    const auto &targetDeviceInfo = *targetDevice;
 
-    // FIXME: use factory to create the correct programmer
-    // for the device family
     auto pgm = ProgrammerFactory::create(targetDeviceInfo.deviceFamily, serial);
     if (!pgm)
     {
-        std::cerr << "Device family " << targetDeviceInfo.deviceFamily << " is not supported\n";
+        std::cerr << "Device family " << familyName(targetDeviceInfo.deviceFamily) << " is not supported\n";
         return EXIT_FAILURE;
     }
 
+    // production line: the port and the image stay loaded from target to target
+    if (repeat)
+    {
+        auto image = uploadHexfileName.empty() ? std::make_shared<const ProgramImage>(targetDeviceInfo)
+            : images.get(uploadHexfileName, targetDeviceInfo, log);
+        if (!image)
+        {
+            return EXIT_FAILURE;
+        }
+
+        signal(SIGINT, onInterrupt);
+        std::cout << "Programming targets until Ctrl-C is pressed\n";
+        const bool ok = Session::repeatJob(*pgm, targetDeviceInfo, *image, jobOptions, g_stopRepeat, log);
+
+        if (verbose)
+        {
+            showStats(serial->stats());
+        }
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     pgm->enterProgMode();
 
-    if (!checkDevice(pgm, targetDeviceInfo))
+    if (!Session::checkDevice(*pgm, targetDeviceInfo, log))
     {
         pgm->exitProgMode();
         return EXIT_FAILURE;
@@ -326,83 +318,64 @@ int main(int argc, char *argv[])
         std::cout << "Device ID ok!\n";
     }
 
-    std::vector<uint8_t> flashMem(targetDeviceInfo.flashMemSize*2, 0xFF);
-    std::vector<uint8_t> configMem(targetDeviceInfo.configSize*2,  0xFF);
-
-    // FIXME: PIC16 has 14-bit word, so we need
-    //        to make sure the top 2 bits are 0
-    //        however, other PICs might have
-    //        a wide pgm word..
-    for(size_t idx=1; idx<flashMem.size(); idx+=2)
-    {
-        flashMem.at(idx) &= 0x3F;
-    }
+    // FIXME: PIC16 has 14-bit word, so an erased
+    //        word reads as 0x3FFF. however, other PICs 
+    //        might have a wide pgm word..
+    auto image = std::make_shared<const ProgramImage>(targetDeviceInfo);
 
     // read the input hex file if there is one
     if (!uploadHexfileName.empty())
     {
-        if (verbose)
+        image = images.get(uploadHexfileName, targetDeviceInfo, log);
+        if (!image)
         {
-            std::cout << "Reading IHEX file " << uploadHexfileName << "\n";
-        }
-
-        if (!HexReader::read(uploadHexfileName, flashMem, configMem))
-        {
-            std::cerr << "Error reading HEX file\n";
             pgm->exitProgMode();
             return EXIT_FAILURE;
         }
         // TODO: check if config bits are available
     }
 
-    bool isBlank = true;
-    if (blankCheck)
+    // the flash is read before the job, which may erase it
+    if (download)
     {
-        std::cout << "Blank check\n";
-        isBlank = pgm->isDeviceBlank(targetDeviceInfo);
-        if (isBlank)
+        std::cout << "Reading flash into " << downloadHexfileName << "\n";
+
+        HexWriter writer;
+        if (!writer.open(downloadHexfileName))
         {
-            std::cout << "Device is blank\n";
+            std::cerr << "Cannot create HEX file " << downloadHexfileName << "\n";
+            pgm->exitProgMode();
+            return EXIT_FAILURE;
         }
-    }
-
-    if (cpuErase && !isBlank)
-    {
-        std::cout << "Erasing flash memory\n";
-        pgm->massErase();
-        sleep(1);
-    }
 
-    if (upload)
-    {
-        std::cout << "Programming flash..\n";
-        pgm->uploadFlash(targetDeviceInfo, flashMem);
-        pgm->uploadConfig(targetDeviceInfo, configMem);
-        std::cout << "\n";
-    }
+        // records are written while the next chunk is read
+        constexpr size_t c_downloadChunkWords = 1024;
+        std::vector<uint8_t> chunk(c_downloadChunkWords*2);
+        bool ok = true;
+        for(size_t address = 0; (address < targetDeviceInfo.flashMemSize) && ok; address += c_downloadChunkWords)
+        {
+            const size_t words = std::min(c_downloadChunkWords, targetDeviceInfo.flashMemSize - address);
+            auto dest = std::span(chunk).first(words*2);
+            ok = pgm->downloadFlash(targetDeviceInfo, address, dest) && writer.write(address*2, dest);
+        }
 
-    if (verify)
-    {        
-        std::cout << "Verifying.. ";
-        auto flashContents = pgm->downloadFlash(targetDeviceInfo);
+        // the configuration words go where HexReader expects them
+        auto configBytes = pgm->downloadConfig(targetDeviceInfo);
+        ok = ok && !configBytes.empty() && writer.write(0x1000E, configBytes, false);
 
-        for(size_t address = 0; address < targetDeviceInfo.flashMemSize*2; address+=2)
+        if (!writer.close() || !ok)
         {
-            bool check1 = flashContents.at(address) == flashMem.at(address);
-            bool check2 = flashContents.at(address+1) == flashMem.at(address+1);
-            if ((check1 && check2) == false)
-            {
-                std::cerr << "Flash memory mismatch at address " << (address/2) << "\n";
-                std::cerr << "  wanted: " << Utils::toHex(flashMem.at(address+1),2);
-                std::cerr << Utils::toHex(flashMem.at(address),2) << "  but got: ";
-                std::cerr << Utils::toHex(flashContents.at(address+1),2);
-                std::cerr << Utils::toHex(flashContents.at(address),2) << "\n";
-                pgm->exitProgMode();
-                return EXIT_FAILURE;
-            }
+            std::cerr << "Could not download the flash memory!\n";
+            pgm->exitProgMode();
+            return EXIT_FAILURE;
         }
-        std::cout << "Ok!\n";
-    }    
+    }
+
+    if (!Session::runJob(*pgm, targetDeviceInfo, *image, jobOptions, log))
+    {
+        pgm->exitProgMode();
+        return EXIT_FAILURE;
+    }
 
     if (showConfig)
     {
@@ -429,6 +402,11 @@ int main(int argc, char *argv[])
 
     pgm->exitProgMode();
 
+    if (verbose)
+    {
+        showStats(serial->stats());
+    }
+
     std::cout << "Done.\n";
 
     return EXIT_SUCCESS;
@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mappedfile.h"
+
+MappedFile::MappedFile(const std::string &filename)
+{
+    m_fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0)
+    {
+        return;
+    }
+
+    struct stat info;
+    if ((fstat(m_fd, &info) != 0) || (!S_ISREG(info.st_mode)))
+    {
+        return;
+    }
+
+    m_size = info.st_size;
+    if (m_size == 0)
+    {
+        m_ok = true;    // mmap does not accept empty files
+        return;
+    }
+
+    m_data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (m_data == MAP_FAILED)
+    {
+        m_data = nullptr;
+        return;
+    }
+
+    madvise(m_data, m_size, MADV_SEQUENTIAL);
+    m_ok = true;
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data != nullptr)
+    {
+        munmap(m_data, m_size);
+    }
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+    }
+}
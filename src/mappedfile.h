@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <span>
+
+/** a read-only memory mapping of a whole file */
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string &filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /** true if the file could be opened. An empty file is open but has no data. */
+    bool isOpen() const noexcept
+    {
+        return m_ok;
+    }
+
+    std::span<const uint8_t> data() const noexcept
+    {
+        return std::span<const uint8_t>(static_cast<const uint8_t*>(m_data), m_data ? m_size : 0);
+    }
+
+    std::string_view text() const noexcept
+    {
+        return std::string_view(static_cast<const char*>(m_data), m_data ? m_size : 0);
+    }
+
+protected:
+    int    m_fd   = -1;
+    void  *m_data = nullptr;
+    size_t m_size = 0;
+    bool   m_ok   = false;
+};
@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include <algorithm>
+#include "memoryimage.h"
+#include "framing.h"
+
+MemoryImage::MemoryImage(size_t sizeWords, size_t pageWords, uint16_t blankWord) 
+    : m_sizeWords(sizeWords), m_pageWords(pageWords)
+{
+    m_blankPage.resize(pageBytes());
+    for(size_t i=0; i<m_blankPage.size(); i+=2)
+    {
+        m_blankPage.at(i)   = blankWord & 0xFF;
+        m_blankPage.at(i+1) = blankWord >> 8;
+    }
+    m_blankCrc = Framing::crc32(m_blankPage.data(), m_blankPage.size());
+
+    m_pageSlots.resize((sizeWords + pageWords - 1) / pageWords, c_noSlot);
+}
+
+uint8_t* MemoryImage::pageStorage(size_t index)
+{
+    auto &slot = m_pageSlots.at(index);
+    if (slot == c_noSlot)
+    {
+        slot = m_slots.size();
+        m_slots.push_back(Slot{index});
+        m_pool.insert(m_pool.end(), m_blankPage.begin(), m_blankPage.end());
+    }
+
+    m_slots.at(slot).dirty = true;
+    return &m_pool.at(slot*pageBytes());
+}
+
+bool MemoryImage::setByte(size_t byteAddress, uint8_t value)
+{
+    if (byteAddress >= (m_sizeWords*2))
+    {
+        return false;
+    }
+
+    pageStorage(byteAddress / pageBytes())[byteAddress % pageBytes()] = value;
+    return true;
+}
+
+size_t MemoryImage::setBytes(size_t byteAddress, std::span<const uint8_t> data)
+{
+    size_t stored = 0;
+    while((stored < data.size()) && (byteAddress < (m_sizeWords*2)))
+    {
+        const size_t offset = byteAddress % pageBytes();
+        const size_t bytes  = std::min({data.size() - stored, pageBytes() - offset,
+            (m_sizeWords*2) - byteAddress});
+
+        std::copy_n(data.begin() + stored, bytes, pageStorage(byteAddress / pageBytes()) + offset);
+        stored      += bytes;
+        byteAddress += bytes;
+    }
+    return stored;
+}
+
+void MemoryImage::setPage(size_t index, std::span<const uint8_t> data, uint32_t crc)
+{
+    std::copy_n(data.begin(), std::min(data.size(), pageBytes()), pageStorage(index));
+
+    auto &slot    = m_slots.at(m_pageSlots.at(index));
+    slot.crc      = crc;
+    slot.nonBlank = (crc != m_blankCrc) || !std::equal(data.begin(), data.end(), m_blankPage.begin());
+    slot.dirty    = (data.size() != pageBytes());
+}
+
+uint16_t MemoryImage::word(size_t address) const
+{
+    auto data = page(address / m_pageWords);
+    const size_t offset = (address % m_pageWords)*2;
+    return data[offset] | (static_cast<uint16_t>(data[offset+1]) << 8);
+}
+
+std::span<const uint8_t> MemoryImage::page(size_t index) const
+{
+    const auto slot = m_pageSlots.at(index);
+    if (slot == c_noSlot)
+    {
+        return m_blankPage;
+    }
+    return std::span<const uint8_t>(m_pool.data() + slot*pageBytes(), pageBytes());
+}
+
+const MemoryImage::Slot& MemoryImage::slotInfo(uint32_t slot) const
+{
+    auto &info = m_slots.at(slot);
+    if (info.dirty)
+    {
+        auto data = std::span<const uint8_t>(m_pool.data() + slot*pageBytes(), pageBytes());
+        info.crc      = Framing::crc32(data.data(), data.size());
+        info.nonBlank = !std::equal(data.begin(), data.end(), m_blankPage.begin());
+        info.dirty    = false;
+    }
+    return info;
+}
+
+bool MemoryImage::isPageBlank(size_t index) const
+{
+    const auto slot = m_pageSlots.at(index);
+    return (slot == c_noSlot) || !slotInfo(slot).nonBlank;
+}
+
+uint32_t MemoryImage::pageCrc(size_t index) const
+{
+    const auto slot = m_pageSlots.at(index);
+    return (slot == c_noSlot) ? m_blankCrc : slotInfo(slot).crc;
+}
+
+void MemoryImage::updateCache() const
+{
+    for(uint32_t slot=0; slot<m_slots.size(); slot++)
+    {
+        slotInfo(slot);
+    }
+}
+
+std::vector<size_t> MemoryImage::usedPages() const
+{
+    std::vector<size_t> pages;
+    pages.reserve(m_slots.size());
+    for(uint32_t slot=0; slot<m_slots.size(); slot++)
+    {
+        if (slotInfo(slot).nonBlank)
+        {
+            pages.push_back(m_slots.at(slot).page);
+        }
+    }
+    std::sort(pages.begin(), pages.end());
+    return pages;
+}
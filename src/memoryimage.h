@@ -0,0 +1,110 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <span>
+
+/** Flash memory image that only stores the pages holding data.
+
+    A page gets storage from a common pool when it is first written,
+    all other pages read as blank. The blank state and the CRC-32 of
+    a page are cached until the page is written again.
+*/
+class MemoryImage
+{
+public:
+    /** sizes are in words. blankWord is the value of an erased word. */
+    MemoryImage(size_t sizeWords, size_t pageWords, uint16_t blankWord = 0x3FFF);
+
+    size_t sizeWords() const noexcept
+    {
+        return m_sizeWords;
+    }
+
+    size_t pageWords() const noexcept
+    {
+        return m_pageWords;
+    }
+
+    size_t pageBytes() const noexcept
+    {
+        return m_pageWords*2;
+    }
+
+    size_t pageCount() const noexcept
+    {
+        return m_pageSlots.size();
+    }
+
+    /** set a byte at a byte address. returns false if it is outside the image */
+    bool setByte(size_t byteAddress, uint8_t value);
+
+    /** copy bytes to a byte address, page by page.
+        returns the number of bytes stored, which is less than
+        data.size() if the end of the image was reached.
+    */
+    size_t setBytes(size_t byteAddress, std::span<const uint8_t> data);
+
+    /** store a whole page whose CRC-32 is already known, e.g. from an image cache */
+    void setPage(size_t index, std::span<const uint8_t> data, uint32_t crc);
+
+    /** value of an erased word */
+    uint16_t blankWord() const noexcept
+    {
+        return m_blankPage[0] | (static_cast<uint16_t>(m_blankPage[1]) << 8);
+    }
+
+    /** word at a word address */
+    uint16_t word(size_t address) const;
+
+    /** the bytes of a page, LSB first. Pages without data share the blank page.
+        The span is valid until the next call to setByte.
+    */
+    std::span<const uint8_t> page(size_t index) const;
+
+    /** true if every word of the page is blank */
+    bool isPageBlank(size_t index) const;
+
+    /** CRC-32 of a page, as computed by the CrcRange command */
+    uint32_t pageCrc(size_t index) const;
+
+    /** compute the cached state of every page. After this the const
+        functions do not change the image, so several threads can read it.
+    */
+    void updateCache() const;
+
+    /** indices of the pages that are not blank, in ascending order */
+    std::vector<size_t> usedPages() const;
+
+protected:
+    /** a page that has storage in the pool */
+    struct Slot
+    {
+        size_t   page;
+        uint32_t crc      = 0;
+        bool     dirty    = true;   ///< crc and nonBlank must be recomputed
+        bool     nonBlank = false;
+    };
+
+    /** storage of a page, taken from the pool if needed. Marks the page dirty. */
+    uint8_t* pageStorage(size_t index);
+
+    /** recompute the cached state of a slot if it was written */
+    const Slot& slotInfo(uint32_t slot) const;
+
+    constexpr static uint32_t c_noSlot = 0xFFFFFFFF;
+
+    size_t   m_sizeWords;
+    size_t   m_pageWords;
+
+    std::vector<uint8_t>    m_blankPage;
+    uint32_t                m_blankCrc;
+
+    std::vector<uint32_t>   m_pageSlots;    ///< slot of each page, or c_noSlot
+    std::vector<uint8_t>    m_pool;         ///< storage of the pages that hold data
+    mutable std::vector<Slot> m_slots;
+};
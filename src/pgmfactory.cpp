@@ -6,32 +6,44 @@
 #include "pic16pgm_a.h"
 //#include "pic16c.h"
 
-std::shared_ptr<IDeviceProgrammer> ProgrammerFactory::create(const std::string &deviceFamily, std::shared_ptr<Serial> serial)
+std::shared_ptr<IDeviceProgrammer> ProgrammerFactory::create(DeviceFamily deviceFamily, std::shared_ptr<Serial> serial)
 {
-    if (deviceFamily == "CF_P16F_A")
+    switch(deviceFamily)
     {
+    case DeviceFamily::CF_P16F_A:
         return std::make_shared<PIC16A>(serial);
-    }
-    else if (deviceFamily == "CF_P16F_B")
-    {
+    case DeviceFamily::CF_P16F_B:
         return std::make_shared<PIC16B>(serial);
-    }
-    else if (deviceFamily == "CF_P16F_PGM_A")
-    {
+    case DeviceFamily::CF_P16F_PGM_A:
         return std::make_shared<PIC16PGM_A>(serial);
-    }
+
     // Note: CF_P16F_C uses a very different command set!
     //       it needs support from the Arduino code.
     // see: 40001753B.pdf
     //
-    //else if (deviceFamily == "CF_P16F_C")
-    //{
+    //case DeviceFamily::CF_P16F_C:
     //    return std::make_shared<PIC16C>(serial);
-    //}
 
     // At first glance, CF_P16F_D has the same command set
     // as CF_P16F_A., see 40001738D.pdf
+    default:
+        break;
+    }
 
     return nullptr;
 }
 
+EntrySequence ProgrammerFactory::entrySequence(DeviceFamily deviceFamily)
+{
+    switch(deviceFamily)
+    {
+    case DeviceFamily::CF_P16F_A:
+    case DeviceFamily::CF_P16F_B:
+        return EntrySequence::LowVoltageKey;
+    case DeviceFamily::CF_P16F_PGM_A:
+        return EntrySequence::PGMPin;
+    default:
+        return EntrySequence::Unsupported;
+    }
+}
+
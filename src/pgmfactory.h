@@ -3,9 +3,20 @@
 
 #include "devicepgminterface.h"
 
+/** the ways of putting a device into programming mode */
+enum class EntrySequence
+{
+    LowVoltageKey,  ///< MCLR low and the 32 bit key, see PIC16A::enterProgMode
+    PGMPin,         ///< PGM pin high before MCLR, see PIC16PGM_A::enterProgMode
+    Unsupported
+};
+
 class ProgrammerFactory
 {
 public:
-    static std::shared_ptr<IDeviceProgrammer> create(const std::string &deviceFamily, 
+    static std::shared_ptr<IDeviceProgrammer> create(DeviceFamily deviceFamily, 
         std::shared_ptr<Serial> serial);
+
+    /** how the engine for a family enters programming mode */
+    static EntrySequence entrySequence(DeviceFamily deviceFamily);
 };
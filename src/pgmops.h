@@ -3,6 +3,7 @@
 
 enum class PGMOperation : uint8_t
 {
+    Sync                = 0x00,     // no payload, restarts the frame sequence numbering
     EnterProgMode       = 0x01,
     ExitProgMode        = 0x02,
     ResetPointer        = 0x03,
@@ -11,11 +12,33 @@ enum class PGMOperation : uint8_t
     ReadPage            = 0x06,
     MassErasePIC16A     = 0x07,
     WritePage           = 0x08,
+    SetBaudRate         = 0x09,     // 4 byte argument: baud rate, LSB first
+    Echo                = 0x0A,     // reply with the payload, used to test the link
+    WritePageSeq        = 0x0B,     // sequence-numbered WritePage at a word address, acked when programming starts.
+                                    // Payload: seq, words, speed, address (16 bits) and the words.
+                                    // The address was added for sparse images: older firmware
+                                    // programs it as data, so update host and firmware together
+    ReadRange           = 0x0C,     // 2 byte argument: number of words, LSB first. Streams c_replyData frames
+    CrcRange            = 0x0D,     // start, count (16 bits each) and block size in words. 
+                                    // Streams the CRC-32 of each block in c_replyData frames
+    BlankCheckRange     = 0x0E,     // start and count (16 bits each). Replies the first non-blank 
+                                    // address and word, or no data when the range is blank
+    VerifyPage          = 0x0F,     // start (16 bits) and the expected words. Replies the number
+                                    // of mismatches, then offset and word of each
 
     EnterProgModeWithPGM= 0x10,     // classic devices such as PIC16F87X
     ExitProgModeWithPGM = 0x11,     // classic devices such as PIC16F87X
     LoadConfigWithArg   = 0x12,     // 1 word argument
     BulkEraseSetup1     = 0x13,
     BulkEraseSetup2     = 0x14,
-    BeginEraseProgramming = 0x15
+    BeginEraseProgramming = 0x15,
+
+    RowErase            = 0x16      // start (16 bits), number of rows and words per row.
+                                    // Erases the rows, acked when the last one is done
 };
+
+/** reply status codes that do not echo an operation */
+constexpr uint8_t c_replyData           = 0xFC;     // streamed data: item offset LSB, MSB, then the items LSB first
+constexpr uint8_t c_replyCorrupt        = 0xFD;     // a frame failed the CRC check and was dropped
+constexpr uint8_t c_replyOutOfSequence  = 0xFE;     // frame skipped a sequence number, not executed
+constexpr uint8_t c_replyDuplicate      = 0xFF;     // frame was executed before, reply no longer available
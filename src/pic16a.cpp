@@ -3,6 +3,9 @@
 
 #include <iostream>
 #include <algorithm>
+#include <deque>
+#include <array>
+#include <cstring>
 #include "pic16a.h"
 #include "utils.h"
 #include "pgmops.h"
@@ -35,127 +38,454 @@ std::ostream& operator<<(std::ostream &os, const PGMOperation &op)
     case PGMOperation::WritePage:
         os << "WritePage";
         break;                     
+    case PGMOperation::Sync:
+        os << "Sync";
+        break;
+    case PGMOperation::ReadRange:
+        os << "ReadRange";
+        break;
+    case PGMOperation::CrcRange:
+        os << "CrcRange";
+        break;
+    case PGMOperation::BlankCheckRange:
+        os << "BlankCheckRange";
+        break;
+    case PGMOperation::VerifyPage:
+        os << "VerifyPage";
+        break;
+    case PGMOperation::RowErase:
+        os << "RowErase";
+        break;
+    case PGMOperation::EnterProgModeWithPGM:
+        os << "EnterProgModeWithPGM";
+        break;
+    case PGMOperation::ExitProgModeWithPGM:
+        os << "ExitProgModeWithPGM";
+        break;
+    default:
+        os << "0x" << std::hex << static_cast<uint16_t>(op) << std::dec;
+        break;
     }
     return os;
 }
 
-void PIC16A::writeCommand(PGMOperation op, bool verbose)
+Serial::FrameResult PIC16A::readReply(uint8_t seq, uint8_t *reply, size_t replyMax)
 {
-    m_serial->write(op);
-    m_serial->write(0x00);  // length
-    auto resultOpt = m_serial->read();
-    if (!resultOpt)
+    auto deadline = Serial::deadlineFromNow();
+    bool sawCorrupt = false;
+    while(true)
     {
-        std::cerr << "No response to cmd " << op << "\n";
-        return;
-    }
-    else
-    {
-        if (resultOpt.value() & 0x80)
+        auto result = m_serial->readFrame(reply, replyMax, deadline);
+        if (result.status == Serial::ReadStatus::Corrupt)
         {
-            if (verbose) std::cout << "CMD " << op << " ok\n";
+            sawCorrupt = true;
+            deadline = std::min(deadline, Serial::deadlineFromNow(c_corruptQuietMs));
+            continue;
         }
-        else
+
+        if (!result.ok())
         {
-            std::cerr << "CMD " << op << " failed! reply=";
-            std::cerr << std::hex << static_cast<uint16_t>(resultOpt.value()) << std::dec << "\n";
+            if (sawCorrupt && (result.status == Serial::ReadStatus::Timeout))
+            {
+                result.status = Serial::ReadStatus::Corrupt;
+            }
+            return result;
+        }
+
+        if ((result.bytes == 0) || (reply[0] == c_replyCorrupt))
+        {
+            result.status = Serial::ReadStatus::Corrupt;
+            return result;
+        }
+
+        if (result.seq == seq)
+        {
+            return result;
         }
+
+        // a reply to an earlier frame: the programmer is still busy with those
+        sawCorrupt = false;
+        deadline = Serial::deadlineFromNow();
     }
 }
 
-void PIC16A::resetPointer()
+std::optional<size_t> PIC16A::transact(PGMOperation op, const uint8_t *args, size_t argsLen,
+    uint8_t *reply, size_t replyMax)
 {
-    writeCommand(PGMOperation::ResetPointer, m_verbose);
+    uint8_t seq = m_serial->writeFrame(op, args, argsLen);
+    for(size_t attempt=0; attempt <= c_maxRetries; attempt++)
+    {
+        m_serial->flush();
+
+        auto result = readReply(seq, reply, replyMax);
+        if (result.ok())
+        {
+            if ((reply[0] == c_replyOutOfSequence) && (op != PGMOperation::Sync))
+            {
+                // the programmer lost track of the numbering,
+                // restart it and send the command as a new frame.
+                if (!sync())
+                {
+                    return std::nullopt;
+                }
+                seq = m_serial->writeFrame(op, args, argsLen);
+                continue;
+            }
+
+            return result.bytes;
+        }
+
+        // timeout or corrupted reply
+        if (attempt < c_maxRetries)
+        {
+            if (m_verbose) std::cout << "CMD " << op << " retry " << (attempt+1) << "\n";
+            m_serial->rewriteFrame(seq, op, args, argsLen);
+        }
+    }
+
+    return std::nullopt;
 }
 
-void PIC16A::incPointer(uint8_t number)
+bool PIC16A::command(PGMOperation op, const uint8_t *args, size_t argsLen, uint8_t *data, size_t dataLen)
 {
-    m_serial->write(PGMOperation::PointerIncrement);
-    m_serial->write(0x01);  // length
-    m_serial->write(number);
-    
-    auto resultOpt = m_serial->read();
-    if ((!resultOpt) || (!(resultOpt.value() & 0x80)))
+    std::array<uint8_t, Framing::c_maxBodySize> reply;
+    auto replyLenOpt = transact(op, args, argsLen, reply.data(), reply.size());
+    if (!replyLenOpt)
     {
-        std::cerr << "CMD PointerIncrement failed - reply=";
-        std::cerr << std::hex << static_cast<uint16_t>(resultOpt.value()) << std::dec << "\n";
+        std::cerr << "No response to cmd " << op << "\n";
+        return false;
     }
-    else
+
+    if ((reply.at(0) != (static_cast<uint8_t>(op) | 0x80)) || (replyLenOpt.value() != (dataLen + 1)))
+    {
+        std::cerr << "CMD " << op << " failed! reply=";
+        std::cerr << std::hex << static_cast<uint16_t>(reply.at(0)) << std::dec << "\n";
+        return false;
+    }
+
+    if (dataLen > 0)
     {
-        if (m_verbose) std::cout << "CMD PointerIncrement ok!\n";
+        memcpy(data, &reply.at(1), dataLen);
     }
 
+    if (m_verbose) std::cout << "CMD " << op << " ok\n";
+    return true;
+}
+
+void PIC16A::discardReplies()
+{
+    std::array<uint8_t, Framing::c_maxBodySize> reply;
+    while(true)
+    {
+        auto result = m_serial->readFrame(reply.data(), reply.size(), Serial::deadlineFromNow(c_corruptQuietMs));
+        if ((result.status != Serial::ReadStatus::Ok) && (result.status != Serial::ReadStatus::Corrupt))
+        {
+            return;
+        }
+    }
+}
+
+bool PIC16A::sync()
+{
+    std::array<uint8_t, Framing::c_maxBodySize> reply;
+    auto replyLenOpt = transact(PGMOperation::Sync, nullptr, 0, reply.data(), reply.size());
+    return replyLenOpt && (reply.at(0) == (static_cast<uint8_t>(PGMOperation::Sync) | 0x80));
+}
+
+void PIC16A::writeCommand(PGMOperation op)
+{
+    command(op);
+}
+
+void PIC16A::resetPointer()
+{
+    writeCommand(PGMOperation::ResetPointer);
+}
+
+void PIC16A::incPointer(uint8_t number)
+{
+    command(PGMOperation::PointerIncrement, &number, 1);
 }
 
 void PIC16A::massErase()
 {
     resetPointer();
-    writeCommand(PGMOperation::MassErasePIC16A, m_verbose);
+    writeCommand(PGMOperation::MassErasePIC16A);
 }
 
 void PIC16A::loadConfig()
 {
-    writeCommand(PGMOperation::LoadConfig, m_verbose);
+    writeCommand(PGMOperation::LoadConfig);
 }
 
-bool PIC16A::writePage(const std::vector<uint8_t> &data)
+bool PIC16A::writePage(std::span<const uint8_t> data)
 {
-    if ((data.size() % 2) == 1)
+    if (((data.size() % 2) == 1) || ((data.size() + 2) > 255))
     {
         // data must be an even number of bytes!
         return false;
     }
 
-    auto payloadBytes = data.size() + 2;
-    m_serial->write(PGMOperation::WritePage);
-    m_serial->write(payloadBytes);
-    m_serial->write(data.size()/2); // number of words, not bytes.
-    m_serial->write(1);             // speed, 1 = slow, 0 = fast ?
-    
-    m_serial->write(data);
+    std::array<uint8_t, 255> args;
+    args.at(0) = data.size()/2;     // number of words, not bytes.
+    args.at(1) = 1;                 // speed, 1 = slow, 0 = fast ?
+    std::copy(data.begin(), data.end(), args.begin() + 2);
+
+    return command(PGMOperation::WritePage, args.data(), data.size() + 2);
+}
 
-    auto resultOpt = m_serial->read();
-    if ((!resultOpt) || (!(resultOpt.value() & 0x80)))
+void PIC16A::sendPage(PendingPage &page, bool resend)
+{
+    std::array<uint8_t, 255> args;
+    args.at(0) = page.pageSeq;
+    args.at(1) = page.bytes/2;      // number of words, not bytes.
+    args.at(2) = 1;                 // speed, 1 = slow, 0 = fast ?
+    args.at(3) = page.address & 0xFF;
+    args.at(4) = page.address >> 8;
+    std::copy(page.data, page.data + page.bytes, args.begin() + 5);
+
+    if (resend)
+    {
+        m_serial->rewriteFrame(page.frameSeq, PGMOperation::WritePageSeq, args.data(), page.bytes + 5);
+    }
+    else
+    {
+        page.frameSeq = m_serial->writeFrame(PGMOperation::WritePageSeq, args.data(), page.bytes + 5);
+    }
+    m_serial->flush();
+}
+
+PIC16A::AckResult PIC16A::waitPageAck(const PendingPage &page)
+{
+    std::array<uint8_t, Framing::c_maxBodySize> reply;
+    auto result = readReply(page.frameSeq, reply.data(), reply.size());
+    if (!result.ok())
+    {
+        return AckResult::Retry;
+    }
+
+    switch(reply.at(0))
+    {
+    case c_replyDuplicate:
+        // executed before, the reply got lost
+        return AckResult::Ok;
+    case c_replyOutOfSequence:
+        // an earlier page in the window got lost
+        return AckResult::Retry;
+    case static_cast<uint8_t>(PGMOperation::WritePageSeq) | 0x80:
+        if ((result.bytes == 2) && (reply.at(1) == page.pageSeq))
+        {
+            if (m_verbose) std::cout << "CMD WritePageSeq ok\n";
+            return AckResult::Ok;
+        }
+        [[fallthrough]];
+    default:
+        std::cerr << "CMD WritePageSeq failed for page " << static_cast<int>(page.pageSeq);
+        std::cerr << " reply=" << std::hex << static_cast<uint16_t>(reply.at(0)) << std::dec << "\n";
+        return AckResult::Failed;
+    }
+}
+
+bool PIC16A::readPage(std::span<uint8_t> dest)
+{
+    if (((dest.size() & 1) != 0) || (dest.size() > 254))
     {
-        std::cout << "CMD WritePage failed\n";
         return false;
     }
-    
-    if (m_verbose) std::cout << "CMD WritePage ok\n";
+
+    const uint8_t numberOfWords = dest.size()/2;
+    return command(PGMOperation::ReadPage, &numberOfWords, 1, dest.data(), dest.size());
+}
+
+bool PIC16A::seekPointer(size_t address)
+{
+    if (!command(PGMOperation::ResetPointer))
+    {
+        return false;
+    }
+
+    while(address > 0)
+    {
+        const uint8_t step = std::min<size_t>(address, 255);
+        if (!command(PGMOperation::PointerIncrement, &step, 1))
+        {
+            return false;
+        }
+        address -= step;
+    }
     return true;
 }
 
-std::vector<uint8_t> PIC16A::readPage(uint8_t numberOfWords)
+std::optional<size_t> PIC16A::receiveStream(PGMOperation op, uint8_t seq, const ItemRange &range,
+    size_t itemBytes, uint8_t *dest, std::vector<ItemRange> &missing)
 {
-    const auto numberOfBytes = numberOfWords*2;
+    std::array<uint8_t, Framing::c_maxBodySize> reply;
+
+    size_t next = 0;        // offset of the first item not seen yet
+    size_t received = 0;
+    while(true)
+    {
+        auto result = readReply(seq, reply.data(), reply.size());
+        if (!result.ok())
+        {
+            break;  // the stream stopped, ask for the rest again
+        }
 
-    m_serial->write(PGMOperation::ReadPage);
-    m_serial->write(0x01);
-    m_serial->write(numberOfWords);
-    auto resultOpt = m_serial->read();
-    if (!resultOpt)
+        if ((reply.at(0) == c_replyData) && (result.bytes > 3) && (((result.bytes - 3) % itemBytes) == 0))
+        {
+            const size_t offset = reply.at(1) | (static_cast<size_t>(reply.at(2)) << 8);
+            const size_t items  = (result.bytes - 3) / itemBytes;
+            if ((offset < next) || ((offset + items) > range.count))
+            {
+                continue;
+            }
+
+            // a data frame got lost in between
+            if (offset > next)
+            {
+                missing.push_back({range.first + next, offset - next, 0});
+            }
+
+            memcpy(dest + offset*itemBytes, &reply.at(3), items*itemBytes);
+            next = offset + items;
+            received += items;
+            continue;
+        }
+
+        if (reply.at(0) != (static_cast<uint8_t>(op) | 0x80))
+        {
+            std::cerr << "CMD " << op << " failed! reply=";
+            std::cerr << std::hex << static_cast<uint16_t>(reply.at(0)) << std::dec << "\n";
+            return std::nullopt;
+        }
+        break;
+    }
+
+    if (next < range.count)
     {
-        return std::vector<uint8_t>();
+        missing.push_back({range.first + next, range.count - next, 0});
     }
-    if (resultOpt.value() != (static_cast<uint8_t>(PGMOperation::ReadPage) | 0x80))
+
+    return received;
+}
+
+template<typename Request>
+bool PIC16A::streamItems(PGMOperation op, size_t count, size_t maxCount, 
+    size_t itemBytes, uint8_t *dest, Request &&request)
+{
+    // the range lists keep their capacity between calls, so a
+    // download does not allocate once the first one has been done.
+    auto &todo = m_streamTodo;
+    todo.clear();
+    for(size_t first = 0; first < count; first += maxCount)
     {
-        return std::vector<uint8_t>();
+        todo.push_back({first, std::min(count - first, maxCount), 0});
     }
 
-    std::vector<uint8_t> page(numberOfBytes, 0);
-    for(uint8_t i=0; i<numberOfBytes; i++)
+    while(!todo.empty())
     {
-        auto optByte = m_serial->read();
-        if (optByte.has_value())
+        const auto range = todo.front();
+        todo.erase(todo.begin());
+
+        auto seq = request(range.first, range.count);
+        if (!seq)
         {
-            page.at(i) = optByte.value();
+            return false;
         }
-        else
+
+        auto &missing = m_streamMissing;
+        missing.clear();
+        auto received = receiveStream(op, seq.value(), range, itemBytes, dest + range.first*itemBytes, missing);
+        if (!received)
         {
-            return std::vector<uint8_t>();
+            return false;
+        }
+
+        // a range that keeps failing without any progress is given up
+        const size_t tries = (received.value() > 0) ? 0 : range.tries + 1;
+        if (tries > c_maxRetries)
+        {
+            std::cerr << "CMD " << op << ": too many retries\n";
+            return false;
+        }
+
+        for(auto &m : missing)
+        {
+            m.tries = tries;
+            m_serial->countRetry();
+            todo.push_back(m);
         }
     }
-    return page;
+
+    if (m_verbose) std::cout << "CMD " << op << " ok\n";
+    return true;
+}
+
+bool PIC16A::readRange(size_t address, size_t words, uint8_t *dest)
+{
+    return streamItems(PGMOperation::ReadRange, words, 0xFFFF, 2, dest, 
+        [this, address](size_t first, size_t count) -> std::optional<uint8_t>
+        {
+            if (!seekPointer(address + first))
+            {
+                return std::nullopt;
+            }
+
+            const std::array<uint8_t, 2> args = 
+            {
+                static_cast<uint8_t>(count & 0xFF), 
+                static_cast<uint8_t>(count >> 8)
+            };
+
+            const uint8_t seq = m_serial->writeFrame(PGMOperation::ReadRange, args.data(), args.size());
+            m_serial->flush();
+            return seq;
+        }
+    );
+}
+
+std::optional<std::vector<uint32_t> > PIC16A::readCrcs(size_t address, size_t blocks, size_t blockWords)
+{
+    if ((blockWords == 0) || (blockWords > 0xFF))
+    {
+        return std::nullopt;
+    }
+
+    std::vector<uint8_t> crcBytes(blocks*4);
+    const bool ok = streamItems(PGMOperation::CrcRange, blocks, 0xFFFF / blockWords, 4, crcBytes.data(),
+        [this, address, blockWords](size_t first, size_t count) -> std::optional<uint8_t>
+        {
+            const size_t start = address + first*blockWords;
+            const size_t words = count*blockWords;
+            const std::array<uint8_t, 5> args = 
+            {
+                static_cast<uint8_t>(start & 0xFF), 
+                static_cast<uint8_t>(start >> 8),
+                static_cast<uint8_t>(words & 0xFF), 
+                static_cast<uint8_t>(words >> 8),
+                static_cast<uint8_t>(blockWords)
+            };
+
+            const uint8_t seq = m_serial->writeFrame(PGMOperation::CrcRange, args.data(), args.size());
+            m_serial->flush();
+            return seq;
+        }
+    );
+
+    if (!ok)
+    {
+        return std::nullopt;
+    }
+
+    std::vector<uint32_t> crcs(blocks);
+    for(size_t i=0; i<blocks; i++)
+    {
+        crcs.at(i) = static_cast<uint32_t>(crcBytes.at(4*i))
+            | (static_cast<uint32_t>(crcBytes.at(4*i+1)) << 8)
+            | (static_cast<uint32_t>(crcBytes.at(4*i+2)) << 16)
+            | (static_cast<uint32_t>(crcBytes.at(4*i+3)) << 24);
+    }
+    return crcs;
 }
 
 std::optional<uint16_t> PIC16A::readDeviceId()
@@ -163,9 +493,8 @@ std::optional<uint16_t> PIC16A::readDeviceId()
     //resetPointer();
     loadConfig();
     incPointer(6);
-    auto bytes = readPage(1);
-
-    if (bytes.size() != 2)
+    std::array<uint8_t, 2> bytes;
+    if (!readPage(bytes))
     {
         return std::nullopt;
     }
@@ -174,7 +503,7 @@ std::optional<uint16_t> PIC16A::readDeviceId()
     return result;
 }
 
-bool PIC16A::uploadConfig(const DeviceInfo &info, const std::vector<uint8_t> &config)
+bool PIC16A::uploadConfig(const DeviceInfo &info, std::span<const uint8_t> config)
 {
     if (config.size() != 4)
     {
@@ -186,61 +515,101 @@ bool PIC16A::uploadConfig(const DeviceInfo &info, const std::vector<uint8_t> &co
     loadConfig();
     incPointer(7);
 
-    std::vector<uint8_t> word1;
-    std::vector<uint8_t> word2;
-
-    word1.push_back(config.at(0));
-    word1.push_back(config.at(1));
-    word2.push_back(config.at(2));
-    word2.push_back(config.at(3));
-
-    writePage(word1); // slow write
-    writePage(word2); // slow write
-
-    return true;
+    return writePage(config.subspan(0, 2)) &&   // slow write
+        writePage(config.subspan(2, 2));        // slow write
 }
 
-std::vector<uint8_t> PIC16A::downloadConfig(const DeviceInfo &info)
+bool PIC16A::downloadConfig(const DeviceInfo &info, std::span<uint8_t> dest)
 {
+    if (dest.size() != (info.configSize*2))
+    {
+        return false;
+    }
+
     loadConfig();
     incPointer(0x07);
-    return readPage(info.configSize);
+    return readPage(dest);
 }
 
 void PIC16A::enterProgMode() 
 {
-    writeCommand(PGMOperation::EnterProgMode, m_verbose);
+    writeCommand(PGMOperation::EnterProgMode);
 }
 
 void PIC16A::exitProgMode()
 {
-    writeCommand(PGMOperation::ExitProgMode, m_verbose);
+    writeCommand(PGMOperation::ExitProgMode);
 }
 
-bool PIC16A::uploadFlash(const DeviceInfo &info, const std::vector<uint8_t> &memory)
+bool PIC16A::uploadPages(const DeviceInfo &info, std::span<PendingPage> pages)
 {
-    resetPointer();
-
-    size_t outChars = 0;
-    for(size_t address=0; address < info.flashMemSize; address += info.flashPageSize)
-    {   
-        std::vector<uint8_t> memChunk(memory.begin() + address*2, memory.begin() + (address+info.flashPageSize)*2);
-        
-        if (Utils::isEmptyMem(memChunk))
+    // pages are sent ahead of their replies, up to a window at a time.
+    // when a reply is lost, all pages in the window are sent again;
+    // the firmware recognises the ones it has already programmed.
+    const size_t window = writeWindow(info.flashPageSize*2);
+    std::deque<PendingPage> inFlight;
+    size_t retries = 0;
+
+    auto waitFront = [&]()
+    {
+        while(true)
         {
-            incPointer(info.flashPageSize);
-            std::cout << "." << std::flush;
+            switch(waitPageAck(inFlight.front()))
+            {
+            case AckResult::Ok:
+                inFlight.pop_front();
+                retries = 0;
+                return true;
+            case AckResult::Retry:
+                if (++retries > c_maxRetries)
+                {
+                    std::cerr << "CMD WritePageSeq: too many retries\n";
+                    return false;
+                }
+                // replies to the previous round would count as new failures
+                discardReplies();
+                for(auto &page : inFlight)
+                {
+                    sendPage(page, true);
+                }
+                break;
+            case AckResult::Failed:
+                return false;
+            }
         }
-        else
+    };
+
+    auto drain = [&]()
+    {
+        while(!inFlight.empty())
         {
-            if (!writePage(memChunk))
+            if (!waitFront())
             {
                 return false;
             }
+        }
+        return true;
+    };
 
+    // every page carries its address, so blank pages are simply not sent
+    uint8_t pageSeq = 0;
+    size_t outChars = 0;
+    for(auto &page : pages)
+    {   
+        if ((inFlight.size() >= window) && !waitFront())
+        {
+            return false;
+        }
+
+        page.pageSeq = pageSeq++;
+        sendPage(page, false);
+        inFlight.push_back(page);
+
+        if (m_showProgress)
+        {
             std::cout << "#" << std::flush;
+            outChars++;
         }
-        outChars++;
 
         if (outChars >= 80)
         {
@@ -248,45 +617,231 @@ bool PIC16A::uploadFlash(const DeviceInfo &info, const std::vector<uint8_t> &mem
             outChars = 0;
         }
     }
+    return drain();
+}
+
+bool PIC16A::uploadFlash(const DeviceInfo &info, const MemoryImage &memory)
+{
+    return uploadFlash(info, memory, memory.usedPages());
+}
+
+bool PIC16A::uploadFlash(const DeviceInfo &info, const MemoryImage &memory, std::span<const size_t> pages)
+{
+    std::vector<PendingPage> pending;
+    for(auto index : pages)
+    {
+        if ((index < memory.pageCount()) && !memory.isPageBlank(index))
+        {
+            auto data = memory.page(index);
+            pending.push_back({0, 0, index*memory.pageWords(), data.data(), data.size()});
+        }
+    }
+    return uploadPages(info, pending);
+}
+
+bool PIC16A::eraseRows(const DeviceInfo &info, size_t address, size_t words)
+{
+    // the erase row of the part is not known, only that it is no larger
+    // than the block, so the row holding every page is erased
+    const size_t blockWords = eraseBlockWords(info);
+    const size_t pageWords  = info.flashPageSize;
+    if ((blockWords == 0) || ((address % blockWords) != 0) || ((words % pageWords) != 0) ||
+        ((address + words) > info.flashMemSize))
+    {
+        return false;
+    }
+
+    for(size_t page = 0; page < (words / pageWords); page += c_maxEraseRows)
+    {
+        const size_t start = address + page*pageWords;
+        const std::array<uint8_t, 4> args = 
+        {
+            static_cast<uint8_t>(start & 0xFF), 
+            static_cast<uint8_t>(start >> 8),
+            static_cast<uint8_t>(std::min(words/pageWords - page, c_maxEraseRows)),
+            static_cast<uint8_t>(pageWords)
+        };
+
+        if (!command(PGMOperation::RowErase, args.data(), args.size()))
+        {
+            return false;
+        }
+    }
     return true;
 }
 
+bool PIC16A::uploadFlash(const DeviceInfo &info, std::span<const uint8_t> memory)
+{
+    if (memory.size() != (info.flashMemSize*2))
+    {
+        std::cerr << "Error: uploadFlash requires " << info.flashMemSize*2 << " bytes\n";
+        return false;
+    }
+
+    std::vector<PendingPage> pages;
+    const size_t pageBytes = info.flashPageSize*2;
+    for(size_t start = 0; start < memory.size(); start += pageBytes)
+    {
+        auto data = memory.subspan(start, std::min(pageBytes, memory.size() - start));
+        if (!Utils::isEmptyMem(data))
+        {
+            pages.push_back({0, 0, start/2, data.data(), data.size()});
+        }
+    }
+    return uploadPages(info, pages);
+}
+
 /** Download from flash */
-std::vector<uint8_t> PIC16A::downloadFlash(const DeviceInfo &info)
+bool PIC16A::downloadFlash(const DeviceInfo &info, std::span<uint8_t> dest)
 {
-    std::vector<uint8_t> flashContents;
-    resetPointer();
-    for(size_t address=0; address < info.flashMemSize; address += info.flashPageSize)
+    return downloadFlash(info, 0, dest);
+}
+
+bool PIC16A::downloadFlash(const DeviceInfo &info, size_t address, std::span<uint8_t> dest)
+{
+    const size_t words = dest.size() / 2;
+    if (((dest.size() & 1) != 0) || ((address + words) > info.flashMemSize))
     {
-        auto page = readPage(info.flashPageSize);
-        if (page.empty())
+        return false;
+    }
+
+    return readRange(address, words, dest.data());
+}
+
+std::optional<std::vector<FlashMismatch> > PIC16A::verifyFlash(const DeviceInfo &info, 
+    const MemoryImage &memory, size_t address, size_t words)
+{
+    if (((address + words) > info.flashMemSize) || ((address + words) > memory.sizeWords()))
+    {
+        return std::nullopt;
+    }
+
+    std::vector<FlashMismatch> mismatches;
+    std::array<uint8_t, 2 + 2*c_maxVerifyWords> args;
+    std::array<uint8_t, Framing::c_maxBodySize> reply;
+    for(size_t offset = 0; offset < words; offset += c_maxVerifyWords)
+    {
+        const size_t start = address + offset;
+        const size_t count = std::min(words - offset, c_maxVerifyWords);
+        args.at(0) = start & 0xFF;
+        args.at(1) = start >> 8;
+        for(size_t i=0; i<count; i++)
+        {
+            const uint16_t word = memory.word(start + i);
+            args.at(2 + 2*i) = word & 0xFF;
+            args.at(3 + 2*i) = word >> 8;
+        }
+
+        auto replyLenOpt = transact(PGMOperation::VerifyPage, args.data(), 2 + count*2, 
+            reply.data(), reply.size());
+
+        if (!replyLenOpt)
         {
-            return std::vector<uint8_t>();  // error
+            std::cerr << "No response to cmd " << PGMOperation::VerifyPage << "\n";
+            return std::nullopt;
         }
 
-        flashContents.insert(flashContents.end(), page.begin(), page.end());
+        const size_t replyLen = replyLenOpt.value();
+        if ((reply.at(0) != (static_cast<uint8_t>(PGMOperation::VerifyPage) | 0x80))
+            || (replyLen < 2) || (replyLen != (2 + 3*static_cast<size_t>(reply.at(1)))))
+        {
+            std::cerr << "CMD " << PGMOperation::VerifyPage << " failed! reply=";
+            std::cerr << std::hex << static_cast<uint16_t>(reply.at(0)) << std::dec << "\n";
+            return std::nullopt;
+        }
+
+        for(size_t i=0; i<reply.at(1); i++)
+        {
+            const uint8_t *entry = &reply.at(2 + 3*i);
+            const size_t wordAddress = start + entry[0];
+            mismatches.push_back(
+                {
+                    wordAddress,
+                    memory.word(wordAddress),
+                    static_cast<uint16_t>(entry[1] | (static_cast<uint16_t>(entry[2]) << 8))
+                }
+            );
+        }
     }
 
-    return flashContents;
+    if (m_verbose) std::cout << "CMD " << PGMOperation::VerifyPage << " ok\n";
+    return mismatches;
 }
 
+std::vector<uint32_t> PIC16A::readPageCrcs(const DeviceInfo &info)
+{
+    auto crcs = readCrcs(0, info.flashMemSize / info.flashPageSize, info.flashPageSize);
+    if (!crcs)
+    {
+        return std::vector<uint32_t>();
+    }
+    return crcs.value();
+}
 
-bool PIC16A::isDeviceBlank(const DeviceInfo &info)
+bool PIC16A::blankCheckRange(size_t address, size_t words, std::optional<NonBlankWord> &nonBlank)
 {
-    resetPointer();
-    for(size_t address=0; address < info.flashMemSize; address += info.flashPageSize)
+    std::array<uint8_t, Framing::c_maxBodySize> reply;
+
+    nonBlank.reset();
+    for(size_t offset = 0; offset < words; offset += c_blankCheckWords)
     {
-        auto page = readPage(info.flashPageSize);
-        if (page.size() == 0)
+        const size_t start = address + offset;
+        const size_t count = std::min(words - offset, c_blankCheckWords);
+        const std::array<uint8_t, 4> args = 
         {
-            std::cout << "Could not read page\n";
+            static_cast<uint8_t>(start & 0xFF), 
+            static_cast<uint8_t>(start >> 8),
+            static_cast<uint8_t>(count & 0xFF), 
+            static_cast<uint8_t>(count >> 8)
+        };
+
+        auto replyLenOpt = transact(PGMOperation::BlankCheckRange, args.data(), args.size(), 
+            reply.data(), reply.size());
+
+        if (!replyLenOpt)
+        {
+            std::cerr << "No response to cmd " << PGMOperation::BlankCheckRange << "\n";
             return false;
         }
-        if (!Utils::isEmptyMem(page))
+
+        const bool ok = reply.at(0) == (static_cast<uint8_t>(PGMOperation::BlankCheckRange) | 0x80);
+        if (ok && (replyLenOpt.value() == 5))
         {
-            std::cout << "### Warning: uC is not blank! ###\n";
+            nonBlank = NonBlankWord
+            {
+                reply.at(1) | (static_cast<size_t>(reply.at(2)) << 8),
+                static_cast<uint16_t>(reply.at(3) | (static_cast<uint16_t>(reply.at(4)) << 8))
+            };
+            return true;
+        }
+
+        if (!ok || (replyLenOpt.value() != 1))
+        {
+            std::cerr << "CMD " << PGMOperation::BlankCheckRange << " failed! reply=";
+            std::cerr << std::hex << static_cast<uint16_t>(reply.at(0)) << std::dec << "\n";
             return false;
         }
-    }    
+    }
+
+    if (m_verbose) std::cout << "CMD " << PGMOperation::BlankCheckRange << " ok\n";
+    return true;
+}
+
+bool PIC16A::isDeviceBlank(const DeviceInfo &info)
+{
+    std::optional<NonBlankWord> nonBlank;
+    if (!blankCheckRange(0, info.flashMemSize, nonBlank))
+    {
+        std::cout << "Could not read flash\n";
+        return false;
+    }
+
+    if (nonBlank)
+    {
+        std::cout << "### Warning: uC is not blank! ###\n";
+        std::cout << "  address " << Utils::toHex(nonBlank->address) << " holds ";
+        std::cout << Utils::toHex(nonBlank->word) << "\n";
+        return false;
+    }
     return true;
 }
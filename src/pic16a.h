@@ -13,17 +13,39 @@ public:
     
     std::optional<uint16_t> readDeviceId() override;
 
+    using IDeviceProgrammer::downloadFlash;
+    using IDeviceProgrammer::downloadConfig;
+
     /** Upload configuration bits */
-    bool uploadConfig(const DeviceInfo &info, const std::vector<uint8_t> &config) override;
+    bool uploadConfig(const DeviceInfo &info, std::span<const uint8_t> config) override;
 
     /** Download configuration bits */
-    std::vector<uint8_t> downloadConfig(const DeviceInfo &info) override;
+    bool downloadConfig(const DeviceInfo &info, std::span<uint8_t> dest) override;
 
     /** Upload to flash */
-    bool uploadFlash(const DeviceInfo &info, const std::vector<uint8_t> &memory) override;
+    bool uploadFlash(const DeviceInfo &info, const MemoryImage &memory) override;
+
+    /** Upload some pages of an image */
+    bool uploadFlash(const DeviceInfo &info, const MemoryImage &memory, std::span<const size_t> pages) override;
+
+    /** Upload to flash from a full size image */
+    bool uploadFlash(const DeviceInfo &info, std::span<const uint8_t> memory) override;
 
     /** Download from flash */
-    std::vector<uint8_t> downloadFlash(const DeviceInfo &info) override;
+    bool downloadFlash(const DeviceInfo &info, std::span<uint8_t> dest) override;
+
+    /** Download part of the flash */
+    bool downloadFlash(const DeviceInfo &info, size_t address, std::span<uint8_t> dest) override;
+
+    /** Compare flash against memory on the programmer */
+    std::optional<std::vector<FlashMismatch> > verifyFlash(const DeviceInfo &info, 
+        const MemoryImage &memory, size_t address, size_t words) override;
+
+    /** CRC-32 of each flash page */
+    std::vector<uint32_t> readPageCrcs(const DeviceInfo &info) override;
+
+    /** erase flash rows */
+    bool eraseRows(const DeviceInfo &info, size_t address, size_t words) override;
 
     /** check if the device is blank */
     bool isDeviceBlank(const DeviceInfo &info) override;
@@ -32,13 +54,159 @@ public:
     void exitProgMode() override;
 
 protected:
+    /** a WritePageSeq frame that has been sent but not acknowledged */
+    struct PendingPage
+    {
+        uint8_t         frameSeq;   ///< sequence number of the frame
+        uint8_t         pageSeq;    ///< sequence number in the WritePageSeq payload
+        size_t          address;    ///< word address of the page
+        const uint8_t  *data;
+        size_t          bytes;
+    };
+
+    /** a range of streamed items: flash words or CRC blocks */
+    struct ItemRange
+    {
+        size_t first;
+        size_t count;
+        size_t tries;   ///< attempts that did not make any progress
+    };
+
+    /** the first word found by a blank check that is not blank */
+    struct NonBlankWord
+    {
+        size_t   address;
+        uint16_t word;
+    };
+
+    enum class AckResult
+    {
+        Ok,
+        Retry,      ///< reply lost or corrupted, send the window again
+        Failed
+    };
+
     void resetPointer();
     void incPointer(uint8_t number);
 
-    bool                    writePage(const std::vector<uint8_t> &data);
-    std::vector<uint8_t>    readPage(uint8_t num);
+    bool                    writePage(std::span<const uint8_t> data);
+
+    /** program pages with WritePageSeq, keeping a window of them in flight.
+        The pages need their address, data and size set.
+    */
+    bool                    uploadPages(const DeviceInfo &info, std::span<PendingPage> pages);
+
+    /** send a WritePageSeq frame without waiting for the reply.
+        When resend is true the frame is sent with its original sequence number.
+    */
+    void                    sendPage(PendingPage &page, bool resend);
+
+    /** wait for the reply to a page sent by sendPage */
+    AckResult               waitPageAck(const PendingPage &page);
+
+    /** read dest.size()/2 words into dest */
+    bool                    readPage(std::span<uint8_t> dest);
+
+    /** move the pointer to a flash word address */
+    bool                    seekPointer(size_t address);
+
+    /** read a range of flash words, streamed by the programmer.
+        dest must hold words*2 bytes.
+    */
+    bool                    readRange(size_t address, size_t words, uint8_t *dest);
+
+    /** CRC-32 of blocks of blockWords flash words, computed by the programmer */
+    std::optional<std::vector<uint32_t> > readCrcs(size_t address, size_t blocks, size_t blockWords);
+
+    /** check a range of flash words on the programmer, stopping at the first
+        word that is not blank. returns false if the check could not be done.
+    */
+    bool                    blankCheckRange(size_t address, size_t words, 
+                                std::optional<NonBlankWord> &nonBlank);
+
+    /** fetch count items of itemBytes each, in requests of at most maxCount items.
+        Items lost on the way are asked for again, from the first missing one.
+        request(first, count) sends the request for a range of items and returns
+        its frame sequence number, or nullopt on error.
+    */
+    template<typename Request>
+    bool                    streamItems(PGMOperation op, size_t count, size_t maxCount, 
+                                size_t itemBytes, uint8_t *dest, Request &&request);
+
+    /** receive the data frames of one streaming request. Ranges that did not
+        arrive are added to missing. returns the number of items received.
+    */
+    std::optional<size_t>   receiveStream(PGMOperation op, uint8_t seq, const ItemRange &range,
+                                size_t itemBytes, uint8_t *dest, std::vector<ItemRange> &missing);
     
     void loadConfig();
 
-    void writeCommand(PGMOperation op, bool verbose);
+    void writeCommand(PGMOperation op);
+
+    /** send a command frame and wait for the reply with the same sequence number.
+        Lost or corrupted frames are sent again with the same sequence number;
+        the firmware replays the reply of a command it has already executed.
+        reply receives the status byte followed by the reply data.
+        returns the number of reply bytes.
+    */
+    std::optional<size_t> transact(PGMOperation op, const uint8_t *args, size_t argsLen,
+        uint8_t *reply, size_t replyMax);
+
+    /** send a command and check that it succeeded. The reply data, if any,
+        must be exactly dataLen bytes and is copied to data.
+    */
+    bool command(PGMOperation op, const uint8_t *args = nullptr, size_t argsLen = 0, 
+        uint8_t *data = nullptr, size_t dataLen = 0);
+
+    /** wait for a reply frame with the given sequence number, or a c_replyCorrupt frame.
+        Replies to earlier frames extend the wait because ours is queued behind them.
+        After a corrupted frame the wait ends when the line goes quiet, since the 
+        corrupted frame might have been our reply.
+    */
+    Serial::FrameResult readReply(uint8_t seq, uint8_t *reply, size_t replyMax);
+
+    /** drop incoming frames until the line has been quiet for c_corruptQuietMs */
+    void discardReplies();
+
+    /** restart the frame sequence numbering */
+    bool sync();
+
+    /** ranges still to be fetched by streamItems, kept to avoid allocations */
+    std::vector<ItemRange> m_streamTodo;
+    std::vector<ItemRange> m_streamMissing;
+
+    /** number of times a frame is sent again before giving up */
+    constexpr static size_t c_maxRetries = 3;
+
+    /** quiet time after a corrupted frame before a frame is sent again */
+    constexpr static int c_corruptQuietMs = 50;
+
+    /** maximum number of WritePageSeq frames sent but not yet acked.
+        One frame is being handled by the firmware, the others must
+        fit in its receive ring buffer (UART::c_rxBufferSize).
+    */
+    constexpr static size_t c_maxWriteWindow = 3;
+
+    /** words per BlankCheckRange request, so the reply arrives 
+        well within Serial::c_defaultTimeoutMs at ICSP speed
+    */
+    constexpr static size_t c_blankCheckWords = 2048;
+
+    /** rows per RowErase request, so the reply arrives well within
+        Serial::c_defaultTimeoutMs at 2.5 ms per row
+    */
+    constexpr static size_t c_maxEraseRows = 128;
+
+    /** words per VerifyPage request, see MessageHandler::c_maxVerifyWords */
+    constexpr static size_t c_maxVerifyWords = 64;
+    constexpr static size_t c_programmerRxBufferSize = 256;
+
+    /** number of pages that can be in flight for a given page size in bytes */
+    static constexpr size_t writeWindow(size_t pageBytes) noexcept
+    {
+        // opcode, length, seq, words, speed, address, frame trailer and delimiter
+        const size_t frameBytes = Framing::maxEncodedSize(pageBytes + 7 + Framing::c_trailerSize) + 1;
+        const size_t window = 1 + (c_programmerRxBufferSize / frameBytes);
+        return (window < c_maxWriteWindow) ? window : c_maxWriteWindow;
+    }
 };
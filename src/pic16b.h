@@ -10,5 +10,5 @@ class PIC16B : public PIC16A
 public:
     PIC16B(std::shared_ptr<Serial> serial) : PIC16A(serial) {}
 
-    bool uploadConfig(const DeviceInfo &info, const std::vector<uint8_t> &config) override;
+    bool uploadConfig(const DeviceInfo &info, std::span<const uint8_t> config) override;
 };
@@ -9,11 +9,11 @@ void PIC16PGM_A::massErase()
 
 void PIC16PGM_A::enterProgMode() 
 {
-    writeCommand(PGMOperation::EnterProgModeWithPGM, m_verbose);
+    writeCommand(PGMOperation::EnterProgModeWithPGM);
 }
 
 void PIC16PGM_A::exitProgMode()
 {
-    writeCommand(PGMOperation::ExitProgModeWithPGM, m_verbose);
+    writeCommand(PGMOperation::ExitProgModeWithPGM);
 }
 
@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include <iostream>
+#include <string>
+#include <csignal>
+
+#include "contrib/cxxopts.hpp"
+#include "utils.h"
+#include "daemon.h"
+
+static Daemon *g_daemon = nullptr;
+
+static void onSignal(int)
+{
+    if (g_daemon != nullptr)
+    {
+        g_daemon->stop();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::string socketPath;
+    std::string comName;
+    uint32_t baudrate;
+    bool verbose;
+    bool noCache;
+
+    std::cout << "--== PICMEUPD version 0.1a ==--\n\n";
+    try
+    {
+        cxxopts::Options options(argv[0], "keeps programmers open and runs the jobs of picmeup --daemon");
+
+        options
+            .set_width(70)
+            .add_options()
+            ("s,socket","Unix domain socket to listen on", cxxopts::value<std::string>(socketPath)->default_value(Daemon::defaultSocketPath()))
+            ("p,port",  "serial ports to open at startup, separated by commas", cxxopts::value<std::string>(comName))
+            ("b,baud",  "serial link baud rate of the ports opened at startup", cxxopts::value<uint32_t>(baudrate)->default_value("57600"))
+            ("verbose","Verbose output", cxxopts::value<bool>(verbose)->default_value("false"))
+            ("nocache","Always parse the HEX file, do not use the image cache", cxxopts::value<bool>(noCache)->default_value("false"))
+            ("h, help", "Print help");
+
+        auto result = options.parse(argc, argv);
+
+        if (result.count("help"))
+        {
+            std::cout << options.help() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    catch(const cxxopts::OptionException& e)
+    {
+        std::cerr << "Error parsing options: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    Daemon daemon(!noCache);
+    if (!daemon.listen(socketPath))
+    {
+        return EXIT_FAILURE;
+    }
+
+    // the Arduinos reset when their port is opened, so do that now
+    SessionLog log{std::cout, std::cerr, verbose};
+    for(auto const &port : Utils::tokenize(comName, ','))
+    {
+        if (daemon.openPort(port, baudrate, log))
+        {
+            std::cout << "Programmer on " << port << " is ready\n";
+        }
+    }
+
+    g_daemon = &daemon;
+    signal(SIGINT,  onSignal);
+    signal(SIGTERM, onSignal);
+
+    std::cout << "Waiting for jobs on " << socketPath << "\n";
+    daemon.run();
+
+    std::cout << "Done.\n";
+    return EXIT_SUCCESS;
+}
@@ -3,7 +3,13 @@
 
 #include "serial.h"
 #include <cstdio>
+#include <algorithm>
+#include <fcntl.h>          // Contains file controls like O_RDWR
+#include <errno.h>          // Error integer and strerror() function
+#include <unistd.h>         // write(), read(), close()
+#include <sys/ioctl.h>
 #include <sys/poll.h>
+#include <asm/termbits.h>   // termios2 for non-standard baud rates
 
 #ifdef _DEBUG
 
@@ -29,47 +35,459 @@ void Serial::debugTX(uint8_t b)
 
 #endif
 
+namespace
+{
+    /** the standard rates that have a Bxxx constant */
+    struct BaudRateConstant
+    {
+        uint32_t baudrate;
+        speed_t  constant;
+    };
+
+    constexpr BaudRateConstant c_standardRates[] =
+    {
+        {9600,    B9600},
+        {19200,   B19200},
+        {38400,   B38400},
+        {57600,   B57600},
+        {115200,  B115200},
+        {230400,  B230400},
+        {460800,  B460800},
+        {500000,  B500000},
+        {921600,  B921600},
+        {1000000, B1000000},
+        {2000000, B2000000}
+    };
+};
+
+std::shared_ptr<Serial> Serial::open(const std::string &portname, uint32_t baudrate)
+{
+    int serialPortHandle = ::open(portname.c_str(), O_RDWR | O_NOCTTY | O_NDELAY);
+    if (serialPortHandle < 0)
+    {
+        return nullptr;
+    }
+
+    fcntl(serialPortHandle, F_SETFL, 0);
+
+    struct termios2 tty;
+    memset (&tty, 0, sizeof(tty));
+
+    if (ioctl(serialPortHandle, TCGETS2, &tty) != 0) 
+    {
+        ::close(serialPortHandle);
+        return nullptr;
+    }
+
+    tty.c_lflag  &=  ~(ICANON | ECHO | ECHOE | ISIG);
+    tty.c_cflag |=  (CLOCAL | CREAD);
+    tty.c_cflag &=  ~PARENB;
+    tty.c_cflag &= ~CSTOPB;
+    tty.c_cflag &=  ~CSIZE;
+    tty.c_cflag |=  CS8;
+    tty.c_oflag &=  ~OPOST;
+    tty.c_iflag &=  ~INPCK;
+    tty.c_iflag &=  ~ICRNL;		//do NOT translate CR to NL
+    tty.c_iflag &=  ~(IXON | IXOFF | IXANY);
+
+    if (ioctl(serialPortHandle, TCSETS2, &tty) != 0) 
+    {
+        ::close(serialPortHandle);
+        return nullptr;
+    }
+
+    auto s = std::shared_ptr<Serial>(new Serial(serialPortHandle));
+    if (!s->setBaudRate(baudrate))
+    {
+        return nullptr;
+    }
+
+    return s;
+}
+
+bool Serial::setBaudRate(uint32_t baudrate)
+{
+    flush();
+
+    struct termios2 tty;
+    if (ioctl(m_serialPortHandle, TCGETS2, &tty) != 0)
+    {
+        return false;
+    }
+
+    tty.c_cflag &= ~CBAUD;
+    tty.c_cflag &= ~(CBAUD << IBSHIFT);
+
+    bool isStandard = false;
+    for(auto const &rate : c_standardRates)
+    {
+        if (rate.baudrate == baudrate)
+        {
+            tty.c_cflag |= rate.constant;
+            tty.c_cflag |= rate.constant << IBSHIFT;
+            isStandard = true;
+            break;
+        }
+    }
+
+    if (!isStandard)
+    {
+        tty.c_cflag |= BOTHER;
+        tty.c_cflag |= BOTHER << IBSHIFT;
+    }
+
+    tty.c_ispeed = baudrate;
+    tty.c_ospeed = baudrate;
+
+    // TCSETSW2 waits until all pending output has been transmitted
+    if (ioctl(m_serialPortHandle, TCSETSW2, &tty) != 0)
+    {
+        return false;
+    }
+
+    ioctl(m_serialPortHandle, TCFLSH, TCIFLUSH);
+    m_rxHead = 0;
+    m_rxTail = 0;
+    m_rxFrameLen = 0;
+    m_rxFrameOverflow = false;
+
+    m_baudRate = baudrate;
+    return true;
+}
+
 Serial::~Serial()
 {
     if (m_serialPortHandle >= 0)
     {
+        flush();
         ::close(m_serialPortHandle);
     }
 }
 
+bool Serial::flush()
+{
+    size_t offset = 0;
+    while(offset < m_txBuffer.size())
+    {
+        auto bytes = ::write(m_serialPortHandle, &m_txBuffer[offset], m_txBuffer.size() - offset);
+        m_stats.txSyscalls++;
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            if (errno == EAGAIN)
+            {
+                // non-blocking port with a full output queue: a frame is
+                // a few hundred bytes at most, so this wait is short.
+                struct pollfd fds[1];
+                fds[0].fd = m_serialPortHandle;
+                fds[0].events = POLLOUT;
+                if (poll(fds, 1, c_defaultTimeoutMs) > 0)
+                {
+                    continue;
+                }
+            }
+            m_txBuffer.clear();
+            return false;
+        }
+        offset += bytes;
+    }
+
+    if (offset > 0)
+    {
+        m_stats.txBytes += offset;
+        m_stats.txFrames++;
+    }
+
+    m_txBuffer.clear();
+    return true;
+}
+
 std::optional<uint8_t> Serial::read()
 {
     uint8_t v;
-    int bytes = ::read(m_serialPortHandle, &v, 1);
-    if (bytes != 1)
+    if (!readExact(&v, 1, deadlineFromNow()).ok())
     {
         return std::nullopt;
     }
 
-    debugRX(v);
-
     return v;
 }
 
 std::optional<std::vector<uint8_t> > Serial::read(size_t bytes)
 {
     std::vector<uint8_t> buffer(bytes,0);
-    int rdbytes = ::read(m_serialPortHandle, &buffer[0], buffer.size());
-    if (rdbytes != buffer.size())
+    if (!readExact(buffer.data(), buffer.size(), deadlineFromNow()).ok())
     {
         return std::nullopt;
     }
 
-    for(auto v : buffer)
+    return buffer;
+}
+
+Serial::ReadStatus Serial::fillRxBuffer(Deadline deadline)
+{
+    flush();
+
+    if (m_rxTail == m_rxHead)
     {
-        debugRX(v);
+        m_rxTail = 0;
+        m_rxHead = 0;
     }
-    
-    return buffer;
+
+    while(true)
+    {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+        if (remaining < 0)
+        {
+            return ReadStatus::Timeout;
+        }
+
+        struct pollfd fds[1];
+        fds[0].fd = m_serialPortHandle;
+        fds[0].events = POLLIN;
+
+        int result = poll(fds, 1, static_cast<int>(remaining));
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return ReadStatus::Error;
+        }
+
+        if (result == 0)
+        {
+            return ReadStatus::Timeout;
+        }
+
+        if ((fds[0].revents & POLLIN) == 0)
+        {
+            // POLLERR, POLLHUP or POLLNVAL
+            return ReadStatus::Error;
+        }
+
+        auto bytes = ::read(m_serialPortHandle, &m_rxBuffer[m_rxHead], m_rxBuffer.size() - m_rxHead);
+        m_stats.rxSyscalls++;
+        if (bytes < 0)
+        {
+            if ((errno == EINTR) || (errno == EAGAIN))
+            {
+                continue;
+            }
+            return ReadStatus::Error;
+        }
+        
+        if (bytes == 0)
+        {
+            // end of file: the device has gone away
+            return ReadStatus::Error;
+        }
+
+        for(ssize_t i=0; i<bytes; i++)
+        {
+            debugRX(m_rxBuffer[m_rxHead + i]);
+        }
+
+        m_rxHead += bytes;
+        m_stats.rxBytes += bytes;
+        return ReadStatus::Ok;
+    }
+}
+
+Serial::ReadResult Serial::readExact(uint8_t *buf, size_t n, Deadline deadline)
+{
+    size_t received = 0;
+    while(received < n)
+    {
+        if (rxBuffered() == 0)
+        {
+            auto status = fillRxBuffer(deadline);
+            if (status != ReadStatus::Ok)
+            {
+                return {status, received};
+            }
+        }
+
+        const size_t chunk = std::min(rxBuffered(), n - received);
+        memcpy(buf + received, &m_rxBuffer[m_rxTail], chunk);
+        m_rxTail += chunk;
+        received += chunk;
+    }
+
+    return {ReadStatus::Ok, received};
 }
 
-bool Serial::waitForData(int timeOutMilliSeconds) const
+void Serial::encodeFrame(uint8_t seq, PGMOperation op, const uint8_t *payload, size_t len)
 {
+    std::array<uint8_t, Framing::c_maxRawSize> raw;
+
+    len = std::min<size_t>(len, 255);
+    raw[0] = static_cast<uint8_t>(op);
+    raw[1] = static_cast<uint8_t>(len);
+    if (len > 0)
+    {
+        memcpy(&raw[2], payload, len);
+    }
+    raw[2+len] = seq;
+
+    const auto crc = Framing::crc16(raw.data(), len+3);
+    raw[3+len] = crc & 0xFF;
+    raw[4+len] = crc >> 8;
+
+    Framing::cobsEncode(raw.data(), len+5, [this](uint8_t b)
+        {
+            write(b);
+        }
+    );
+    write(Framing::c_delimiter);
+}
+
+uint8_t Serial::writeFrame(PGMOperation op, const uint8_t *payload, size_t len)
+{
+    const uint8_t seq = m_txSeq++;
+    encodeFrame(seq, op, payload, len);
+    return seq;
+}
+
+void Serial::rewriteFrame(uint8_t seq, PGMOperation op, const uint8_t *payload, size_t len)
+{
+    m_stats.txRetries++;
+    encodeFrame(seq, op, payload, len);
+}
+
+Serial::FrameResult Serial::nextFrame(uint8_t *buf, size_t maxLen)
+{
+    while(rxBuffered() > 0)
+    {
+        const uint8_t b = m_rxBuffer[m_rxTail++];
+        if (b != Framing::c_delimiter)
+        {
+            if (m_rxFrameLen < m_rxFrame.size())
+            {
+                m_rxFrame[m_rxFrameLen++] = b;
+            }
+            else
+            {
+                m_rxFrameOverflow = true;
+            }
+            continue;
+        }
+
+        if ((m_rxFrameLen == 0) && !m_rxFrameOverflow)
+        {
+            continue;   // back-to-back delimiters
+        }
+
+        // end of frame: decode in place and check it
+        const size_t rawLen = m_rxFrameOverflow ? 0 : Framing::cobsDecode(m_rxFrame.data(), m_rxFrameLen, m_rxFrame.data());
+        m_rxFrameLen = 0;
+        m_rxFrameOverflow = false;
+
+        if ((rawLen < (1 + Framing::c_trailerSize)) || ((rawLen - Framing::c_trailerSize) > maxLen))
+        {
+            m_stats.rxCorrupt++;
+            return {ReadStatus::Corrupt, 0, 0};
+        }
+
+        const size_t bodyLen = rawLen - Framing::c_trailerSize;
+        const uint16_t crc = m_rxFrame[bodyLen+1] | (static_cast<uint16_t>(m_rxFrame[bodyLen+2]) << 8);
+        if (Framing::crc16(m_rxFrame.data(), bodyLen+1) != crc)
+        {
+            m_stats.rxCorrupt++;
+            return {ReadStatus::Corrupt, 0, 0};
+        }
+
+        memcpy(buf, m_rxFrame.data(), bodyLen);
+        m_stats.rxFrames++;
+        return {ReadStatus::Ok, m_rxFrame[bodyLen], bodyLen};
+    }
+
+    return {ReadStatus::Timeout, 0, 0};
+}
+
+Serial::FrameResult Serial::readFrame(uint8_t *buf, size_t maxLen, Deadline deadline)
+{
+    while(true)
+    {
+        auto result = nextFrame(buf, maxLen);
+        if (result.status != ReadStatus::Timeout)
+        {
+            return result;
+        }
+
+        auto status = fillRxBuffer(deadline);
+        if (status != ReadStatus::Ok)
+        {
+            return {status, 0, 0};
+        }
+    }
+}
+
+bool Serial::setNonBlocking(bool nonBlocking)
+{
+    int flags = fcntl(m_serialPortHandle, F_GETFL);
+    if (flags < 0)
+    {
+        return false;
+    }
+
+    flags = nonBlocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return fcntl(m_serialPortHandle, F_SETFL, flags) == 0;
+}
+
+Serial::ReadStatus Serial::readAvailable()
+{
+    flush();
+
+    if (m_rxTail == m_rxHead)
+    {
+        m_rxTail = 0;
+        m_rxHead = 0;
+    }
+
+    while(true)
+    {
+        auto bytes = ::read(m_serialPortHandle, &m_rxBuffer[m_rxHead], m_rxBuffer.size() - m_rxHead);
+        m_stats.rxSyscalls++;
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return (errno == EAGAIN) ? ReadStatus::Timeout : ReadStatus::Error;
+        }
+
+        if (bytes == 0)
+        {
+            return ReadStatus::Error;
+        }
+
+        for(ssize_t i=0; i<bytes; i++)
+        {
+            debugRX(m_rxBuffer[m_rxHead + i]);
+        }
+
+        m_rxHead += bytes;
+        m_stats.rxBytes += bytes;
+        return ReadStatus::Ok;
+    }
+}
+
+bool Serial::waitForData(int timeOutMilliSeconds)
+{
+    flush();
+
+    if (rxBuffered() > 0)
+    {
+        return true;
+    }
+
     struct pollfd fds[1];
     fds[0].fd = m_serialPortHandle;
     fds[0].events = POLLIN ;
@@ -90,8 +508,15 @@ bool Serial::waitForData(int timeOutMilliSeconds) const
     return false;
 }
 
-bool Serial::hasData() const
+bool Serial::hasData()
 {
+    flush();
+
+    if (rxBuffered() > 0)
+    {
+        return true;
+    }
+
     struct pollfd fds[1];
     fds[0].fd = m_serialPortHandle;
     fds[0].events = POLLIN ;
@@ -116,19 +541,19 @@ bool Serial::hasData() const
 void Serial::write(PGMOperation op)
 {
     uint8_t opcode = static_cast<uint8_t>(op);
-    ::write(m_serialPortHandle, &opcode, 1);
+    m_txBuffer.push_back(opcode);
     debugTX(opcode);
 }
 
 void Serial::write(uint8_t c)
 {
-    ::write(m_serialPortHandle, &c, 1);
+    m_txBuffer.push_back(c);
     debugTX(c);
 }
 
 void Serial::write(const char *data, size_t len)
 {
-    ::write(m_serialPortHandle, data, len);
+    m_txBuffer.insert(m_txBuffer.end(), data, data + len);
 
     for(size_t i=0; i<len; i++)
     {
@@ -138,7 +563,7 @@ void Serial::write(const char *data, size_t len)
 
 void Serial::write(const uint8_t *data, size_t len)
 {
-    ::write(m_serialPortHandle, data, len);
+    m_txBuffer.insert(m_txBuffer.end(), data, data + len);
     for(size_t i=0; i<len; i++)
     {
         debugTX(data[i]);
@@ -147,7 +572,7 @@ void Serial::write(const uint8_t *data, size_t len)
 
 void Serial::write(const std::vector<uint8_t> &data)
 {
-    ::write(m_serialPortHandle, &data[0], data.size());
+    m_txBuffer.insert(m_txBuffer.end(), data.begin(), data.end());
     
     for(size_t i=0; i<data.size(); i++)
     {
@@ -3,11 +3,6 @@
 
 #pragma once
 
-#include <fcntl.h> // Contains file controls like O_RDWR
-#include <errno.h> // Error integer and strerror() function
-#include <termios.h> // Contains POSIX terminal control definitions
-#include <unistd.h> // write(), read(), close()
-
 #include <cstring>
 #include <cstdlib>
 #include <cstdint>
@@ -17,105 +12,201 @@
 #include <memory>
 #include <utility>
 #include <optional>
+#include <chrono>
+#include <array>
 
 #include "pgmops.h"
+#include "framing.h"
 
 class Serial
 {
 public:
-    Serial() = delete;
+    using Clock    = std::chrono::steady_clock;
+    using Deadline = Clock::time_point;
 
-    virtual ~Serial();
+    /** outcome of a readExact call */
+    enum class ReadStatus : uint8_t
+    {
+        Ok = 0,     ///< all requested bytes were received
+        Timeout,    ///< deadline passed, see ReadResult::bytes for a short read
+        Error,      ///< the port reported an error or was closed
+        Corrupt     ///< a frame failed the COBS, length or CRC check
+    };
 
-    static std::shared_ptr<Serial> open(const std::string &portname, uint32_t baudrate)
+    struct ReadResult
     {
-        int serialPortHandle = ::open("/dev/ttyUSB0", O_RDWR | O_NOCTTY | O_NDELAY);
-        if (serialPortHandle < 0)
+        ReadStatus status;
+        size_t     bytes;       ///< number of bytes actually stored in the buffer
+
+        constexpr bool ok() const noexcept
         {
-            return nullptr;
+            return status == ReadStatus::Ok;
         }
+    };
 
-        fcntl(serialPortHandle, F_SETFL, 0);
-
-        struct termios tty;
-        memset (&tty, 0, sizeof(tty));
+    /** outcome of a readFrame call */
+    struct FrameResult
+    {
+        ReadStatus status;
+        uint8_t    seq;         ///< sequence number of the frame
+        size_t     bytes;       ///< number of bytes stored in the buffer, excluding seq and CRC
 
-        if (tcgetattr(serialPortHandle, &tty) != 0) 
+        constexpr bool ok() const noexcept
         {
-            return nullptr;
-        }
-#if 0 
-        tty.c_cflag &= ~PARENB;     // clear parity bit
-        tty.c_cflag &= ~CSTOPB;     // one stop bit
-        tty.c_cflag &= ~CSIZE;      // clear size bits
-        tty.c_cflag |= CS8;         // 8 bits per byte 
-        tty.c_cflag &= ~CRTSCTS;    // no flow control .. 
-        tty.c_lflag &= ~ICANON;     // disable canonical mode
-        tty.c_lflag &= ~ECHO;       // disable echo
-        tty.c_lflag &= ~ECHOE;      // disable erasure
-        tty.c_lflag &= ~ECHONL;     // disable new-line echo
-        tty.c_lflag &= ~ISIG;       // disable interpretation of INTR, QUIT and SUSP
-        tty.c_iflag &= ~(IXON | IXOFF | IXANY); // Turn off s/w flow ctrl
-        tty.c_iflag &= ~(IGNBRK|BRKINT|PARMRK|ISTRIP|INLCR|IGNCR|ICRNL); // Disable any special handling of received bytes
-
-        tty.c_oflag &= ~OPOST; // Prevent special interpretation of output bytes (e.g. newline chars)
-        tty.c_oflag &= ~ONLCR; // Prevent conversion of newline to carriage return/line feed
-        
-        // tty.c_oflag &= ~OXTABS; // Prevent conversion of tabs to spaces (NOT PRESENT ON LINUX)
-        // tty.c_oflag &= ~ONOEOT; // Prevent removal of C-d chars (0x004) in output (NOT PRESENT ON LINUX)
-
-        tty.c_cc[VTIME] = 10;    // Wait for up to 1s (10 deciseconds), returning as soon as any data is received.
-        tty.c_cc[VMIN] = 0;        
-#else
-        tty.c_lflag  &=  ~(ICANON | ECHO | ECHOE | ISIG);
-        tty.c_cflag |=  (CLOCAL | CREAD);
-        tty.c_cflag &=  ~PARENB;
-        tty.c_cflag &= ~CSTOPB;
-        tty.c_cflag &=  ~CSIZE;
-        tty.c_cflag |=  CS8;
-        tty.c_oflag &=  ~OPOST;
-        tty.c_iflag &=  ~INPCK;
-        tty.c_iflag &=  ~ICRNL;		//do NOT translate CR to NL
-        tty.c_iflag &=  ~(IXON | IXOFF | IXANY);
-#endif
-        int rate = B9600;
-        if (baudrate == 57600)
-        {
-            rate = B57600;
+            return status == ReadStatus::Ok;
         }
+    };
 
-        cfsetispeed(&tty, rate);
-        cfsetospeed(&tty, rate);
+    /** default time allowed for a reply */
+    constexpr static int c_defaultTimeoutMs = 1000;
 
-        if (tcsetattr(serialPortHandle, TCSANOW, &tty) != 0) 
-        {
-            //printf("Error %i from tcsetattr: %s\n", errno, strerror(errno));
-            return nullptr;
-        }
+    static Deadline deadlineFromNow(int milliSeconds = c_defaultTimeoutMs)
+    {
+        return Clock::now() + std::chrono::milliseconds(milliSeconds);
+    }
+
+    Serial() = delete;
+
+    virtual ~Serial();
+
+    /** rate used when the port is opened and the programmer has just reset */
+    constexpr static uint32_t c_defaultBaudRate = 57600;
+
+    /** open a serial port in raw 8N1 mode. Returns nullptr on error. */
+    static std::shared_ptr<Serial> open(const std::string &portname, uint32_t baudrate = c_defaultBaudRate);
 
-        tcflush(serialPortHandle, TCIOFLUSH);
+    /** change the line rate. Standard rates use the Bxxx constants, 
+        others use termios2/BOTHER. Pending output is sent first 
+        and pending input is discarded. 
+    */
+    bool setBaudRate(uint32_t baudrate);
 
-        auto s = new Serial(serialPortHandle);
+    uint32_t baudRate() const noexcept
+    {
+        return m_baudRate;
+    }
 
-        return std::shared_ptr<Serial>(s);
+    /** Transfer statistics, used to measure the cost of the protocol on the wire */
+    struct Stats
+    {
+        size_t txSyscalls = 0;  ///< number of write() calls issued to the kernel
+        size_t txBytes    = 0;  ///< number of bytes sent
+        size_t txFrames   = 0;  ///< number of non-empty flushes, i.e. frames sent
+        size_t rxSyscalls = 0;  ///< number of read() calls issued to the kernel
+        size_t rxBytes    = 0;  ///< number of bytes received
+        size_t rxFrames   = 0;  ///< number of valid frames received
+        size_t rxCorrupt  = 0;  ///< number of frames dropped because of COBS or CRC errors
+        size_t txRetries  = 0;  ///< number of frames sent again by rewriteFrame
     };
 
-    bool waitForData(int timeOutMilliSeconds = 1000) const;
-    bool hasData() const;
+    bool waitForData(int timeOutMilliSeconds = 1000);
+    bool hasData();
     std::optional<uint8_t> read();
     std::optional<std::vector<uint8_t> > read(size_t bytes);
 
+    /** read exactly n bytes into buf, waiting no longer than the deadline.
+        The kernel may deliver fewer bytes per read() than asked, so this
+        loops over poll/read until the buffer is full.
+    */
+    ReadResult readExact(uint8_t *buf, size_t n, Deadline deadline);
+
+    /** the write functions only stage data in the transmit buffer.
+        The buffer is sent by flush() or automatically before any read.
+    */
     void write(PGMOperation op);
     void write(uint8_t c);
     void write(const char *data, size_t len);
     void write(const uint8_t *data, size_t len);
     void write(const std::vector<uint8_t> &data);
 
+    /** encode a request frame (see framing.h) into the transmit buffer,
+        using the next sequence number. returns the sequence number.
+    */
+    uint8_t writeFrame(PGMOperation op, const uint8_t *payload = nullptr, size_t len = 0);
+
+    /** encode a request frame again, with the sequence number it was first sent with */
+    void rewriteFrame(uint8_t seq, PGMOperation op, const uint8_t *payload = nullptr, size_t len = 0);
+
+    /** receive the next valid or corrupt frame. buf receives the reply 
+        body: status and data, without sequence number and CRC.
+    */
+    FrameResult readFrame(uint8_t *buf, size_t maxLen, Deadline deadline);
+
+    /** take the next frame from the bytes already received, without waiting.
+        The status is Timeout when no complete frame has been received.
+    */
+    FrameResult nextFrame(uint8_t *buf, size_t maxLen);
+
+    /** the port file descriptor, for use with poll or epoll */
+    int fd() const noexcept
+    {
+        return m_serialPortHandle;
+    }
+
+    /** switch reads to non-blocking mode, used by event loops */
+    bool setNonBlocking(bool nonBlocking);
+
+    /** read whatever the port has received, without waiting. The port
+        must be in non-blocking mode. The status is Timeout when there
+        was nothing to read.
+    */
+    ReadStatus readAvailable();
+
+    /** send the staged transmit buffer to the port using as few syscalls as possible.
+        returns false if the port reported an error.
+    */
+    bool flush();
+
+    const Stats& stats() const noexcept
+    {
+        return m_stats;
+    }
+
+    /** count a request that is sent again as a new frame */
+    void countRetry() noexcept
+    {
+        m_stats.txRetries++;
+    }
+
+    void resetStats() noexcept
+    {
+        m_stats = Stats{};
+    }
+
 protected:
     void debugRX(uint8_t b);
     void debugTX(uint8_t b);
 
-    Serial(int serialPortHandle) : m_serialPortHandle(serialPortHandle) {}
+    void encodeFrame(uint8_t seq, PGMOperation op, const uint8_t *payload, size_t len);
+
+    /** wait for data and append it to the receive buffer */
+    ReadStatus fillRxBuffer(Deadline deadline);
+
+    size_t rxBuffered() const noexcept
+    {
+        return m_rxHead - m_rxTail;
+    }
+
+    Serial(int serialPortHandle) : m_serialPortHandle(serialPortHandle) 
+    {
+        m_txBuffer.reserve(c_txBufferReserve);
+    }
+
+    constexpr static size_t c_txBufferReserve = 512;
 
     int m_serialPortHandle = -1;
+    uint32_t m_baudRate = 0;
+    std::vector<uint8_t> m_txBuffer;    ///< staged bytes of the frame being built
+    uint8_t m_txSeq = 0;                ///< sequence number of the next frame
+
+    std::array<uint8_t, 1024> m_rxBuffer;   ///< bytes read from the port but not yet consumed
+    size_t m_rxHead = 0;
+    size_t m_rxTail = 0;
+
+    /** encoded bytes of the frame being received */
+    std::array<uint8_t, Framing::maxEncodedSize(Framing::c_maxRawSize)> m_rxFrame;
+    size_t m_rxFrameLen = 0;
+    bool   m_rxFrameOverflow = false;
+
+    Stats m_stats;
 };
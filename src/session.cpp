@@ -0,0 +1,764 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include <algorithm>
+#include <array>
+#include <iomanip>
+#include <unistd.h>
+
+#include "session.h"
+#include "pgmfactory.h"
+#include "devicedb.h"
+#include "utils.h"
+
+/** poll the programmer with Sync frames until it answers.
+    The Arduino resets when the port is opened and the bootloader
+    listens for a while before it starts the programmer firmware.
+    Bytes the bootloader does not understand make it start the
+    firmware sooner.
+*/
+bool Session::waitForProgrammer(Serial &serial, int timeoutMilliSeconds)
+{
+    constexpr int c_pollIntervalMs = 20;
+    const uint8_t syncReply = static_cast<uint8_t>(PGMOperation::Sync) | 0x80;
+    std::array<uint8_t, Framing::c_maxBodySize> reply;
+
+    const auto deadline = Serial::deadlineFromNow(timeoutMilliSeconds);
+    while(Serial::Clock::now() < deadline)
+    {
+        // the extra delimiter ends any partial frame the programmer holds
+        serial.write(Framing::c_delimiter);
+        const uint8_t seq = serial.writeFrame(PGMOperation::Sync);
+
+        // ignore anything the bootloader might send and
+        // the replies to earlier Sync frames.
+        auto pollDeadline = Serial::deadlineFromNow(c_pollIntervalMs);
+        while(true)
+        {
+            auto result = serial.readFrame(reply.data(), reply.size(), pollDeadline);
+            if ((result.status == Serial::ReadStatus::Timeout) || (result.status == Serial::ReadStatus::Error))
+            {
+                break;
+            }
+
+            if (result.ok() && (result.seq == seq) && (reply.at(0) == syncReply))
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/** switch the link between host and programmer to a faster rate.
+    Both sides fall back to the current rate if the echo test
+    at the new rate fails.
+*/
+bool Session::negotiateBaudRate(Serial &serial, uint32_t baudrate, SessionLog &log)
+{
+    const uint32_t oldRate = serial.baudRate();
+    if (baudrate == oldRate)
+    {
+        return true;
+    }
+
+    std::array<uint8_t, Framing::c_maxBodySize> reply;
+    std::array<uint8_t, 4> args;
+    for(uint32_t i=0; i<4; i++)
+    {
+        args.at(i) = static_cast<uint8_t>(baudrate >> (i*8));
+    }
+
+    const uint8_t seq = serial.writeFrame(PGMOperation::SetBaudRate, args.data(), args.size());
+    auto result = serial.readFrame(reply.data(), reply.size(), Serial::deadlineFromNow());
+    if ((!result.ok()) || (result.seq != seq) || (reply.at(0) != (static_cast<uint8_t>(PGMOperation::SetBaudRate) | 0x80)))
+    {
+        log.err << "Programmer does not support " << baudrate << " baud\n";
+        return false;
+    }
+
+    // the programmer has switched; follow it and check the link.
+    const std::array<uint8_t, 4> pattern = {0x55, 0xAA, 0x00, 0xFF};
+
+    if (serial.setBaudRate(baudrate))
+    {
+        const uint8_t echoSeq = serial.writeFrame(PGMOperation::Echo, pattern.data(), pattern.size());
+        result = serial.readFrame(reply.data(), reply.size(), Serial::deadlineFromNow(100));
+        if (result.ok() && (result.seq == echoSeq) && (result.bytes == (pattern.size() + 1))
+            && (reply.at(0) == (static_cast<uint8_t>(PGMOperation::Echo) | 0x80))
+            && std::equal(pattern.begin(), pattern.end(), reply.begin()+1))
+        {
+            return true;
+        }
+    }
+
+    // the programmer reverts to the old rate when it
+    // does not see a valid echo frame within 250ms.
+    log.err << "Link test at " << baudrate << " baud failed, falling back to " << oldRate << " baud\n";
+    usleep(300*1000);
+    serial.setBaudRate(oldRate);
+
+    // the echo frame used up a sequence number the programmer never saw
+    waitForProgrammer(serial, 500);
+    return false;
+}
+
+/** an absent or unresponsive device reads as all ones or all zeros */
+static bool isDeviceId(uint16_t id)
+{
+    return (id != 0x3FFF) && (id != 0);
+}
+
+bool Session::targetPresent(IDeviceProgrammer &pgm)
+{
+    auto idOpt = pgm.readDeviceId();
+    return idOpt && isDeviceId(idOpt.value());
+}
+
+bool Session::checkDeviceId(std::optional<uint16_t> idOpt, const DeviceInfo &target, SessionLog &log)
+{
+    if (!idOpt)
+    {
+        log.err << "Could not read device ID!\n";
+        return false;
+    }
+ 
+    const uint32_t IDcheck = idOpt.value() & target.deviceIdMask;
+
+    bool IDok = (IDcheck == target.deviceId);
+    log.out << "  device ID = " << Utils::toHex(IDcheck) << "\n";
+    if (!IDok)
+    {
+        log.err << "Device ID mismatch! Wanted " << Utils::toHex(target.deviceId) << " but got " << Utils::toHex(IDcheck) << "\n";
+        return false;
+    }
+
+    return true;    
+}
+
+bool Session::checkDevice(IDeviceProgrammer &pgm, const DeviceInfo &target, SessionLog &log)
+{
+    // read the device ID from the interface.
+    // note: the programmer must be in programming mode to make this work
+    return checkDeviceId(pgm.readDeviceId(), target, log);
+}
+
+void Session::mergeImage(const MemoryImage &flash, size_t address, std::span<uint8_t> deviceWords)
+{
+    for(size_t i = 0; i < (deviceWords.size() / 2); i++)
+    {
+        const uint16_t word = flash.word(address + i);
+        if (word != flash.blankWord())
+        {
+            deviceWords[2*i]   = word & 0xFF;
+            deviceWords[2*i+1] = word >> 8;
+        }
+    }
+}
+
+Session::EraseBlocks Session::eraseBlocksOf(const DeviceInfo &info, std::span<const size_t> pages)
+{
+    EraseBlocks result;
+    const size_t blockPages = eraseBlockWords(info) / info.flashPageSize;
+    if (blockPages == 0)
+    {
+        return result;
+    }
+
+    const size_t pageCount = (info.flashMemSize + info.flashPageSize - 1) / info.flashPageSize;
+    for(auto page : pages)
+    {
+        const size_t block = page / blockPages;
+        if (!result.blocks.empty() && (result.blocks.back() == block))
+        {
+            continue;
+        }
+
+        result.blocks.push_back(block);
+        for(size_t blockPage = block*blockPages; blockPage < std::min((block+1)*blockPages, pageCount); blockPage++)
+        {
+            result.pages.push_back(blockPage);
+        }
+    }
+    return result;
+}
+
+/** erase blocks of eraseBlockWords(), given in ascending order.
+    Adjacent blocks are erased with one request.
+*/
+static bool eraseBlocks(IDeviceProgrammer &pgm, const DeviceInfo &info, std::span<const size_t> blocks,
+    SessionLog &log)
+{
+    const size_t blockWords = eraseBlockWords(info);
+    size_t i = 0;
+    while(i < blocks.size())
+    {
+        size_t run = 1;
+        while(((i + run) < blocks.size()) && (blocks[i + run] == (blocks[i] + run)))
+        {
+            run++;
+        }
+
+        const size_t start = blocks[i]*blockWords;
+        if (!pgm.eraseRows(info, start, std::min(run*blockWords, info.flashMemSize - start)))
+        {
+            log.err << "Could not erase the rows at " << Utils::toHex(start) << "\n";
+            return false;
+        }
+        i += run;
+    }
+    return true;
+}
+
+/** erase and program only the flash rows that differ from the image.
+    The device contents are compared using per-page CRCs, or read back
+    when the programmer cannot compute them.
+*/
+static Session::DeltaResult programDelta(IDeviceProgrammer &pgm, const DeviceInfo &info, 
+    const ProgramImage &image, SessionLog &log)
+{
+    using Session::DeltaResult;
+    auto const &flash  = image.flash;
+    auto const &config = image.config;
+
+    if (eraseBlockWords(info) == 0)
+    {
+        log.err << "The " << familyName(info.deviceFamily) << " family cannot erase single rows\n";
+        return DeltaResult::Failed;
+    }
+
+    auto deviceConfig = pgm.downloadConfig(info);
+    if (deviceConfig.size() != config.size())
+    {
+        log.err << "Could not read configuration bytes!\n";
+        return DeltaResult::Failed;
+    }
+
+    for(size_t i=0; i<config.size(); i += 2)
+    {
+        const uint16_t wanted = config.at(i) | (static_cast<uint16_t>(config.at(i+1)) << 8);
+        const uint16_t got    = deviceConfig.at(i) | (static_cast<uint16_t>(deviceConfig.at(i+1)) << 8);
+        if ((wanted & 0x3FFF) != (got & 0x3FFF))
+        {
+            return DeltaResult::NeedsFullErase;
+        }
+    }
+
+    auto deviceCrcs = pgm.readPageCrcs(info);
+    if (deviceCrcs.size() != flash.pageCount())
+    {
+        // no CRC command: read the flash back and compute the CRCs here
+        std::vector<uint8_t> contents(flash.pageCount()*flash.pageBytes());
+        if (!pgm.downloadFlash(info, std::span(contents).first(info.flashMemSize*2)))
+        {
+            log.err << "Could not read flash memory!\n";
+            return DeltaResult::Failed;
+        }
+
+        deviceCrcs.clear();
+        for(size_t page = 0; page < flash.pageCount(); page++)
+        {
+            deviceCrcs.push_back(Framing::crc32(&contents.at(page*flash.pageBytes()), flash.pageBytes()));
+        }
+    }
+
+    std::vector<size_t> changedPages;
+    for(size_t page = 0; page < flash.pageCount(); page++)
+    {
+        if (deviceCrcs.at(page) != flash.pageCrc(page))
+        {
+            changedPages.push_back(page);
+        }
+    }
+
+    // the unchanged pages of a block are erased too, so they are written again
+    const size_t blockWords = eraseBlockWords(info);
+    const size_t blockPages = blockWords / info.flashPageSize;
+    const auto [blocks, pages] = Session::eraseBlocksOf(info, changedPages);
+    if (log.verbose)
+    {
+        for(auto block : blocks)
+        {
+            log.out << "Row at " << Utils::toHex(block*blockWords) << " changed\n";
+        }
+    }
+
+    if (!eraseBlocks(pgm, info, blocks, log))
+    {
+        return DeltaResult::Failed;
+    }
+
+    log.out << blocks.size() << " of " << (flash.pageCount() / blockPages) << " rows changed\n";
+    return pgm.uploadFlash(info, flash, pages) ? DeltaResult::Done : DeltaResult::Failed;
+}
+
+/** erase and program only the erase blocks that hold data in the image,
+    see eraseBlockWords(). Words of those blocks that are blank in the
+    image keep their contents, so the rest of the device is left alone.
+    The configuration words are not written.
+*/
+static bool programRows(IDeviceProgrammer &pgm, const DeviceInfo &info, const MemoryImage &flash,
+    SessionLog &log)
+{
+    const size_t blockWords = eraseBlockWords(info);
+    if (blockWords == 0)
+    {
+        log.err << "The " << familyName(info.deviceFamily) << " family cannot erase single rows\n";
+        return false;
+    }
+
+    // a block can hold pages the HEX file does not touch, they are read
+    // back and written again with the rest of the block
+    const size_t blockPages = blockWords / info.flashPageSize;
+    const auto usedPages = flash.usedPages();
+    const auto [blocks, pages] = Session::eraseBlocksOf(info, usedPages);
+
+    // the blocks as they should be after programming
+    MemoryImage rows(flash.sizeWords(), flash.pageWords(), flash.blankWord());
+    std::vector<uint8_t> deviceRow(blockWords*2);
+    for(auto block : blocks)
+    {
+        const size_t address = block*blockWords;
+        const size_t words   = std::min(blockWords, info.flashMemSize - address);
+        auto dest = std::span(deviceRow).first(words*2);
+        if (!pgm.downloadFlash(info, address, dest))
+        {
+            log.err << "Could not read flash memory!\n";
+            return false;
+        }
+        Session::mergeImage(flash, address, dest);
+        rows.setBytes(address*2, dest);
+
+        if (log.verbose)
+        {
+            log.out << "Updating row at " << Utils::toHex(address) << "\n";
+        }
+    }
+
+    if (!eraseBlocks(pgm, info, blocks, log))
+    {
+        return false;
+    }
+
+    log.out << blocks.size() << " of " << (flash.pageCount() / blockPages) << " rows updated\n";
+    return pgm.uploadFlash(info, rows, pages);
+}
+
+std::vector<const DeviceInfo*> Session::devicesWithId(EntrySequence sequence, uint16_t id)
+{
+    std::vector<const DeviceInfo*> matches;
+    if (!isDeviceId(id))
+    {
+        return matches;
+    }
+
+    const auto devices = DeviceDB::devices();
+    for(size_t maskIndex = 0; maskIndex < DeviceDB::idMasks().size(); maskIndex++)
+    {
+        for(auto index : DeviceDB::findById(maskIndex, id))
+        {
+            auto const &device = devices[index];
+            if (ProgrammerFactory::entrySequence(device.deviceFamily) == sequence)
+            {
+                matches.push_back(&device);
+            }
+        }
+    }
+    return matches;
+}
+
+std::optional<const DeviceInfo*> Session::identify(EntrySequence sequence, std::optional<uint16_t> idOpt,
+    SessionLog &log)
+{
+    if (!idOpt)
+    {
+        return std::nullopt;
+    }
+
+    auto matches = devicesWithId(sequence, idOpt.value());
+    if (matches.size() == 1)
+    {
+        return matches.front();
+    }
+
+    if (matches.size() > 1)
+    {
+        log.err << "Device ID " << Utils::toHex(idOpt.value()) << " matches " << matches.size();
+        log.err << " devices, please specify the target\n";
+        return nullptr;
+    }
+    return std::nullopt;
+}
+
+/** find the target by reading its ID. Every way into programming mode
+    is tried once; the ID is looked up in the device ID index for each of
+    the ID masks, so no device list is scanned.
+    returns nullptr if no single supported device matches.
+*/
+const DeviceInfo* Session::detectDevice(std::shared_ptr<Serial> serial, SessionLog &log)
+{
+    // one engine per entry sequence is enough to read the ID
+    for(auto const &probe : c_detectProbes)
+    {
+        auto pgm = ProgrammerFactory::create(probe.second, serial);
+        pgm->enterProgMode();
+        auto idOpt = pgm->readDeviceId();
+        pgm->exitProgMode();
+        if (auto target = identify(probe.first, idOpt, log))
+        {
+            return target.value();
+        }
+    }
+
+    return nullptr;
+}
+
+std::shared_ptr<Serial> Session::openProgrammer(const std::string &port, uint32_t baudrate, SessionLog &log)
+{
+    auto serial = Serial::open(port, Serial::c_defaultBaudRate);
+    if (!serial)
+    {
+        log.err << "Error opening serial port " << port << " !\n";
+        return nullptr;
+    }
+
+    if (log.verbose)
+    {
+        log.out << "Serial port " << port << " opened, waiting for the programmer to come online..\n";
+    }
+
+    // Arduino resets when the UART connects.
+    // and we have to wait a bit before the uC comes online.
+    const auto syncStart = Serial::Clock::now();
+    if (!waitForProgrammer(*serial, 3000))
+    {
+        log.err << "Programmer does not respond on " << port << "\n";
+        return nullptr;
+    }
+
+    if (log.verbose)
+    {
+        auto syncTime = std::chrono::duration_cast<std::chrono::milliseconds>(Serial::Clock::now() - syncStart);
+        log.out << "Programmer online after " << syncTime.count() << " ms\n";
+    }
+
+    if (negotiateBaudRate(*serial, baudrate, log) && log.verbose)
+    {
+        log.out << "Link running at " << serial->baudRate() << " baud\n";
+    }
+    return serial;
+}
+
+std::optional<std::vector<size_t> > Session::VerifyReport::pagesToCheck(std::span<const uint32_t> deviceCrcs)
+{
+    if (deviceCrcs.size() != m_flash.pageCount())
+    {
+        m_log.err << "Could not read flash memory CRCs!\n";
+        return std::nullopt;
+    }
+
+    std::vector<size_t> pages;
+    for(size_t page = 0; page < deviceCrcs.size(); page++)
+    {
+        // a partial update leaves the words outside the HEX file as they were
+        if ((deviceCrcs[page] == m_flash.pageCrc(page)) || (m_partial && m_flash.isPageBlank(page)))
+        {
+            continue;
+        }
+
+        if (m_log.verbose)
+        {
+            m_log.out << "CRC mismatch in page " << page << ", verifying it on the programmer\n";
+        }
+        pages.push_back(page);
+    }
+    return pages;
+}
+
+bool Session::VerifyReport::pageChecked(size_t page, const std::optional<std::vector<FlashMismatch> > &mismatches)
+{
+    if (!mismatches)
+    {
+        m_log.err << "Could not verify flash memory!\n";
+        return false;
+    }
+
+    for(auto const &mismatch : mismatches.value())
+    {
+        if (m_partial && (mismatch.wanted == m_flash.blankWord()))
+        {
+            continue;   // not in the HEX file, see programRows
+        }
+
+        if (m_mismatchCount == 0)
+        {
+            m_log.err << "\n";
+        }
+        m_log.err << "Flash memory mismatch at address " << Utils::toHex(mismatch.address);
+        m_log.err << "  wanted: " << Utils::toHex(mismatch.wanted);
+        m_log.err << "  but got: " << Utils::toHex(mismatch.got) << "\n";
+        m_mismatchCount++;
+    }
+
+    if (mismatches->empty())
+    {
+        // the words match, so the CRC was received wrongly
+        m_log.err << "CRC of page " << page << " does not match, but its contents do\n";
+    }
+    return true;
+}
+
+bool Session::VerifyReport::ok()
+{
+    if (m_mismatchCount > 0)
+    {
+        m_log.err << m_mismatchCount << " flash words do not match\n";
+        return false;
+    }
+    return true;
+}
+
+/** compare the flash with the image. CRCs are compared first, 
+    only pages that differ are checked word by word.
+*/
+static bool verifyImage(IDeviceProgrammer &pgm, const DeviceInfo &info, const MemoryImage &flash,
+    bool partial, SessionLog &log)
+{
+    Session::VerifyReport report(flash, partial, log);
+    auto pages = report.pagesToCheck(pgm.readPageCrcs(info));
+    if (!pages)
+    {
+        return false;
+    }
+
+    for(auto page : pages.value())
+    {
+        const size_t pageSize = info.flashPageSize;
+        if (!report.pageChecked(page, pgm.verifyFlash(info, flash, page*pageSize, pageSize)))
+        {
+            return false;
+        }
+    }
+    return report.ok();
+}
+
+bool Session::JobFlow::wanted(Step step) const
+{
+    switch(step)
+    {
+    case Step::Delta:
+        return m_options.upload && m_options.delta;
+    case Step::Partial:
+        return m_options.upload && m_options.partial;
+    case Step::BlankCheck:
+        return m_options.blankCheck && !m_programmed;
+    case Step::Erase:
+        return m_options.erase && !m_isBlank && !m_programmed;
+    case Step::Upload:
+        return m_options.upload && !m_programmed;
+    case Step::Verify:
+        return m_options.verify;
+    default:
+        return false;
+    }
+}
+
+Session::JobFlow::Step Session::JobFlow::next()
+{
+    while(m_ok && (m_step != Step::Done))
+    {
+        m_step = static_cast<Step>(static_cast<int>(m_step) + 1);
+        if (!wanted(m_step))
+        {
+            continue;
+        }
+
+        switch(m_step)
+        {
+        case Step::Delta:
+            m_log.out << "Programming changed rows..\n";
+            break;
+        case Step::Partial:
+            m_log.out << "Programming the rows in the HEX file..\n";
+            break;
+        case Step::BlankCheck:
+            m_log.out << "Blank check\n";
+            break;
+        case Step::Erase:
+            m_log.out << "Erasing flash memory\n";
+            break;
+        case Step::Upload:
+            m_log.out << "Programming flash..\n";
+            break;
+        case Step::Verify:
+            m_log.out << "Verifying.. ";
+            break;
+        default:
+            break;
+        }
+        return m_step;
+    }
+    return Step::Done;
+}
+
+void Session::JobFlow::stepDone(bool ok)
+{
+    m_ok = ok;
+    switch(m_step)
+    {
+    case Step::Partial:
+        if (!ok)
+        {
+            m_log.err << "Partial programming failed!\n";
+        }
+        m_programmed = true;
+        break;
+    case Step::Upload:
+        if (ok)
+        {
+            m_log.out << "\n";
+        }
+        else
+        {
+            m_log.err << "\nProgramming failed!\n";
+        }
+        break;
+    case Step::Verify:
+        if (ok)
+        {
+            m_log.out << "Ok!\n";
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void Session::JobFlow::blankCheckDone(std::optional<bool> blank)
+{
+    if (!blank)
+    {
+        m_log.err << "Could not read flash\n";
+    }
+
+    m_isBlank = blank.value_or(false);
+    if (m_isBlank)
+    {
+        m_log.out << "Device is blank\n";
+    }
+}
+
+void Session::JobFlow::deltaDone(DeltaResult result)
+{
+    switch(result)
+    {
+    case DeltaResult::Done:
+        m_programmed = true;
+        break;
+    case DeltaResult::NeedsFullErase:
+        m_log.out << "Configuration words differ, programming the whole device\n";
+        break;
+    case DeltaResult::Failed:
+        m_log.err << "Delta programming failed!\n";
+        m_ok = false;
+        break;
+    }
+}
+
+bool Session::runJob(IDeviceProgrammer &pgm, const DeviceInfo &info, const ProgramImage &image,
+    const JobOptions &options, SessionLog &log)
+{
+    JobFlow flow(options, log);
+    for(auto step = flow.next(); step != JobFlow::Step::Done; step = flow.next())
+    {
+        switch(step)
+        {
+        case JobFlow::Step::Delta:
+            flow.deltaDone(programDelta(pgm, info, image, log));
+            break;
+        case JobFlow::Step::Partial:
+            flow.stepDone(programRows(pgm, info, image.flash, log));
+            break;
+        case JobFlow::Step::BlankCheck:
+            flow.blankCheckDone(pgm.isDeviceBlank(info));
+            break;
+        case JobFlow::Step::Erase:
+            pgm.massErase();    // the programmer acks once the erase has completed
+            flow.stepDone(true);
+            break;
+        case JobFlow::Step::Upload:
+            flow.stepDone(pgm.uploadFlash(info, image.flash) && pgm.uploadConfig(info, image.config));
+            break;
+        case JobFlow::Step::Verify:
+            flow.stepDone(verifyImage(pgm, info, image.flash, options.partial, log));
+            break;
+        default:
+            break;
+        }
+    }
+    return flow.ok();
+}
+
+/** poll until a target is present, or until it has been removed.
+    A present target is left in programming mode.
+    returns false if stopped first.
+*/
+static bool waitForTarget(IDeviceProgrammer &pgm, bool present, const std::atomic<bool> &stop)
+{
+    constexpr int c_pollIntervalMs = 200;
+
+    // a target that is being plugged in may not make contact on all pins at once
+    constexpr size_t c_stablePolls = 2;
+
+    size_t stable = 0;
+    while(!stop)
+    {
+        pgm.enterProgMode();
+        stable = (Session::targetPresent(pgm) == present) ? (stable + 1) : 0;
+        if (present && (stable >= c_stablePolls))
+        {
+            return true;
+        }
+
+        pgm.exitProgMode();
+        if (stable >= c_stablePolls)
+        {
+            return true;
+        }
+        usleep(c_pollIntervalMs*1000);
+    }
+    return false;
+}
+
+bool Session::repeatJob(IDeviceProgrammer &pgm, const DeviceInfo &info, const ProgramImage &image,
+    const JobOptions &options, const std::atomic<bool> &stop, SessionLog &log)
+{
+    size_t targets = 0;
+    size_t passed  = 0;
+    while(!stop)
+    {
+        log.out << "\nWaiting for a target..\n";
+        if (!waitForTarget(pgm, true, stop))
+        {
+            break;
+        }
+
+        const auto start = Serial::Clock::now();
+        const bool ok = checkDevice(pgm, info, log) && runJob(pgm, info, image, options, log);
+        pgm.exitProgMode();
+
+        const double seconds = std::chrono::duration<double>(Serial::Clock::now() - start).count();
+        targets++;
+        passed += ok ? 1 : 0;
+        log.out << "Target " << targets << ": " << (ok ? "PASS" : "FAIL") << "  ";
+        log.out << std::fixed << std::setprecision(1) << seconds << " s";
+        log.out << "  (" << passed << " of " << targets << " passed)\n";
+
+        log.out << "Remove the target\n";
+        waitForTarget(pgm, false, stop);
+    }
+
+    log.out << passed << " of " << targets << " targets passed\n";
+    return passed == targets;
+}
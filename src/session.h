@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <ostream>
+#include <atomic>
+#include <array>
+#include <optional>
+#include <span>
+#include <utility>
+#include "serial.h"
+#include "devicepgminterface.h"
+#include "pgmfactory.h"
+
+/** what a session does with a target, set from the command line */
+struct JobOptions
+{
+    bool upload     = false;
+    bool verify     = false;
+    bool erase      = true;
+    bool blankCheck = true;
+    bool delta      = false;    ///< only program the rows that differ from the device
+    bool partial    = false;    ///< only program the rows that hold data in the image
+};
+
+/** flash and configuration contents for one target.
+    Once loaded it is only read, so sessions on several ports can share it.
+*/
+struct ProgramImage
+{
+    explicit ProgramImage(const DeviceInfo &info)
+        : flash(info.flashMemSize, info.flashPageSize),
+          config(info.configSize*2, 0xFF) {}
+
+    MemoryImage          flash;
+    std::vector<uint8_t> config;
+};
+
+/** where a session writes its messages. A single port run uses
+    std::cout and std::cerr, gang runs collect the messages per port.
+*/
+struct SessionLog
+{
+    std::ostream &out;
+    std::ostream &err;
+    bool          verbose = false;
+};
+
+/** the steps of programming one target through one programmer */
+namespace Session
+{
+    /** poll the programmer with Sync frames until it answers */
+    bool waitForProgrammer(Serial &serial, int timeoutMilliSeconds);
+
+    /** switch the link between host and programmer to a faster rate */
+    bool negotiateBaudRate(Serial &serial, uint32_t baudrate, SessionLog &log);
+
+    /** open a port, wait for the programmer to come online after
+        its reset and switch to the baud rate. nullptr on error.
+    */
+    std::shared_ptr<Serial> openProgrammer(const std::string &port, uint32_t baudrate, SessionLog &log);
+
+    /** the supported devices with an ID, read after entering programming mode
+        with the given sequence. More than one means the ID is ambiguous.
+    */
+    std::vector<const DeviceInfo*> devicesWithId(EntrySequence sequence, uint16_t id);
+
+    /** find the target by reading its ID. nullptr if no single supported device matches. */
+    const DeviceInfo* detectDevice(std::shared_ptr<Serial> serial, SessionLog &log);
+
+    /** the ways into programming mode that are tried to detect a target,
+        each with a family that uses it to read the ID
+    */
+    constexpr std::array<std::pair<EntrySequence, DeviceFamily>, 2> c_detectProbes =
+    {
+        {{EntrySequence::LowVoltageKey, DeviceFamily::CF_P16F_A},
+        {EntrySequence::PGMPin,         DeviceFamily::CF_P16F_PGM_A}}
+    };
+
+    /** the target for an ID read after entering programming mode with the sequence.
+        nullopt if no device matches, so the next sequence is tried, and
+        nullptr if the ID matches several devices, which is reported.
+    */
+    std::optional<const DeviceInfo*> identify(EntrySequence sequence, std::optional<uint16_t> id,
+        SessionLog &log);
+
+    /** true if a target answers with a device ID. The programmer must be in programming mode. */
+    bool targetPresent(IDeviceProgrammer &pgm);
+
+    /** check and report an ID read from the target, nullopt if it could not be read */
+    bool checkDeviceId(std::optional<uint16_t> id, const DeviceInfo &target, SessionLog &log);
+
+    /** check the device ID of the target. The programmer must be in programming mode. */
+    bool checkDevice(IDeviceProgrammer &pgm, const DeviceInfo &target, SessionLog &log);
+
+    enum class DeltaResult
+    {
+        Done,
+        NeedsFullErase,     ///< the configuration words differ, they can only be bulk erased
+        Failed
+    };
+
+    /** erase blocks, see eraseBlockWords(), and the pages they hold */
+    struct EraseBlocks
+    {
+        std::vector<size_t> blocks;
+        std::vector<size_t> pages;
+    };
+
+    /** the erase blocks that hold the pages and every page of those blocks,
+        which must all be written again after the erase. pages must be ascending.
+    */
+    EraseBlocks eraseBlocksOf(const DeviceInfo &info, std::span<const size_t> pages);
+
+    /** put the words of the image that are not blank on top of device
+        contents read from a word address, for a partial update
+    */
+    void mergeImage(const MemoryImage &flash, size_t address, std::span<uint8_t> deviceWords);
+
+    /** the steps of a job in their order, and the messages about them. Shared by
+        runJob and AsyncSession, which only do the programmer I/O of each step:
+
+            for(auto step = flow.next(); step != JobFlow::Step::Done; step = flow.next())
+            {
+                run the step, then report it with stepDone(), blankCheckDone() or deltaDone()
+            }
+            return flow.ok();
+    */
+    class JobFlow
+    {
+    public:
+        enum class Step
+        {
+            Start,
+            Delta,          ///< erase and program the rows that differ from the device
+            Partial,        ///< erase and program the rows that hold data in the image
+            BlankCheck,
+            Erase,
+            Upload,         ///< program the flash and the configuration words
+            Verify,
+            Done
+        };
+
+        JobFlow(const JobOptions &options, SessionLog &log) : m_options(options), m_log(log) {}
+
+        /** the next step to run and print its heading. Done after the last
+            step, or after a step that failed.
+        */
+        Step next();
+
+        /** the result of a Partial, Erase, Upload or Verify step */
+        void stepDone(bool ok);
+
+        /** the result of a BlankCheck step, nullopt if the flash could not be read */
+        void blankCheckDone(std::optional<bool> blank);
+
+        /** the result of a Delta step */
+        void deltaDone(DeltaResult result);
+
+        /** false if a step failed */
+        bool ok() const noexcept
+        {
+            return m_ok;
+        }
+
+    protected:
+        bool wanted(Step step) const;
+
+        const JobOptions &m_options;
+        SessionLog  &m_log;
+        Step        m_step       = Step::Start;
+        bool        m_ok         = true;
+        bool        m_programmed = false;  ///< by a Delta or Partial step
+        bool        m_isBlank    = true;
+    };
+
+    /** the decisions and messages of comparing the flash with the image, shared
+        by runJob and AsyncSession. The page CRCs are compared first, only pages
+        that differ are checked word by word on the programmer.
+    */
+    class VerifyReport
+    {
+    public:
+        /** partial: the words outside the HEX file were left as they were */
+        VerifyReport(const MemoryImage &flash, bool partial, SessionLog &log)
+            : m_flash(flash), m_partial(partial), m_log(log) {}
+
+        /** the pages to check word by word. nullopt if the CRCs could not be read. */
+        std::optional<std::vector<size_t> > pagesToCheck(std::span<const uint32_t> deviceCrcs);
+
+        /** report the words of a page that differ. false if they could not be compared. */
+        bool pageChecked(size_t page, const std::optional<std::vector<FlashMismatch> > &mismatches);
+
+        /** true if all words match, otherwise the number of words that do not is reported */
+        bool ok();
+
+    protected:
+        const MemoryImage &m_flash;
+        bool        m_partial;
+        SessionLog  &m_log;
+        size_t      m_mismatchCount = 0;
+    };
+
+    /** blank check, erase, program and verify as set by the options.
+        The programmer must be in programming mode.
+    */
+    bool runJob(IDeviceProgrammer &pgm, const DeviceInfo &info, const ProgramImage &image,
+        const JobOptions &options, SessionLog &log);
+
+    /** production loop for a single station: wait for a target, run the job
+        on it, report the result and wait until it is removed, until stop is set.
+        returns true if all targets passed.
+    */
+    bool repeatJob(IDeviceProgrammer &pgm, const DeviceInfo &info, const ProgramImage &image,
+        const JobOptions &options, const std::atomic<bool> &stop, SessionLog &log);
+};
@@ -0,0 +1,229 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#pragma once
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <memory>
+#include <functional>
+#include "eventloop.h"
+
+/** Coroutines for sessions that run on an EventLoop.
+
+    A Task starts when it is awaited, or by start() for the outermost
+    task of a session, and resumes its caller when it returns. Tasks
+    suspend on the awaitables of AsyncPort and on Background; the
+    EventLoop resumes them when the reply, timer or background work
+    they wait for is done, so all tasks run on the loop thread.
+*/
+
+template<typename T = void>
+class Task;
+
+namespace TaskDetail
+{
+    struct PromiseBase
+    {
+        /** resumed when the task returns */
+        std::coroutine_handle<> continuation = std::noop_coroutine();
+        std::exception_ptr      exception;
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept
+            {
+                return false;
+            }
+
+            template<typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+            {
+                return handle.promise().continuation;
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        FinalAwaiter final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void unhandled_exception() noexcept
+        {
+            exception = std::current_exception();
+        }
+    };
+
+    template<typename T>
+    struct Promise : PromiseBase
+    {
+        std::optional<T> value;
+
+        Task<T> get_return_object() noexcept;
+
+        void return_value(T result)
+        {
+            value = std::move(result);
+        }
+
+        T result()
+        {
+            if (exception)
+            {
+                std::rethrow_exception(exception);
+            }
+            return std::move(*value);
+        }
+    };
+
+    template<>
+    struct Promise<void> : PromiseBase
+    {
+        Task<void> get_return_object() noexcept;
+
+        void return_void() noexcept {}
+
+        void result()
+        {
+            if (exception)
+            {
+                std::rethrow_exception(exception);
+            }
+        }
+    };
+};
+
+template<typename T>
+class Task
+{
+public:
+    using promise_type = TaskDetail::Promise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    Task() = default;
+    explicit Task(Handle handle) noexcept : m_handle(handle) {}
+
+    Task(Task &&other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+
+    Task& operator=(Task &&other) noexcept
+    {
+        if (this != &other)
+        {
+            destroy();
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task()
+    {
+        destroy();
+    }
+
+    /** run the task until it first suspends. The Task must be kept
+        until it is done, nothing is resumed when it returns.
+    */
+    void start()
+    {
+        m_handle.resume();
+    }
+
+    bool isDone() const noexcept
+    {
+        return !m_handle || m_handle.done();
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+    {
+        m_handle.promise().continuation = caller;
+        return m_handle;
+    }
+
+    T await_resume()
+    {
+        return m_handle.promise().result();
+    }
+
+protected:
+    void destroy() noexcept
+    {
+        if (m_handle)
+        {
+            m_handle.destroy();
+            m_handle = nullptr;
+        }
+    }
+
+    Handle m_handle;
+};
+
+template<typename T>
+Task<T> TaskDetail::Promise<T>::get_return_object() noexcept
+{
+    return Task<T>(std::coroutine_handle<Promise<T> >::from_promise(*this));
+}
+
+inline Task<void> TaskDetail::Promise<void>::get_return_object() noexcept
+{
+    return Task<void>(std::coroutine_handle<Promise<void> >::from_promise(*this));
+}
+
+/** work that runs on another thread while the task goes on, such as
+    loading a HEX file. It starts when it is constructed; co_await
+    waits until it is done. The work must not touch the session state
+    that the task uses in the meantime.
+*/
+class Background
+{
+public:
+    Background(EventLoop &loop, std::function<void()> work) : m_state(std::make_shared<State>())
+    {
+        loop.runInBackground(std::move(work), [state = m_state]()
+            {
+                state->done = true;
+                if (state->waiter)
+                {
+                    std::exchange(state->waiter, nullptr).resume();
+                }
+            }
+        );
+    }
+
+    bool await_ready() const noexcept
+    {
+        return m_state->done;
+    }
+
+    void await_suspend(std::coroutine_handle<> caller) noexcept
+    {
+        m_state->waiter = caller;
+    }
+
+    void await_resume() const noexcept {}
+
+protected:
+    /** shared with the completion callback, which may run after the task has gone */
+    struct State
+    {
+        bool                    done = false;
+        std::coroutine_handle<> waiter;
+    };
+
+    std::shared_ptr<State> m_state;
+};
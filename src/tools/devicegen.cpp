@@ -0,0 +1,342 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+/*
+    devicegen: turns devices.dat into a C++ header with a constexpr
+    device table and perfect hash tables to look devices up by name
+    and by masked device ID. Run by the build, see CMakeLists.txt.
+
+    usage: devicegen <devices.dat> <devicetable.h>
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <functional>
+#include <optional>
+#include <cstdlib>
+#include "../deviceinfo.h"
+
+struct Device
+{
+    std::string  name;
+    uint32_t     flashMemSize;  // in words
+    uint32_t     flashPageSize; // in words
+    uint32_t     deviceId;
+    uint32_t     deviceIdMask;
+    const FamilyInfo *family;
+};
+
+/** a hash and displace table: per bucket a seed, per slot an entry */
+struct PerfectHash
+{
+    std::vector<uint16_t> seeds;
+    std::vector<uint16_t> slots;
+};
+
+static std::optional<uint32_t> parseNumber(const std::string &str, int base)
+{
+    if (str.empty())
+    {
+        return std::nullopt;
+    }
+
+    char *end = nullptr;
+    const unsigned long value = strtoul(str.c_str(), &end, base);
+    if (*end != 0)
+    {
+        return std::nullopt;
+    }
+    return static_cast<uint32_t>(value);
+}
+
+static bool readDevices(const std::string &filename, std::vector<Device> &devices)
+{
+    std::ifstream deviceFile(filename);
+    if (!deviceFile.is_open())
+    {
+        std::cerr << "Cannot open device file: " << filename << "\n";
+        return false;
+    }
+
+    size_t lineNum = 0;
+    std::string line;
+    while(std::getline(deviceFile, line))
+    {
+        lineNum++;
+
+        // skip empty lines and comments
+        if ((line.size() <= 2) || (line.at(0) == '#'))
+        {
+            continue;
+        }
+
+        std::istringstream columns(line);
+        std::vector<std::string> tokens;
+        std::string token;
+        while(columns >> token)
+        {
+            tokens.push_back(token);
+        }
+
+        if (tokens.size() < 6)
+        {
+            std::cerr << filename << ":" << lineNum << ": not enough columns\n";
+            return false;
+        }
+
+        auto flashMem   = parseNumber(tokens.at(1), 10);
+        auto flashPage  = parseNumber(tokens.at(2), 10);
+        auto deviceId   = parseNumber(tokens.at(3), 16);
+        auto deviceMask = parseNumber(tokens.at(4), 16);
+        if (!flashMem || !flashPage || !deviceId || !deviceMask || (flashPage.value() < 2))
+        {
+            std::cerr << filename << ":" << lineNum << ": cannot parse sizes or device ID\n";
+            return false;
+        }
+
+        auto iter = std::find_if(c_families.begin(), c_families.end(),
+            [&tokens](const FamilyInfo &family)
+            {
+                return family.name == tokens.at(5);
+            }
+        );
+
+        if (iter == c_families.end())
+        {
+            std::cerr << filename << ":" << lineNum << ": unknown device family " << tokens.at(5) << "\n";
+            return false;
+        }
+
+        // rows are updated in erase blocks of whole pages, see eraseBlockWords()
+        if ((iter->eraseBlockSize != 0) && ((iter->eraseBlockSize % (flashPage.value() / 2)) != 0))
+        {
+            std::cerr << filename << ":" << lineNum << ": page size does not divide the erase block of "
+                << iter->name << "\n";
+            return false;
+        }
+
+        std::string name = tokens.at(0);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+        // sizes are in bytes in the file
+        devices.push_back({name, flashMem.value() / 2, flashPage.value() / 2,
+            deviceId.value(), deviceMask.value(), &(*iter)});
+    }
+    return true;
+}
+
+/** build a minimal-ish perfect hash over the keys. hashKey(i, seed) hashes key i. */
+static std::optional<PerfectHash> buildPerfectHash(size_t keys,
+    const std::function<uint32_t(size_t, uint32_t)> &hashKey)
+{
+    size_t slotCount = 1;
+    while(slotCount < keys)
+    {
+        slotCount *= 2;
+    }
+    const size_t bucketCount = std::max<size_t>(1, (keys + 3) / 4);
+
+    PerfectHash table;
+    table.seeds.assign(bucketCount, 0);
+    table.slots.assign(slotCount, DeviceDB::c_noEntry);
+
+    std::vector<std::vector<size_t> > buckets(bucketCount);
+    for(size_t i=0; i<keys; i++)
+    {
+        buckets.at(hashKey(i, 0) % bucketCount).push_back(i);
+    }
+
+    // place the largest buckets first, while most slots are free
+    std::vector<size_t> order(bucketCount);
+    for(size_t i=0; i<bucketCount; i++)
+    {
+        order.at(i) = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&buckets](size_t a, size_t b)
+        {
+            return buckets.at(a).size() > buckets.at(b).size();
+        }
+    );
+
+    for(auto bucket : order)
+    {
+        const auto &members = buckets.at(bucket);
+        if (members.empty())
+        {
+            break;
+        }
+
+        bool placed = false;
+        for(uint32_t seed = 1; (seed < 0xFFFF) && !placed; seed++)
+        {
+            std::vector<size_t> slots;
+            for(auto key : members)
+            {
+                const size_t slot = hashKey(key, seed) % slotCount;
+                if ((table.slots.at(slot) != DeviceDB::c_noEntry)
+                    || (std::find(slots.begin(), slots.end(), slot) != slots.end()))
+                {
+                    break;
+                }
+                slots.push_back(slot);
+            }
+
+            if (slots.size() == members.size())
+            {
+                for(size_t i=0; i<members.size(); i++)
+                {
+                    table.slots.at(slots.at(i)) = members.at(i);
+                }
+                table.seeds.at(bucket) = seed;
+                placed = true;
+            }
+        }
+
+        if (!placed)
+        {
+            return std::nullopt;
+        }
+    }
+    return table;
+}
+
+static void writeArray(std::ostream &os, const char *type, const char *name, const std::vector<uint16_t> &values)
+{
+    os << "inline constexpr std::array<" << type << ", " << values.size() << "> " << name << " =\n{\n";
+    for(size_t i=0; i<values.size(); i++)
+    {
+        os << ((i % 12) == 0 ? "    " : " ") << values.at(i) << ",";
+        if (((i % 12) == 11) || (i == (values.size()-1)))
+        {
+            os << "\n";
+        }
+    }
+    os << "};\n\n";
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        std::cerr << "usage: devicegen <devices.dat> <devicetable.h>\n";
+        return EXIT_FAILURE;
+    }
+
+    std::vector<Device> devices;
+    if (!readDevices(argv[1], devices))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (devices.empty() || (devices.size() >= DeviceDB::c_noEntry))
+    {
+        std::cerr << "devicegen: unsupported number of devices\n";
+        return EXIT_FAILURE;
+    }
+
+    // names must be unique, the last entry of a duplicate would never be found
+    std::map<std::string, size_t> names;
+    for(size_t i=0; i<devices.size(); i++)
+    {
+        if (!names.emplace(devices.at(i).name, i).second)
+        {
+            std::cerr << "devicegen: duplicate device name " << devices.at(i).name << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    auto nameHash = buildPerfectHash(devices.size(), [&devices](size_t i, uint32_t seed)
+        {
+            return DeviceDB::hash(devices.at(i).name, seed);
+        }
+    );
+
+    // group the devices by ID mask and masked ID
+    std::vector<uint32_t> masks;
+    for(auto const &dev : devices)
+    {
+        if (std::find(masks.begin(), masks.end(), dev.deviceIdMask) == masks.end())
+        {
+            masks.push_back(dev.deviceIdMask);
+        }
+    }
+
+    std::map<uint32_t, std::vector<uint16_t> > groups;
+    for(size_t i=0; i<devices.size(); i++)
+    {
+        auto const &dev = devices.at(i);
+        const size_t maskIndex = std::find(masks.begin(), masks.end(), dev.deviceIdMask) - masks.begin();
+        groups[DeviceDB::idKey(maskIndex, dev.deviceId & dev.deviceIdMask)].push_back(i);
+    }
+
+    std::vector<DeviceDB::IdGroup> idGroups;
+    std::vector<uint16_t> idDevices;
+    for(auto const &group : groups)
+    {
+        idGroups.push_back({group.first, static_cast<uint16_t>(idDevices.size()),
+            static_cast<uint16_t>(group.second.size())});
+        idDevices.insert(idDevices.end(), group.second.begin(), group.second.end());
+    }
+
+    auto idHash = buildPerfectHash(idGroups.size(), [&idGroups](size_t i, uint32_t seed)
+        {
+            return DeviceDB::hash(idGroups.at(i).key, seed);
+        }
+    );
+
+    if (!nameHash || !idHash)
+    {
+        std::cerr << "devicegen: could not build the perfect hash tables\n";
+        return EXIT_FAILURE;
+    }
+
+    std::ofstream out(argv[2]);
+    if (!out.is_open())
+    {
+        std::cerr << "devicegen: cannot write " << argv[2] << "\n";
+        return EXIT_FAILURE;
+    }
+
+    out << "// Generated from devices.dat by devicegen, do not edit.\n\n";
+    out << "#pragma once\n\n";
+    out << "#include \"deviceinfo.h\"\n\n";
+    out << "namespace DeviceDB::Generated\n{\n\n";
+
+    out << "inline constexpr std::array<DeviceInfo, " << devices.size() << "> c_devices =\n{{\n";
+    for(auto const &dev : devices)
+    {
+        out << "    {\"" << dev.name << "\", " << dev.flashMemSize << ", " << dev.flashPageSize << ", ";
+        out << dev.family->configSize << ", 0x" << std::hex << dev.deviceId << ", 0x" << dev.deviceIdMask;
+        out << std::dec << ", DeviceFamily::" << dev.family->name << "},\n";
+    }
+    out << "}};\n\n";
+
+    writeArray(out, "uint16_t", "c_nameSeeds", nameHash->seeds);
+    writeArray(out, "uint16_t", "c_nameSlots", nameHash->slots);
+
+    out << "inline constexpr std::array<uint32_t, " << masks.size() << "> c_idMasks =\n{\n   ";
+    for(auto mask : masks)
+    {
+        out << " 0x" << std::hex << mask << std::dec << ",";
+    }
+    out << "\n};\n\n";
+
+    out << "inline constexpr std::array<IdGroup, " << idGroups.size() << "> c_idGroups =\n{{\n";
+    for(auto const &group : idGroups)
+    {
+        out << "    {0x" << std::hex << group.key << std::dec << ", " << group.first << ", " << group.count << "},\n";
+    }
+    out << "}};\n\n";
+
+    writeArray(out, "uint16_t", "c_idDevices", idDevices);
+    writeArray(out, "uint16_t", "c_idSeeds", idHash->seeds);
+    writeArray(out, "uint16_t", "c_idSlots", idHash->slots);
+
+    out << "};\n";
+    return out.good() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -117,7 +117,7 @@ std::string Utils::toLower(const std::string &str)
     return result;
 }
 
-bool Utils::isEmptyMem(const std::vector<uint8_t> &mem, size_t start, size_t len)
+bool Utils::isEmptyMem(std::span<const uint8_t> mem, size_t start, size_t len)
 {
     if ((len & 1) != 0)
     {
@@ -125,10 +125,16 @@ bool Utils::isEmptyMem(const std::vector<uint8_t> &mem, size_t start, size_t len
         return false;
     }
 
+    if ((start + len) > mem.size())
+    {
+        std::cerr << "Error: isEmptyMem called with a range outside the memory\n";
+        return false;
+    }
+
     while(len > 0)
     {
-        auto low = static_cast<uint16_t>(mem.at(start));
-        auto hi  = static_cast<uint16_t>(mem.at(start+1));
+        auto low = static_cast<uint16_t>(mem[start]);
+        auto hi  = static_cast<uint16_t>(mem[start+1]);
 
         //FIXME: for PIC16, the program word is 14 bits
         //       so we need to check against 0x3FFF
@@ -146,7 +152,7 @@ bool Utils::isEmptyMem(const std::vector<uint8_t> &mem, size_t start, size_t len
     return true;
 }
 
-bool Utils::isEmptyMem(const std::vector<uint8_t> &mem)
+bool Utils::isEmptyMem(std::span<const uint8_t> mem)
 {
     auto len = mem.size();
     return isEmptyMem(mem, 0, len);
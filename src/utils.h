@@ -5,6 +5,7 @@
 #include <optional>
 #include <string>
 #include <vector>
+#include <span>
 
 namespace Utils
 {
@@ -18,6 +19,6 @@ namespace Utils
     std::optional<uint32_t> hexStrToUint32(const std::string &str);
     std::vector<std::string> tokenize(const std::string &str, const char delim);
 
-    bool isEmptyMem(const std::vector<uint8_t> &mem, size_t start, size_t len);
-    bool isEmptyMem(const std::vector<uint8_t> &mem);
+    bool isEmptyMem(std::span<const uint8_t> mem, size_t start, size_t len);
+    bool isEmptyMem(std::span<const uint8_t> mem);
 };
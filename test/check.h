@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#pragma once
+#include <cstdlib>
+#include <iostream>
+
+/** checks for the unit tests. A failed check is reported and the test
+    goes on, so one run shows every failure. Each test is a program that
+    returns testResult() from main().
+*/
+inline int g_failedChecks = 0;
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition "\n"; \
+            g_failedChecks++; \
+        } \
+    } while(0)
+
+inline int testResult()
+{
+    if (g_failedChecks > 0)
+    {
+        std::cerr << g_failedChecks << " checks failed\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
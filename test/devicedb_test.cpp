@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "check.h"
+#include "devicedb.h"
+#include "utils.h"
+
+// the lookups run at compile time
+static_assert(DeviceDB::findByName("16f1509") != nullptr);
+static_assert(DeviceDB::findByName("16f1509")->deviceId == 0x2D40);
+static_assert(DeviceDB::findByName("no such device") == nullptr);
+
+/** index of the ID mask of a device in DeviceDB::idMasks() */
+static size_t maskIndex(const DeviceInfo &device)
+{
+    auto masks = DeviceDB::idMasks();
+    return std::find(masks.begin(), masks.end(), device.deviceIdMask) - masks.begin();
+}
+
+/** every device in devices.dat is found by its name, with the values of the file */
+static void testNames()
+{
+    std::ifstream deviceFile(DEVICES_DAT);
+    CHECK(deviceFile.is_open());
+
+    size_t count = 0;
+    std::string line;
+    while(std::getline(deviceFile, line))
+    {
+        if ((line.size() <= 2) || (line.at(0) == '#'))
+        {
+            continue;
+        }
+
+        std::istringstream columns(line);
+        std::string name, flashBytes, pageBytes, id, mask, family;
+        columns >> name >> flashBytes >> pageBytes >> id >> mask >> family;
+        count++;
+
+        const auto *device = DeviceDB::findByName(Utils::toLower(name));
+        CHECK(device != nullptr);
+        if (device == nullptr)
+        {
+            std::cerr << "  " << name << " not found\n";
+            continue;
+        }
+
+        CHECK(device->deviceName == Utils::toLower(name));
+        CHECK(device->flashMemSize  == std::stoul(flashBytes) / 2);
+        CHECK(device->flashPageSize == std::stoul(pageBytes) / 2);
+        CHECK(device->deviceId      == std::stoul(id, nullptr, 16));
+        CHECK(device->deviceIdMask  == std::stoul(mask, nullptr, 16));
+        CHECK(familyName(device->deviceFamily) == family);
+    }
+
+    CHECK(count == DeviceDB::devices().size());
+}
+
+/** every device is found by its ID, together with the devices that share it */
+static void testIds()
+{
+    const auto devices = DeviceDB::devices();
+    for(size_t index = 0; index < devices.size(); index++)
+    {
+        auto const &device = devices[index];
+        const size_t mask = maskIndex(device);
+        CHECK(mask < DeviceDB::idMasks().size());
+        if (mask >= DeviceDB::idMasks().size())
+        {
+            continue;
+        }
+
+        // the bits outside the mask are the revision of the device
+        const uint32_t readId = device.deviceId | (~device.deviceIdMask & 0x3FFF);
+        const auto matches = DeviceDB::findById(mask, readId);
+        CHECK(std::find(matches.begin(), matches.end(), index) != matches.end());
+
+        for(auto match : matches)
+        {
+            CHECK((devices[match].deviceIdMask == device.deviceIdMask) &&
+                ((devices[match].deviceId & device.deviceIdMask) == (device.deviceId & device.deviceIdMask)));
+        }
+    }
+
+    // IDs that no device has
+    for(size_t mask = 0; mask < DeviceDB::idMasks().size(); mask++)
+    {
+        CHECK(DeviceDB::findById(mask, 0x0000).empty());
+    }
+}
+
+static void testUnknownNames()
+{
+    CHECK(DeviceDB::findByName("") == nullptr);
+    CHECK(DeviceDB::findByName("16f") == nullptr);
+    CHECK(DeviceDB::findByName("16f15090") == nullptr);
+    CHECK(DeviceDB::findByName("16F1509") == nullptr);     // names are looked up in lower case
+}
+
+int main()
+{
+    testNames();
+    testIds();
+    testUnknownNames();
+    return testResult();
+}
@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "check.h"
+#include "framing.h"
+
+static std::vector<uint8_t> encode(const std::vector<uint8_t> &data)
+{
+    std::vector<uint8_t> encoded;
+    Framing::cobsEncode(data.data(), data.size(), [&encoded](uint8_t c)
+    {
+        encoded.push_back(c);
+    });
+    return encoded;
+}
+
+/** encodes without delimiters within the worst case size,
+    and decodes back to the original data */
+static void checkRoundTrip(const std::vector<uint8_t> &data)
+{
+    auto encoded = encode(data);
+    CHECK(encoded.size() <= Framing::maxEncodedSize(data.size()));
+    CHECK(std::find(encoded.begin(), encoded.end(), Framing::c_delimiter) == encoded.end());
+
+    std::vector<uint8_t> decoded(encoded.size());
+    const size_t len = Framing::cobsDecode(encoded.data(), encoded.size(), decoded.data());
+    decoded.resize(len);
+    CHECK(decoded == data);
+}
+
+static std::vector<uint8_t> nonZero(size_t len)
+{
+    std::vector<uint8_t> data(len);
+    for(size_t i=0; i<len; i++)
+    {
+        data[i] = static_cast<uint8_t>(1 + i % 255);
+    }
+    return data;
+}
+
+/** zeros at the start, the end and in runs */
+static void testZeroRuns()
+{
+    checkRoundTrip({0});
+    checkRoundTrip({0, 0, 0, 0});
+    checkRoundTrip({1, 2, 3});
+    checkRoundTrip({1, 2, 3, 0});
+    checkRoundTrip({0, 1, 2, 3});
+    checkRoundTrip({1, 0, 0, 2, 0, 0, 0, 3});
+
+    CHECK((encode({0}) == std::vector<uint8_t>{1, 1}));
+    CHECK((encode({1, 0, 0, 2}) == std::vector<uint8_t>{2, 1, 1, 2, 2}));
+
+    // a request as it goes over the wire: opcode, length, payload, trailer
+    std::vector<uint8_t> frame(Framing::c_maxRawSize, 0);
+    frame[0] = 0x10;
+    frame[1] = 0xFF;
+    frame[100] = 0x3F;
+    checkRoundTrip(frame);
+}
+
+/** a code byte covers at most 254 data bytes */
+static void testLongBlocks()
+{
+    for(size_t len : {253, 254, 255, 256, 508, 509})
+    {
+        checkRoundTrip(nonZero(len));
+
+        auto data = nonZero(len);
+        data.push_back(0);
+        checkRoundTrip(data);
+    }
+
+    auto encoded = encode(nonZero(254));
+    CHECK(encoded.size() == 255);
+    CHECK(encoded[0] == 0xFF);
+
+    encoded = encode(nonZero(255));
+    CHECK(encoded.size() == 257);
+    CHECK(encoded[0] == 0xFF);
+    CHECK(encoded[255] == 2);
+}
+
+/** the firmware decodes its receive buffer in place */
+static void testInPlace()
+{
+    std::vector<uint8_t> data = nonZero(300);
+    data[0]   = 0;
+    data[10]  = 0;
+    data[11]  = 0;
+    data[299] = 0;
+
+    auto buffer = encode(data);
+    const size_t len = Framing::cobsDecode(buffer.data(), buffer.size(), buffer.data());
+    CHECK(len == data.size());
+    CHECK(std::equal(data.begin(), data.end(), buffer.begin()));
+}
+
+static void testCorrupt()
+{
+    uint8_t dst[16];
+
+    const uint8_t zeroCode[] = {2, 1, 0, 1};
+    CHECK(Framing::cobsDecode(zeroCode, sizeof(zeroCode), dst) == 0);
+
+    const uint8_t pastEnd[] = {5, 1, 2};
+    CHECK(Framing::cobsDecode(pastEnd, sizeof(pastEnd), dst) == 0);
+
+    const uint8_t embeddedZero[] = {4, 1, 0, 2};
+    CHECK(Framing::cobsDecode(embeddedZero, sizeof(embeddedZero), dst) == 0);
+}
+
+/** the standard check values over "123456789" */
+static void testCrc()
+{
+    const char *check = "123456789";
+    auto data = reinterpret_cast<const uint8_t *>(check);
+
+    CHECK(Framing::crc16(data, strlen(check)) == 0x29B1);
+    CHECK(Framing::crc32(data, strlen(check)) == 0xCBF43926);
+
+    // crc16 continues from a previous value
+    const uint16_t first = Framing::crc16(data, 4);
+    CHECK(Framing::crc16(data + 4, strlen(check) - 4, first) == 0x29B1);
+
+    CHECK(Framing::crc16(data, 0) == Framing::c_crcInit);
+}
+
+int main()
+{
+    testZeroRuns();
+    testLongBlocks();
+    testInPlace();
+    testCorrupt();
+    testCrc();
+    return testResult();
+}
@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "check.h"
+#include "hexreader.h"
+#include "hexwriter.h"
+
+constexpr size_t c_flashWords  = 2048;
+constexpr size_t c_pageWords   = 32;
+constexpr size_t c_configBytes = 4;
+
+/** a small program with two configuration words */
+constexpr const char *c_hexText =
+    ":020000040000FA\r\n"
+    ":040000008C31022815\r\n"
+    ":080020000130A000FF3F123483\r\n"
+    ":020000040001F9\r\n"
+    ":04000E00E43FFF1FAD\r\n"
+    ":00000001FF\r\n";
+
+static void testParse()
+{
+    MemoryImage flash(c_flashWords, c_pageWords);
+    std::vector<uint8_t> config(c_configBytes, 0xFF);
+    CHECK(HexReader::parse(c_hexText, flash, config));
+
+    CHECK(flash.word(0) == 0x318C);
+    CHECK(flash.word(1) == 0x2802);
+    CHECK(flash.word(2) == 0x3FFF);
+    CHECK(flash.word(16) == 0x3001);
+    CHECK(flash.word(17) == 0x00A0);
+    CHECK(flash.word(19) == 0x3412);
+    CHECK(flash.usedPages() == std::vector<size_t>({0}));
+    CHECK(config == std::vector<uint8_t>({0xE4, 0x3F, 0xFF, 0x1F}));
+}
+
+/** lower case digits decode like upper case ones, text between records is skipped */
+static void testLowerCase()
+{
+    MemoryImage flash(c_flashWords, c_pageWords);
+    std::vector<uint8_t> config(c_configBytes, 0xFF);
+    CHECK(HexReader::parse("; generated\n:040000008c31022815\n:00000001ff\n", flash, config));
+    CHECK(flash.word(0) == 0x318C);
+    CHECK(flash.word(1) == 0x2802);
+}
+
+static void testErrors()
+{
+    MemoryImage flash(c_flashWords, c_pageWords);
+    std::vector<uint8_t> config(c_configBytes, 0xFF);
+
+    // checksum
+    CHECK(!HexReader::parse(":040000008C31022816\n", flash, config));
+
+    // characters that are not hex digits, in the header and in the data
+    CHECK(!HexReader::parse(":04G000008C31022815\n", flash, config));
+    CHECK(!HexReader::parse(":040000008C3102281G\n", flash, config));
+    CHECK(!HexReader::parse(":04000000 C31022815\n", flash, config));
+
+    // records that end early
+    CHECK(!HexReader::parse(":0400000\n", flash, config));
+    CHECK(!HexReader::parse(":040000008C3102\n", flash, config));
+
+    // an extended address record must hold two bytes
+    CHECK(!HexReader::parse(":0100000400FB\n", flash, config));
+
+    // unknown record type
+    CHECK(!HexReader::parse(":00000007F9\n", flash, config));
+
+    // more configuration words than the target has
+    CHECK(!HexReader::parse(":020000040001F9\n:06000E00E43FFF1FFF3F6D\n", flash, config));
+}
+
+/** what HexWriter writes, HexReader reads back */
+static void testRoundTrip()
+{
+    MemoryImage flash(c_flashWords, c_pageWords);
+    for(size_t address = 100; address < 300; address += 3)
+    {
+        flash.setByte(address*2, static_cast<uint8_t>(address));
+        flash.setByte(address*2 + 1, static_cast<uint8_t>(address >> 8) & 0x3F);
+    }
+    flash.setByte(2*(c_flashWords - 1), 0x00);
+    const std::vector<uint8_t> config = {0xE4, 0x3F, 0xFF, 0x1F};
+
+    const auto filename = (std::filesystem::temp_directory_path() /
+        ("picmeup_hexreader_test_" + std::to_string(getpid()) + ".hex")).string();
+
+    HexWriter writer;
+    CHECK(writer.open(filename));
+    for(size_t page = 0; page < flash.pageCount(); page++)
+    {
+        CHECK(writer.write(page*flash.pageBytes(), flash.page(page)));
+    }
+    CHECK(writer.write(0x1000E, config, false));
+    CHECK(writer.close());
+
+    MemoryImage readBack(c_flashWords, c_pageWords);
+    std::vector<uint8_t> readConfig(c_configBytes, 0xFF);
+    CHECK(HexReader::read(filename, readBack, readConfig));
+    std::filesystem::remove(filename);
+
+    for(size_t page = 0; page < flash.pageCount(); page++)
+    {
+        CHECK(readBack.pageCrc(page) == flash.pageCrc(page));
+    }
+    CHECK(readBack.usedPages() == flash.usedPages());
+    CHECK(readConfig == config);
+}
+
+int main()
+{
+    testParse();
+    testLowerCase();
+    testErrors();
+    testRoundTrip();
+    return testResult();
+}
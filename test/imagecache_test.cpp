@@ -0,0 +1,150 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "check.h"
+#include "imagecache.h"
+#include "devicedb.h"
+
+namespace fs = std::filesystem;
+
+/** a flash image and configuration sized for a target */
+struct Image
+{
+    explicit Image(const DeviceInfo &info)
+        : flash(info.flashMemSize, info.flashPageSize),
+          config(info.configSize*2, 0xFF) {}
+
+    MemoryImage          flash;
+    std::vector<uint8_t> config;
+};
+
+static void writeFile(const fs::path &filename, const std::string &contents)
+{
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    out << contents;
+}
+
+static std::vector<fs::path> pimgFiles(const fs::path &dir)
+{
+    std::vector<fs::path> files;
+    for(auto const &entry : fs::directory_iterator(dir))
+    {
+        if (entry.path().extension() == ".pimg")
+        {
+            files.push_back(entry.path());
+        }
+    }
+    return files;
+}
+
+static bool sameImage(const Image &a, const Image &b)
+{
+    for(size_t page = 0; page < a.flash.pageCount(); page++)
+    {
+        if (a.flash.pageCrc(page) != b.flash.pageCrc(page))
+        {
+            return false;
+        }
+    }
+    return (a.flash.usedPages() == b.flash.usedPages()) && (a.config == b.config);
+}
+
+static ImageCache::LoadResult load(const fs::path &hexFile, const DeviceInfo &info, Image &image,
+    bool useCache = true)
+{
+    return ImageCache::load(hexFile.string(), info, image.flash, image.config, useCache);
+}
+
+int main()
+{
+    const auto dir = fs::temp_directory_path() / ("picmeup_imagecache_test_" + std::to_string(getpid()));
+    fs::create_directories(dir);
+    setenv("PICMEUP_CACHE", dir.c_str(), 1);
+    CHECK(ImageCache::cacheDirectory() == dir.string());
+
+    const auto *info = DeviceDB::findByName("16f1509");
+    CHECK(info != nullptr);
+    if (info == nullptr)
+    {
+        return testResult();
+    }
+
+    const auto hexFile = dir / "program.hex";
+    writeFile(hexFile,
+        ":040000008C31022815\n"
+        ":080020000130A000FF3F123483\n"
+        ":020000040001F9\n"
+        ":04000E00E43FFF1FAD\n"
+        ":00000001FF\n");
+
+    // the first load parses and stores the image, the second maps it
+    Image parsed(*info);
+    CHECK(load(hexFile, *info, parsed) == ImageCache::LoadResult::Parsed);
+    CHECK(pimgFiles(dir).size() == 1);
+
+    Image cached(*info);
+    CHECK(load(hexFile, *info, cached) == ImageCache::LoadResult::Cached);
+    CHECK(sameImage(parsed, cached));
+    CHECK(cached.flash.word(16) == 0x3001);
+    CHECK(cached.config.at(0) == 0xE4);
+
+    // another target gets an image of its own
+    if (const auto *other = DeviceDB::findByName("16f1508"); other != nullptr)
+    {
+        Image otherImage(*other);
+        CHECK(load(hexFile, *other, otherImage) == ImageCache::LoadResult::Parsed);
+        CHECK(pimgFiles(dir).size() == 2);
+    }
+
+    // a changed HEX file is parsed again
+    writeFile(hexFile,
+        ":040000008C31032814\n"
+        ":00000001FF\n");
+    Image changed(*info);
+    CHECK(load(hexFile, *info, changed) == ImageCache::LoadResult::Parsed);
+    CHECK(changed.flash.word(1) == 0x2803);
+    CHECK(changed.flash.word(16) == 0x3FFF);
+
+    Image changedCached(*info);
+    CHECK(load(hexFile, *info, changedCached) == ImageCache::LoadResult::Cached);
+    CHECK(sameImage(changed, changedCached));
+
+    // a damaged cache file is not used
+    for(auto const &pimg : pimgFiles(dir))
+    {
+        fs::resize_file(pimg, fs::file_size(pimg) - 1);
+    }
+    Image afterDamage(*info);
+    CHECK(load(hexFile, *info, afterDamage) == ImageCache::LoadResult::Parsed);
+    CHECK(sameImage(changed, afterDamage));
+
+    // a .pimg file is only restored for the hash and size it was stored with
+    const auto pimg = (dir / "direct.pimg").string();
+    CHECK(ImageCache::store(pimg, 0x1234, 100, parsed.flash, parsed.config));
+    Image restored(*info);
+    CHECK(ImageCache::restore(pimg, 0x1234, 100, restored.flash, restored.config));
+    CHECK(sameImage(parsed, restored));
+
+    Image wrongHash(*info);
+    CHECK(!ImageCache::restore(pimg, 0x1235, 100, wrongHash.flash, wrongHash.config));
+    CHECK(!ImageCache::restore(pimg, 0x1234, 101, wrongHash.flash, wrongHash.config));
+
+    // or for an image of the same size
+    MemoryImage smaller(info->flashMemSize / 2, info->flashPageSize);
+    CHECK(!ImageCache::restore(pimg, 0x1234, 100, smaller, wrongHash.config));
+
+    // without the cache the file is always parsed
+    Image uncached(*info);
+    CHECK(load(hexFile, *info, uncached, false) == ImageCache::LoadResult::Parsed);
+
+    CHECK(load(dir / "missing.hex", *info, uncached) == ImageCache::LoadResult::Error);
+
+    fs::remove_all(dir);
+    return testResult();
+}
@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include <array>
+#include <vector>
+#include "check.h"
+#include "memoryimage.h"
+#include "framing.h"
+
+static uint32_t crcOf(std::span<const uint8_t> data)
+{
+    return Framing::crc32(data.data(), data.size());
+}
+
+/** a new image reads as blank and has no storage for its pages */
+static void testBlank()
+{
+    MemoryImage image(100, 16);
+    CHECK(image.pageCount() == 7);
+    CHECK(image.pageBytes() == 32);
+    CHECK(image.blankWord() == 0x3FFF);
+    CHECK(image.usedPages().empty());
+
+    const std::vector<uint8_t> blankPage(16, 0);
+    for(size_t page = 0; page < image.pageCount(); page++)
+    {
+        CHECK(image.isPageBlank(page));
+        CHECK(image.page(page).size() == image.pageBytes());
+        CHECK(image.pageCrc(page) == crcOf(image.page(0)));
+    }
+    CHECK(image.word(99) == 0x3FFF);
+
+    MemoryImage zeroes(32, 8, 0x0000);
+    CHECK(zeroes.word(5) == 0x0000);
+    CHECK(zeroes.pageCrc(1) == crcOf(blankPage));
+}
+
+/** only the pages that are written hold data */
+static void testSparsePages()
+{
+    MemoryImage image(1024, 32);
+
+    // crosses from page 1 into page 2
+    const std::array<uint8_t, 6> data = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06};
+    CHECK(image.setBytes(2*62, data) == data.size());
+    CHECK(image.word(62) == 0x0201);
+    CHECK(image.word(63) == 0x0403);
+    CHECK(image.word(64) == 0x0605);
+    CHECK(image.word(65) == 0x3FFF);
+    CHECK(image.usedPages() == std::vector<size_t>({1, 2}));
+    CHECK(!image.isPageBlank(1));
+    CHECK(image.isPageBlank(0));
+
+    CHECK(image.setByte(2*1023 + 1, 0x12));
+    CHECK(image.word(1023) == 0x12FF);
+    CHECK(image.usedPages() == std::vector<size_t>({1, 2, 31}));
+
+    // writing the blank value back leaves the page blank, but it keeps its storage
+    CHECK(image.setByte(2*1023 + 1, 0x3F));
+    CHECK(image.isPageBlank(31));
+    CHECK(image.usedPages() == std::vector<size_t>({1, 2}));
+}
+
+/** writes that reach past the end of the image are cut off */
+static void testEnd()
+{
+    MemoryImage image(40, 16);
+    const std::vector<uint8_t> data(8, 0x55);
+    CHECK(image.setBytes(2*38, data) == 4);
+    CHECK(image.word(39) == 0x5555);
+    CHECK(image.setBytes(2*40, data) == 0);
+    CHECK(!image.setByte(2*40, 0x00));
+    CHECK(image.usedPages() == std::vector<size_t>({2}));
+}
+
+/** the CRC of a page is cached until the page is written again */
+static void testCrcCache()
+{
+    MemoryImage image(64, 16);
+    const std::array<uint8_t, 2> word = {0x34, 0x12};
+    image.setBytes(2*17, word);
+
+    const uint32_t crc = image.pageCrc(1);
+    CHECK(crc == crcOf(image.page(1)));
+    CHECK(crc != image.pageCrc(0));
+
+    image.setByte(2*17, 0x35);
+    CHECK(image.pageCrc(1) != crc);
+    CHECK(image.pageCrc(1) == crcOf(image.page(1)));
+
+    // after updateCache() the const functions only read the cache
+    image.setByte(2*18, 0x00);
+    image.updateCache();
+    CHECK(image.pageCrc(1) == crcOf(image.page(1)));
+}
+
+/** a page stored with its CRC, as the image cache does, keeps that CRC */
+static void testSetPage()
+{
+    MemoryImage image(64, 16);
+    std::vector<uint8_t> data(image.pageBytes(), 0x3F);
+    data.at(0) = 0x00;
+
+    image.setPage(2, data, 0x12345678);
+    CHECK(image.pageCrc(2) == 0x12345678);
+    CHECK(!image.isPageBlank(2));
+    CHECK(image.word(32) == 0x3F00);
+    CHECK(image.usedPages() == std::vector<size_t>({2}));
+
+    // a later write computes the CRC again
+    image.setByte(2*33, 0x00);
+    CHECK(image.pageCrc(2) == crcOf(image.page(2)));
+
+    std::vector<uint8_t> blank(image.pageBytes());
+    std::copy(image.page(0).begin(), image.page(0).end(), blank.begin());
+    image.setPage(3, blank, image.pageCrc(0));
+    CHECK(image.isPageBlank(3));
+}
+
+int main()
+{
+    testBlank();
+    testSparsePages();
+    testEnd();
+    testCrcCache();
+    testSetPage();
+    return testResult();
+}
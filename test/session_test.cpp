@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// Copyright N.A. Moseley 2022
+
+#include <vector>
+#include "check.h"
+#include "session.h"
+#include "devicedb.h"
+
+using Pages = std::vector<size_t>;
+
+/** 8 word pages: a block of 32 words holds four of them */
+static void testSmallPages()
+{
+    const auto *info = DeviceDB::findByName("16f1826");
+    CHECK((info != nullptr) && (info->flashPageSize == 8));
+    if (info == nullptr)
+    {
+        return;
+    }
+    CHECK(eraseBlockWords(*info) == 32);
+
+    // one changed page: the whole block is erased and written again
+    const Pages changed = {5};
+    auto result = Session::eraseBlocksOf(*info, changed);
+    CHECK(result.blocks == Pages({1}));
+    CHECK(result.pages == Pages({4, 5, 6, 7}));
+
+    // pages in the same block are grouped, blocks stay in order
+    const Pages several = {0, 3, 4, 9, 10};
+    result = Session::eraseBlocksOf(*info, several);
+    CHECK(result.blocks == Pages({0, 1, 2}));
+    CHECK(result.pages == Pages({0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}));
+}
+
+/** 16 word pages: two per block */
+static void testMediumPages()
+{
+    const auto *info = DeviceDB::findByName("16f1509");
+    CHECK((info != nullptr) && (info->flashPageSize == 16));
+    if (info == nullptr)
+    {
+        return;
+    }
+
+    const Pages changed = {1, 2, 7};
+    auto result = Session::eraseBlocksOf(*info, changed);
+    CHECK(result.blocks == Pages({0, 1, 3}));
+    CHECK(result.pages == Pages({0, 1, 2, 3, 6, 7}));
+
+    // the last block ends at the end of flash
+    const size_t lastPage = info->flashMemSize / info->flashPageSize - 1;
+    const Pages last = {lastPage};
+    result = Session::eraseBlocksOf(*info, last);
+    CHECK(result.pages == Pages({lastPage - 1, lastPage}));
+}
+
+/** 32 word pages: a block is a page */
+static void testLargePages()
+{
+    const auto *info = DeviceDB::findByName("16f1454");
+    CHECK((info != nullptr) && (info->flashPageSize == 32));
+    if (info == nullptr)
+    {
+        return;
+    }
+
+    const Pages changed = {2, 3, 40};
+    auto result = Session::eraseBlocksOf(*info, changed);
+    CHECK(result.blocks == changed);
+    CHECK(result.pages == changed);
+}
+
+/** families that cannot erase rows have no blocks */
+static void testNoRowErase()
+{
+    const auto *info = DeviceDB::findByName("16f627a");
+    CHECK(info != nullptr);
+    if (info == nullptr)
+    {
+        return;
+    }
+
+    CHECK(eraseBlockWords(*info) == 0);
+    const Pages changed = {0, 1};
+    auto result = Session::eraseBlocksOf(*info, changed);
+    CHECK(result.blocks.empty());
+    CHECK(result.pages.empty());
+}
+
+/** every device that can erase rows has whole pages in a block */
+static void testAllDevices()
+{
+    for(auto const &device : DeviceDB::devices())
+    {
+        const size_t blockWords = eraseBlockWords(device);
+        CHECK((blockWords == 0) || ((blockWords % device.flashPageSize) == 0));
+    }
+}
+
+/** a partial update keeps the words of a block that are not in the image */
+static void testPartialBlock()
+{
+    const auto *info = DeviceDB::findByName("16f1826");
+    CHECK(info != nullptr);
+    if (info == nullptr)
+    {
+        return;
+    }
+
+    // the HEX file only touches two words of page 5
+    MemoryImage flash(info->flashMemSize, info->flashPageSize);
+    const std::vector<uint8_t> data = {0x34, 0x12, 0x78, 0x16};
+    flash.setBytes(2*41, data);
+
+    const auto usedPages = flash.usedPages();
+    const auto blocks = Session::eraseBlocksOf(*info, usedPages);
+    CHECK(blocks.blocks == Pages({1}));
+    CHECK(blocks.pages == Pages({4, 5, 6, 7}));
+
+    // the device contents of the block, as read back
+    const size_t address = 32;
+    std::vector<uint8_t> device(2*eraseBlockWords(*info));
+    for(size_t i = 0; i < device.size(); i++)
+    {
+        device.at(i) = static_cast<uint8_t>(i) & 0x3F;
+    }
+    const auto before = device;
+
+    Session::mergeImage(flash, address, device);
+    for(size_t word = 0; word < (device.size() / 2); word++)
+    {
+        const bool inImage = ((address + word) == 41) || ((address + word) == 42);
+        const uint16_t got = device.at(2*word) | (static_cast<uint16_t>(device.at(2*word+1)) << 8);
+        const uint16_t old = before.at(2*word) | (static_cast<uint16_t>(before.at(2*word+1)) << 8);
+        CHECK(got == (inImage ? flash.word(address + word) : old));
+    }
+}
+
+int main()
+{
+    testSmallPages();
+    testMediumPages();
+    testLargePages();
+    testNoRowErase();
+    testAllDevices();
+    testPartialBlock();
+    return testResult();
+}